@@ -0,0 +1,457 @@
+// Accuracy-vs-cost harness for the Barnes-Hut model.
+// Each distribution is generated from its fixed seed, reference accelerations are computed with the
+// brute-force model, and the Barnes-Hut model is evaluated over a grid of opening angles and
+// critical cell sizes with both force kernels.
+//
+// Usage: nbody2_accuracy [--n 10000] [--theta 0.5,0.7,0.9,1.1] [--crit 8,16,32,64] [--reps 3]
+//                        [--out results.csv] [--check baseline.csv] [--tolerance 0.05]
+//
+// Results are written as CSV with one row per distribution, opening angle, critical size and kernel:
+//   distribution,n,theta,crit_size,kernel,rms_err,p99_err,median_ms
+// where the errors are relative to the magnitude of the reference acceleration of each body.
+// With --check, every row is compared with the matching row of the baseline and the program fails if
+// either error has grown by more than the tolerance. Wall times are reported but never compared.
+// Trees left with one body or none by removing bodies are evaluated first, and must give no force.
+// Bodies are then added to a running simulation of each model and integrator, past the capacity of its
+// arrays, and the simulation stepped, which must keep every body's id and give finite states.
+
+#include "BenchCommon.h"
+#include "BHTreeNode.h"
+#include "Error.h"
+#include "ModelBarnesHut.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+
+using namespace nbody;
+using namespace nbody::bench;
+
+namespace
+{
+	// the root node is enlarged until at most this fraction of bodies lie outside it, as in a running simulation
+	double constexpr s_MAX_RENEGADE_FRAC = 0.01;
+	size_t constexpr s_MAX_WARMUP_EVALS = 50;
+
+	struct Options
+	{
+		size_t n = 10000;
+		std::vector<double> theta_list{ 0.5, 0.7, 0.9, 1.1 };
+		std::vector<size_t> crit_list{ 8, 16, 32, 64 };
+		size_t reps = 3;
+		std::string out_file;
+		std::string baseline_file;
+		double tolerance = 0.05;
+	};
+
+	Options parseOptions(int argc, char** argv)
+	{
+		Options opts;
+		for (auto i = 1; i < argc; i++)
+		{
+			auto arg = std::string(argv[i]);
+			if (i + 1 >= argc)
+				throw MAKE_ERROR("Missing value for option " + arg);
+			auto value = std::string(argv[++i]);
+
+			if (arg == "--n")
+				opts.n = std::stoull(value);
+			else if (arg == "--theta")
+				opts.theta_list = parseRealList(value);
+			else if (arg == "--crit")
+				opts.crit_list = parseList(value);
+			else if (arg == "--reps")
+				opts.reps = std::max<size_t>(1, std::stoull(value));
+			else if (arg == "--out")
+				opts.out_file = value;
+			else if (arg == "--check")
+				opts.baseline_file = value;
+			else if (arg == "--tolerance")
+				opts.tolerance = std::stod(value);
+			else
+				throw MAKE_ERROR("Unknown option " + arg);
+		}
+		return opts;
+	}
+
+	struct Result
+	{
+		std::string dist;
+		size_t n;
+		double theta;
+		size_t crit_size;
+		std::string kernel;
+		double rms_err;
+		double p99_err;
+		double median_ms;
+	};
+
+	using Key = std::tuple<std::string, size_t, std::string, size_t, std::string>;
+
+	// theta is keyed by its printed form so that values read back from a file compare equal
+	std::string formatTheta(double const theta)
+	{
+		std::stringstream ss;
+		ss << std::setprecision(6) << theta;
+		return ss.str();
+	}
+
+	Key makeKey(Result const& r)
+	{
+		return Key{ r.dist, r.n, formatTheta(r.theta), r.crit_size, r.kernel };
+	}
+
+	void writeHeader(std::ostream& out)
+	{
+		out << "distribution,n,theta,crit_size,kernel,rms_err,p99_err,median_ms\n";
+	}
+
+	void writeResult(std::ostream& out, Result const& r)
+	{
+		out << r.dist << ',' << r.n << ',' << formatTheta(r.theta) << ',' << r.crit_size << ',' << r.kernel << ','
+			<< std::setprecision(6) << r.rms_err << ',' << r.p99_err << ',' << r.median_ms << '\n' << std::flush;
+	}
+
+	std::map<Key, Result> readBaseline(std::string const& file_name)
+	{
+		std::ifstream file(file_name);
+		if (!file.is_open())
+			throw MAKE_ERROR("Could not open file " + file_name);
+
+		std::map<Key, Result> baseline;
+		std::string line;
+		std::getline(file, line); // header
+		while (std::getline(file, line))
+		{
+			if (line.empty())
+				continue;
+
+			std::vector<std::string> fields;
+			std::stringstream ss(line);
+			std::string field;
+			while (std::getline(ss, field, ','))
+				fields.push_back(field);
+			if (fields.size() != 8)
+				throw MAKE_ERROR("Malformed line in " + file_name + ": " + line);
+
+			Result r{ fields[0], std::stoull(fields[1]), std::stod(fields[2]), std::stoull(fields[3]), fields[4],
+					  std::stod(fields[5]), std::stod(fields[6]), std::stod(fields[7]) };
+			baseline[makeKey(r)] = r;
+		}
+		return baseline;
+	}
+
+	std::vector<Vector2d> referenceAccels(DistributorType const dist, size_t const n)
+	{
+		auto model = makeModel(ModelType::BRUTE_FORCE, dist, n, 1e12);
+		std::vector<Vector2d> state(model->getInitialStateVector(), model->getInitialStateVector() + model->getDim());
+		std::vector<Vector2d> deriv(model->getDim());
+
+		// the brute-force model updates both bodies of each pair, so is only exact on one thread
+		auto const num_threads = getNumThreads();
+		setNumThreads(1);
+		model->eval(state.data(), 0, deriv.data());
+		setNumThreads(num_threads);
+
+		auto derivs = reinterpret_cast<ParticleDerivState const*>(deriv.data());
+		std::vector<Vector2d> acc(n);
+		for (size_t i = 0; i < n; i++)
+			acc[i] = derivs[i].acc;
+		return acc;
+	}
+
+	/**
+	 * \brief Get the RMS and 99th percentile of the relative error of each body's acceleration.
+	 */
+	std::pair<double, double> relativeErrors(std::vector<Vector2d> const& ref, ParticleDerivState const* deriv)
+	{
+		std::vector<double> err;
+		err.reserve(ref.size());
+		for (size_t i = 0; i < ref.size(); i++)
+		{
+			auto ref_mag = ref[i].mag();
+			if (ref_mag > 0)
+				err.push_back((deriv[i].acc - ref[i]).mag() / ref_mag);
+		}
+		if (err.empty())
+			return{ 0.0, 0.0 };
+
+		auto sum_sq = 0.0;
+		for (auto e : err)
+			sum_sq += e * e;
+
+		auto p99 = err.begin() + static_cast<std::ptrdiff_t>(0.99 * (err.size() - 1));
+		std::nth_element(err.begin(), p99, err.end());
+		return{ std::sqrt(sum_sq / err.size()), *p99 };
+	}
+
+	void runDistribution(DistributorProperties const& info, Options const& opts, std::vector<Result>& results)
+	{
+		std::cerr << info.name << ": reference\n";
+		auto ref = referenceAccels(info.type, opts.n);
+
+		auto model = makeModel(ModelType::BARNES_HUT, info.type, opts.n, 1e12);
+		auto bh = static_cast<ModelBarnesHut*>(model.get());
+		std::vector<Vector2d> state(model->getInitialStateVector(), model->getInitialStateVector() + model->getDim());
+		std::vector<Vector2d> deriv(model->getDim());
+		auto derivs = reinterpret_cast<ParticleDerivState const*>(deriv.data());
+
+		for (size_t i = 0; i < s_MAX_WARMUP_EVALS; i++)
+		{
+			model->eval(state.data(), 0, deriv.data());
+			if (BHTreeNode::getNumRenegades() <= s_MAX_RENEGADE_FRAC * opts.n)
+				break;
+		}
+
+		for (auto theta : opts.theta_list)
+		{
+			for (auto crit : opts.crit_list)
+			{
+				BHTreeNode::setTheta(theta);
+				BHTreeNode::setCritSize(crit);
+
+				for (auto mixed : { false, true })
+				{
+					bh->setMixedPrecision(mixed);
+
+					std::vector<double> ms;
+					for (size_t r = 0; r < opts.reps; r++)
+						ms.push_back(timeMs([&] { model->eval(state.data(), 0, deriv.data()); }));
+					std::sort(ms.begin(), ms.end());
+
+					auto err = relativeErrors(ref, derivs);
+					results.push_back({ info.name, opts.n, theta, crit, mixed ? "mixed" : "double",
+										err.first, err.second, ms[ms.size() / 2] });
+
+					std::cerr << std::setw(12) << std::left << info.name << " theta=" << theta << " crit=" << crit
+						<< (mixed ? " mixed " : " double") << "  rms " << err.first << "  p99 " << err.second
+						<< "  " << ms[ms.size() / 2] << " ms\n";
+				}
+			}
+		}
+	}
+
+	/**
+	 * \brief Evaluate trees left with no mass, one body and no bodies at all by removing bodies, none of
+	 *		  which may feel a force or produce a value which is not finite.
+	 * \return The number of cases which fail.
+	 */
+	size_t checkSmallTrees()
+	{
+		size_t const n = 64;
+		size_t num_failed = 0;
+		for (auto mixed : { false, true })
+		{
+			auto model = makeModel(ModelType::BARNES_HUT, DistributorType::PLUMMER, n, 1e12);
+			static_cast<ModelBarnesHut*>(model.get())->setMixedPrecision(mixed);
+
+			auto const check = [&](char const* name)
+			{
+				std::vector<Vector2d> deriv(model->getDim());
+				model->eval(model->getInitialStateVector(), 0, deriv.data());
+				auto ok = true;
+				for (auto const& d : deriv)
+					ok = ok && std::isfinite(d.x) && std::isfinite(d.y);
+				// tombstones are still pulled by the live body
+				auto derivs = reinterpret_cast<ParticleDerivState const*>(deriv.data());
+				for (size_t i = 0; i < model->getNumBodies(); i++)
+					ok = ok && (model->getRemoved()[i] || (derivs[i].acc.x == 0 && derivs[i].acc.y == 0));
+				if (!ok)
+				{
+					std::cerr << "FAIL " << name << (mixed ? " mixed" : " double") << ": force without another body\n";
+					num_failed++;
+				}
+			};
+
+			// the model's own arrays are compacted along with the ids, so are evaluated in place
+			for (size_t id = 1; id < n; id++)
+				model->removeBody(id, model->getInitialStateVector());
+			check("one body among tombstones");
+			model->compactBodies();
+			check("one body");
+
+			model->removeBody(0, model->getInitialStateVector());
+			check("only tombstones");
+			model->compactBodies();
+			check("no bodies");
+		}
+		return num_failed;
+	}
+
+	/**
+	 * \brief Add bodies to running simulations, growing their arrays, and step them on. Each model and
+	 *		  integrator must give every body its own id and keep the state finite.
+	 * \return The number of cases which fail.
+	 */
+	size_t checkInsertion()
+	{
+		size_t const n = 64;
+		auto const step = 1e12;
+		size_t num_failed = 0;
+		for (auto model_type : { ModelType::BRUTE_FORCE, ModelType::BARNES_HUT })
+		{
+			for (auto i = 0; i < static_cast<int>(IntegratorType::N_INTEGRATORS); i++)
+			{
+				auto model = makeModel(model_type, DistributorType::PLUMMER, n, step);
+				auto integrator = makeIntegrator(static_cast<IntegratorType>(i), model.get(), step);
+				integrator->setInitialState(model->getInitialStateVector());
+				model->trackConserved(integrator->getStateVector());
+				for (auto s = 0; s < 3; s++)
+					integrator->singleStep();
+
+				// the new bodies are the old ones turned a quarter about the centre, so none coincide
+				auto const capacity = model->getCapacity();
+				auto const num = capacity - n + n / 2;
+				auto const bodies = reinterpret_cast<ParticleState const*>(integrator->getStateVector());
+				std::vector<ParticleState> state(num);
+				std::vector<ParticleAuxState> aux_state(num);
+				for (size_t j = 0; j < num; j++)
+				{
+					auto const& b = bodies[j % n];
+					state[j] = ParticleState({ -b.pos.y, b.pos.x }, { -b.vel.y, b.vel.x });
+					aux_state[j] = model->getAuxState()[j % n];
+				}
+				auto const first = integrator->addBodies(state.data(), aux_state.data(), sf::Color::White, num);
+				for (auto s = 0; s < 5; s++)
+					integrator->singleStep();
+
+				auto ok = first == n && model->getNumBodies() == n + num && model->getCapacity() > capacity
+					&& model->getNumIds() == n + num && model->getDim() == 2 * (n + num);
+				for (size_t id = 0; ok && id < model->getNumIds(); id++)
+					ok = model->getSlot(id) < model->getNumBodies() && model->getId(model->getSlot(id)) == id;
+				auto const after = reinterpret_cast<ParticleState const*>(integrator->getStateVector());
+				for (size_t j = 0; ok && j < model->getNumBodies(); j++)
+				{
+					ok = std::isfinite(after[j].pos.x) && std::isfinite(after[j].pos.y)
+						&& std::isfinite(after[j].vel.x) && std::isfinite(after[j].vel.y);
+				}
+				if (!ok)
+				{
+					std::cerr << "FAIL " << model->getName() << ' ' << integrator->getName()
+						<< ": bodies added past the capacity\n";
+					num_failed++;
+				}
+			}
+		}
+		return num_failed;
+	}
+
+	/**
+	 * \brief Compare results with a baseline, printing each regression.
+	 * \return The number of results which are worse than the baseline allows or have no baseline.
+	 */
+	size_t checkResults(std::vector<Result> const& results, std::map<Key, Result> const& baseline, double const tolerance)
+	{
+		// errors this small are dominated by rounding, so are not compared relatively
+		auto constexpr abs_tolerance = 1e-12;
+
+		size_t num_failed = 0;
+		for (auto const& r : results)
+		{
+			auto it = baseline.find(makeKey(r));
+			if (it == baseline.end())
+			{
+				std::cerr << "FAIL " << r.dist << " theta=" << r.theta << " crit=" << r.crit_size << ' ' << r.kernel
+					<< ": no baseline\n";
+				num_failed++;
+				continue;
+			}
+
+			auto const& b = it->second;
+			auto rms_ok = r.rms_err <= b.rms_err * (1 + tolerance) + abs_tolerance;
+			auto p99_ok = r.p99_err <= b.p99_err * (1 + tolerance) + abs_tolerance;
+			if (!rms_ok || !p99_ok)
+			{
+				std::cerr << "FAIL " << r.dist << " theta=" << r.theta << " crit=" << r.crit_size << ' ' << r.kernel
+					<< ": rms " << r.rms_err << " (baseline " << b.rms_err << "), p99 " << r.p99_err
+					<< " (baseline " << b.p99_err << ")\n";
+				num_failed++;
+			}
+		}
+		return num_failed;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		auto opts = parseOptions(argc, argv);
+
+		// read first so that a bad path fails before the long run
+		std::map<Key, Result> baseline;
+		if (!opts.baseline_file.empty())
+			baseline = readBaseline(opts.baseline_file);
+
+		// likewise, the tree rejects any opening angle or critical size it cannot use
+		for (auto theta : opts.theta_list)
+			BHTreeNode::setTheta(theta);
+		for (auto crit : opts.crit_list)
+			BHTreeNode::setCritSize(crit);
+
+		std::ofstream file;
+		if (!opts.out_file.empty())
+		{
+			file.open(opts.out_file);
+			if (!file.is_open())
+				throw MAKE_ERROR("Could not open file " + opts.out_file);
+		}
+		auto& out = opts.out_file.empty() ? std::cout : file;
+
+		// cheap, so run first
+		auto num_failed = checkSmallTrees();
+		if (num_failed)
+		{
+			std::cerr << num_failed << " cases of trees without bodies failed\n";
+			return 1;
+		}
+		num_failed = checkInsertion();
+		if (num_failed)
+		{
+			std::cerr << num_failed << " cases of adding bodies failed\n";
+			return 1;
+		}
+
+		std::vector<Result> results;
+		for (auto const& info : m_dist_infos)
+		{
+			// needs a particle file
+			if (info.type != DistributorType::FROM_FILE)
+				runDistribution(info, opts, results);
+		}
+
+		writeHeader(out);
+		for (auto const& r : results)
+			writeResult(out, r);
+
+		if (!opts.baseline_file.empty())
+		{
+			auto num_failed = checkResults(results, baseline, opts.tolerance);
+			if (num_failed)
+			{
+				std::cerr << num_failed << " of " << results.size() << " results are less accurate than "
+					<< opts.baseline_file << '\n';
+				return 1;
+			}
+			std::cerr << "All " << results.size() << " results are within " << opts.tolerance * 100
+				<< "% of " << opts.baseline_file << '\n';
+		}
+		return 0;
+	}
+	catch (Error const& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception const& e)
+	{
+		std::cerr << "UNCAUGHT ERROR! " << e.what() << std::endl;
+		return 1;
+	}
+}
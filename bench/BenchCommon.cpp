@@ -0,0 +1,193 @@
+#include "BenchCommon.h"
+#include "ColourerSolid.h"
+#include "DistributorExponential.h"
+#include "DistributorFile.h"
+#include "DistributorIsothermal.h"
+#include "DistributorPlummer.h"
+#include "DistributorRealistic.h"
+#include "Error.h"
+#include "IntegratorADB2.h"
+#include "IntegratorADB6.h"
+#include "IntegratorEuler.h"
+#include "IntegratorEulerImproved.h"
+#include "ModelBarnesHut.h"
+#include "ModelBruteForce.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <sstream>
+
+namespace nbody
+{
+	namespace bench
+	{
+		namespace
+		{
+			// distribution i is generated from seed s_SEED + i
+			uint32_t constexpr s_SEED = 12345;
+		}
+
+		std::vector<size_t> parseList(std::string const& list)
+		{
+			std::vector<size_t> values;
+			std::stringstream ss(list);
+			std::string item;
+			while (std::getline(ss, item, ','))
+			{
+				if (item.empty())
+					continue;
+				if (item.find_first_not_of("0123456789") != std::string::npos)
+					throw MAKE_ERROR("Expected a list of non-negative integers, got " + list);
+				values.push_back(std::stoull(item));
+			}
+			return values;
+		}
+
+		std::vector<double> parseRealList(std::string const& list)
+		{
+			std::vector<double> values;
+			std::stringstream ss(list);
+			std::string item;
+			while (std::getline(ss, item, ','))
+			{
+				if (item.empty())
+					continue;
+				size_t end = 0;
+				try
+				{
+					values.push_back(std::stod(item, &end));
+				}
+				catch (std::exception const&)
+				{
+					end = 0;
+				}
+				if (end != item.size())
+					throw MAKE_ERROR("Expected a list of numbers, got " + list);
+			}
+			return values;
+		}
+
+		BodyGroupProperties makeGroupProperties(DistributorType const type, size_t const n)
+		{
+			BodyGroupProperties bgp;
+			bgp.dist = type;
+			bgp.num = static_cast<int>(n);
+			bgp.radius = 10000;
+			bgp.use_parsecs = true;
+			bgp.min_mass = 1;
+			bgp.max_mass = 10;
+			bgp.has_central_mass = m_dist_infos[static_cast<size_t>(type)].has_central_mass;
+			bgp.central_mass = bgp.has_central_mass ? 1e6 : 0;
+			bgp.colour = ColourerType::SOLID;
+			bgp.cols[0] = sf::Color::White;
+			bgp.seed = s_SEED + static_cast<uint32_t>(type);
+			return bgp;
+		}
+
+		std::unique_ptr<IDistributor> makeDistributor(DistributorType const type)
+		{
+			switch (type)
+			{
+			case DistributorType::EXPONENTIAL:
+				return DistributorExponential::create();
+			case DistributorType::ISOTHERMAL:
+				return DistributorIsothermal::create();
+			case DistributorType::PLUMMER:
+				return DistributorPlummer::create();
+			case DistributorType::REALISTIC:
+				return DistributorRealistic::create();
+			case DistributorType::FROM_FILE:
+				return DistributorFile::create();
+			default:
+				throw MAKE_ERROR("Invalid distributor type");
+			}
+		}
+
+		std::unique_ptr<IIntegrator> makeIntegrator(IntegratorType const type, IModel * model, double const step)
+		{
+			switch (type)
+			{
+			case IntegratorType::EULER:
+				return IntegratorEuler::create(model, step);
+			case IntegratorType::MODIFIED_EULER:
+				return IntegratorEulerImproved::create(model, step);
+			case IntegratorType::ADB2:
+				return IntegratorADB2::create(model, step);
+			case IntegratorType::ADB6:
+				return IntegratorADB6::create(model, step);
+			default:
+				throw MAKE_ERROR("Invalid integrator type");
+			}
+		}
+
+		Bodies makeBodies(DistributorType const type, size_t const n)
+		{
+			Bodies bodies(n);
+			auto data = bodies.data();
+			makeDistributor(type)->createDistribution(data, makeGroupProperties(type, n));
+			return bodies;
+		}
+
+		std::unique_ptr<IModel> makeModel(ModelType const type, DistributorType const dist, size_t const n, double const step)
+		{
+			std::unique_ptr<IModel> model;
+			if (type == ModelType::BARNES_HUT)
+				model = ModelBarnesHut::create();
+			else if (type == ModelType::BRUTE_FORCE)
+				model = ModelBruteForce::create();
+			else
+				throw MAKE_ERROR("Invalid model type");
+
+			model->init(n, step);
+			model->addBodies(*makeDistributor(dist), ColourerSolid::create(), makeGroupProperties(dist, n));
+			return model;
+		}
+
+		Quad boundingQuad(Bodies const& bodies)
+		{
+			auto com = Vector2d{};
+			auto mass = 0.0;
+			for (size_t i = 0; i < bodies.size(); i++)
+			{
+				com += bodies.state[i].pos * bodies.aux[i].mass;
+				mass += bodies.aux[i].mass;
+			}
+			com /= mass;
+
+			auto half_len = 0.0;
+			for (auto const& s : bodies.state)
+				half_len = std::max({ half_len, std::abs(s.pos.x - com.x), std::abs(s.pos.y - com.y) });
+
+			// slightly enlarged so that the furthest bodies are strictly inside
+			return{ com, 2.0 * 1.001 * half_len };
+		}
+
+		void setNumThreads(size_t const num_threads)
+		{
+#ifdef _OPENMP
+			omp_set_num_threads(static_cast<int>(num_threads));
+#endif
+		}
+
+		size_t getNumThreads()
+		{
+#ifdef _OPENMP
+			return static_cast<size_t>(omp_get_max_threads());
+#else
+			return 1;
+#endif
+		}
+
+		size_t getMaxThreads()
+		{
+#ifdef _OPENMP
+			return static_cast<size_t>(omp_get_num_procs());
+#else
+			return 1;
+#endif
+		}
+	}
+}
@@ -0,0 +1,96 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include "BodyGroupProperties.h"
+#include "IDistributor.h"
+#include "IIntegrator.h"
+#include "IModel.h"
+#include "Quad.h"
+#include "Timings.h"
+#include "Types.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace nbody
+{
+	namespace bench
+	{
+		/**
+		 * \brief A set of bodies held in arrays laid out as the models expect.
+		 */
+		struct Bodies
+		{
+			explicit Bodies(size_t const n = 0) : state(n), aux(n), deriv(n) {}
+
+			ParticleData data()
+			{
+				return{ state.data(), aux.data(), deriv.data() };
+			}
+
+			size_t size() const
+			{
+				return state.size();
+			}
+
+			std::vector<ParticleState> state;
+			std::vector<ParticleAuxState> aux;
+			std::vector<ParticleDerivState> deriv;
+		};
+
+		/**
+		 * \brief Parse a comma-separated list of non-negative integers.
+		 */
+		std::vector<size_t> parseList(std::string const& list);
+
+		/**
+		 * \brief Parse a comma-separated list of real numbers.
+		 */
+		std::vector<double> parseRealList(std::string const& list);
+
+		/**
+		 * \brief Call f once and return the wall time it took, in milliseconds.
+		 */
+		template<typename F>
+		double timeMs(F&& f)
+		{
+			auto start = Clock::now();
+			f();
+			return Dble_ms{ Clock::now() - start }.count();
+		}
+
+		/**
+		 * \brief Get the properties used for a body group of the given distribution in all benchmarks.
+		 *		  Each distribution has a fixed seed, so the same bodies are generated on every run.
+		 */
+		BodyGroupProperties makeGroupProperties(DistributorType const type, size_t const n);
+
+		std::unique_ptr<IDistributor> makeDistributor(DistributorType const type);
+		std::unique_ptr<IIntegrator> makeIntegrator(IntegratorType const type, IModel * model, double const step);
+
+		/**
+		 * \brief Generate n bodies with the given distribution.
+		 */
+		Bodies makeBodies(DistributorType const type, size_t const n);
+
+		/**
+		 * \brief Create a model of the given type holding n bodies with the given distribution.
+		 */
+		std::unique_ptr<IModel> makeModel(ModelType const type, DistributorType const dist, size_t const n, double const step);
+
+		/**
+		 * \brief Get a square containing every body, centred on their centre of mass.
+		 */
+		Quad boundingQuad(Bodies const& bodies);
+
+		/**
+		 * \brief Set the number of OpenMP threads used by later parallel regions. Ignored without OpenMP.
+		 */
+		void setNumThreads(size_t const num_threads);
+		size_t getNumThreads();
+		size_t getMaxThreads();
+	}
+}
+
+#endif // BENCH_COMMON_H
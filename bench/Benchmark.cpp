@@ -0,0 +1,331 @@
+// Standalone timing benchmarks for the tree, force, integrator and distributor kernels.
+// No window is opened, so this can run headless (e.g. on a CI machine).
+//
+// Usage: nbody2_bench [--n 1000,10000,100000,1000000] [--threads 1,4] [--reps 5]
+//                     [--max-quadratic 20000] [--out results.csv] [--trace timeline.json] [--counters 1]
+//
+// Results are written as CSV with one row per benchmark, body count and thread count:
+//   benchmark,n,threads,reps,min_ms,median_ms,mean_ms,max_ms
+// followed by the rolling statistics of each profiled phase. With --trace, the most recent phases
+// of every thread are also written as a Chrome trace. With --counters 1, hardware counter totals for
+// each group of benchmarks and hot phase are added, where the system supports them:
+//   group,n,threads,phase,cycles,instructions,llc_misses,branch_misses,ipc
+
+#include "BenchCommon.h"
+#include "BHTreeNode.h"
+#include "DistributorFile.h"
+#include "Error.h"
+#include "IIntegrator.h"
+#include "ModelBarnesHut.h"
+#include "PerfCounters.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <string>
+
+using namespace nbody;
+using namespace nbody::bench;
+
+namespace
+{
+	struct Options
+	{
+		std::vector<size_t> n_list{ 1000, 10000, 100000, 1000000 };
+		std::vector<size_t> thread_list;
+		size_t reps = 5;
+		// the brute-force model is O(N^2), so larger N are skipped
+		size_t max_quadratic = 20000;
+		std::string out_file;
+		std::string trace_file;
+		bool counters = false;
+	};
+
+	Options parseOptions(int argc, char** argv)
+	{
+		Options opts;
+		for (auto i = 1; i < argc; i++)
+		{
+			auto arg = std::string(argv[i]);
+			if (i + 1 >= argc)
+				throw MAKE_ERROR("Missing value for option " + arg);
+			auto value = std::string(argv[++i]);
+
+			if (arg == "--n")
+				opts.n_list = parseList(value);
+			else if (arg == "--threads")
+				opts.thread_list = parseList(value);
+			else if (arg == "--reps")
+				opts.reps = std::max<size_t>(1, std::stoull(value));
+			else if (arg == "--max-quadratic")
+				opts.max_quadratic = std::stoull(value);
+			else if (arg == "--out")
+				opts.out_file = value;
+			else if (arg == "--trace")
+				opts.trace_file = value;
+			else if (arg == "--counters")
+				opts.counters = value != "0";
+			else
+				throw MAKE_ERROR("Unknown option " + arg);
+		}
+
+		if (opts.thread_list.empty())
+		{
+			opts.thread_list.push_back(1);
+			if (getMaxThreads() > 1)
+				opts.thread_list.push_back(getMaxThreads());
+		}
+		return opts;
+	}
+
+	class Reporter
+	{
+	public:
+		explicit Reporter(std::ostream& out) : m_out(out)
+		{
+			m_out << "benchmark,n,threads,reps,min_ms,median_ms,mean_ms,max_ms\n";
+		}
+
+		void report(std::string const& name, size_t const n, size_t const threads, std::vector<double> ms)
+		{
+			std::sort(ms.begin(), ms.end());
+			auto mean = std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size();
+			m_out << name << ',' << n << ',' << threads << ',' << ms.size() << ','
+				<< std::setprecision(6) << ms.front() << ',' << ms[ms.size() / 2] << ','
+				<< mean << ',' << ms.back() << '\n' << std::flush;
+			std::cerr << std::setw(28) << std::left << name << " N=" << n << " threads=" << threads
+				<< " median " << ms[ms.size() / 2] << " ms\n";
+		}
+
+		/**
+		 * \brief Record the hardware counter totals accumulated since the last call, to be written by
+		 *		  reportZones. Does nothing unless counters are enabled.
+		 */
+		void reportCounters(std::string const& group, size_t const n, size_t const threads)
+		{
+			if (!PerfCounters::isEnabled())
+				return;
+
+			auto const totals = PerfCounters::takeTotals();
+			for (size_t p = 0; p < totals.size(); p++)
+			{
+				auto const& v = totals[p];
+				if (!v[Counter::CYCLES] && !v[Counter::INSTRUCTIONS])
+					continue;
+
+				m_counters << group << ',' << n << ',' << threads << ','
+					<< PerfCounters::getName(static_cast<CounterPhase>(p));
+				for (size_t c = 0; c < v.count.size(); c++)
+				{
+					m_counters << ',';
+					if (v.valid[c])
+						m_counters << v.count[c];
+				}
+				m_counters << ',' << std::setprecision(3) << v.ipc() << '\n';
+			}
+		}
+
+		void reportZones()
+		{
+			m_out << "\nzone,count,last_ms,min_ms,mean_ms,p99_ms\n";
+			auto const stats = Profiler::getStats();
+			for (size_t z = 0; z < stats.size(); z++)
+			{
+				auto const& s = stats[z];
+				if (s.count)
+					m_out << Profiler::getName(static_cast<Zone>(z)) << ',' << s.count << ',' << std::setprecision(6)
+						<< s.last << ',' << s.min << ',' << s.mean << ',' << s.p99 << '\n';
+			}
+
+			if (m_counters.tellp() > 0)
+				m_out << "\ngroup,n,threads,phase,cycles,instructions,llc_misses,branch_misses,ipc\n" << m_counters.str();
+			m_out << std::flush;
+		}
+
+	private:
+		std::ostream& m_out;
+		std::stringstream m_counters;
+	};
+
+	/**
+	 * \brief Time reading back bodies written to a temporary particle file in each format.
+	 */
+	void benchImport(Reporter& rep, Options const& opts, size_t const n, size_t const threads)
+	{
+		auto bodies = makeBodies(DistributorType::PLUMMER, n);
+		auto dist = makeDistributor(DistributorType::FROM_FILE);
+		auto bgp = makeGroupProperties(DistributorType::FROM_FILE, n);
+		Bodies imported(n);
+		auto data = imported.data();
+
+		for (auto format : { DistributorFile::Format::BINARY, DistributorFile::Format::CSV })
+		{
+			auto csv = format == DistributorFile::Format::CSV;
+			bgp.file_name = csv ? "nbody2_bench_import.csv" : "nbody2_bench_import.bin";
+			DistributorFile::save(bgp.file_name, bodies.data(), n, format);
+
+			std::vector<double> ms;
+			for (size_t r = 0; r < opts.reps; r++)
+				ms.push_back(timeMs([&] { dist->createDistribution(data, bgp); }));
+			std::remove(bgp.file_name.c_str());
+
+			rep.report(csv ? "distribute/From file (CSV)" : "distribute/From file (binary)", n, threads, ms);
+		}
+	}
+
+	void benchDistributors(Reporter& rep, Options const& opts, size_t const n, size_t const threads)
+	{
+		for (auto const& info : m_dist_infos)
+		{
+			if (info.type == DistributorType::FROM_FILE)
+			{
+				benchImport(rep, opts, n, threads);
+				continue;
+			}
+
+			auto dist = makeDistributor(info.type);
+			auto bgp = makeGroupProperties(info.type, n);
+			Bodies bodies(n);
+			auto data = bodies.data();
+
+			std::vector<double> ms;
+			for (size_t r = 0; r < opts.reps; r++)
+				ms.push_back(timeMs([&] { dist->createDistribution(data, bgp); }));
+
+			rep.report(std::string("distribute/") + info.name, n, threads, ms);
+		}
+	}
+
+	void benchTree(Reporter& rep, Options const& opts, size_t const n, size_t const threads)
+	{
+		auto bodies = makeBodies(DistributorType::PLUMMER, n);
+		auto all = bodies.data();
+		auto bounds = boundingQuad(bodies);
+
+		BHTreeNode root(bounds);
+		std::vector<double> insert_ms, mass_ms, thread_ms, force_ms, mixed_ms, refit_ms, cached_ms;
+
+		for (size_t r = 0; r < opts.reps; r++)
+		{
+			insert_ms.push_back(timeMs([&]
+			{
+				root.reset(bounds, all, n);
+				for (size_t i = 0; i < n; i++)
+					root.insert(ParticleData{ &all.m_state[i], &all.m_aux_state[i], &all.m_deriv_state[i] });
+			}));
+			mass_ms.push_back(timeMs([&] { root.computeMassDistribution(); }));
+			thread_ms.push_back(timeMs([&] { root.threadTree(); }));
+			force_ms.push_back(timeMs([&] { root.calcForces(); }));
+			mixed_ms.push_back(timeMs([&] { root.calcForces(false, true); }));
+
+			// first call builds the interaction lists, the timed one reuses them
+			root.calcForces(true);
+			refit_ms.push_back(timeMs([&] { root.refit(all); }));
+			cached_ms.push_back(timeMs([&] { root.calcForces(true); }));
+		}
+
+		rep.report("tree/insert", n, threads, insert_ms);
+		rep.report("tree/mass_distribution", n, threads, mass_ms);
+		rep.report("tree/thread", n, threads, thread_ms);
+		rep.report("tree/refit", n, threads, refit_ms);
+		rep.report("tree/calc_forces", n, threads, force_ms);
+		rep.report("tree/calc_forces_mixed", n, threads, mixed_ms);
+		rep.report("tree/calc_forces_cached", n, threads, cached_ms);
+	}
+
+	void benchBruteForce(Reporter& rep, Options const& opts, size_t const n, size_t const threads)
+	{
+		if (n > opts.max_quadratic)
+			return;
+
+		auto model = makeModel(ModelType::BRUTE_FORCE, DistributorType::PLUMMER, n, 1e12);
+		std::vector<Vector2d> state(model->getInitialStateVector(), model->getInitialStateVector() + model->getDim());
+		std::vector<Vector2d> deriv(model->getDim());
+
+		std::vector<double> ms;
+		for (size_t r = 0; r < opts.reps; r++)
+			ms.push_back(timeMs([&] { model->eval(state.data(), 0, deriv.data()); }));
+
+		rep.report("brute_force/eval", n, threads, ms);
+	}
+
+	void benchIntegrators(Reporter& rep, Options const& opts, size_t const n, size_t const threads)
+	{
+		for (auto const& info : integrator_infos)
+		{
+			auto model = makeModel(ModelType::BARNES_HUT, DistributorType::PLUMMER, n, 1e12);
+			auto integrator = makeIntegrator(info.type, model.get(), 1e12);
+			integrator->setInitialState(model->getInitialStateVector());
+
+			std::vector<double> ms;
+			for (size_t r = 0; r < opts.reps; r++)
+				ms.push_back(timeMs([&] { integrator->singleStep(); }));
+
+			rep.report(std::string("integrator/") + info.name, n, threads, ms);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		auto opts = parseOptions(argc, argv);
+
+		std::ofstream file;
+		if (!opts.out_file.empty())
+		{
+			file.open(opts.out_file);
+			if (!file.is_open())
+				throw MAKE_ERROR("Could not open file " + opts.out_file);
+		}
+		Reporter rep(opts.out_file.empty() ? std::cout : file);
+
+		if (opts.counters)
+		{
+			PerfCounters::setEnabled(true);
+			if (!PerfCounters::isEnabled())
+				std::cerr << "Hardware counters unavailable: " << PerfCounters::getUnavailableReason() << '\n';
+		}
+
+		for (auto n : opts.n_list)
+		{
+			for (auto threads : opts.thread_list)
+			{
+				setNumThreads(threads);
+				PerfCounters::takeTotals();
+				benchDistributors(rep, opts, n, threads);
+				benchTree(rep, opts, n, threads);
+				rep.reportCounters("tree", n, threads);
+				benchBruteForce(rep, opts, n, threads);
+				benchIntegrators(rep, opts, n, threads);
+				rep.reportCounters("integrator", n, threads);
+			}
+		}
+		rep.reportZones();
+
+		if (!opts.trace_file.empty())
+		{
+			std::ofstream trace(opts.trace_file);
+			if (!trace.is_open())
+				throw MAKE_ERROR("Could not open file " + opts.trace_file);
+			Profiler::writeTrace(trace);
+		}
+		return 0;
+	}
+	catch (Error const& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception const& e)
+	{
+		std::cerr << "UNCAUGHT ERROR! " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,206 @@
+// Conservation harness: runs a simulation without a window and records how far the energy, momentum,
+// angular momentum and centre of mass move from their initial values, to compare integrators,
+// opening angles and timesteps.
+//
+// Usage: nbody2_conservation [--n 10000] [--dist plummer] [--model barnes-hut] [--integrator euler,adb2]
+//                            [--theta 0.5,0.9] [--step 1e10] [--steps 1000] [--every 10] [--out drift.csv]
+//
+// Distributions are exponential, isothermal, plummer or realistic, models barnes-hut or brute-force and
+// integrators euler, modified-euler, adb2 or adb6. The opening angles are ignored by the brute-force model.
+// Results are written as CSV with one row per run and recorded step:
+//   model,integrator,theta,step,time,energy,momentum,angular_momentum,centre_mass
+// where the drifts are as defined by ConservationDrift: relative for the energy, momentum and angular
+// momentum, and in metres for the centre of mass.
+
+#include "BenchCommon.h"
+#include "BHTreeNode.h"
+#include "ConservationMonitor.h"
+#include "Error.h"
+#include "IIntegrator.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace nbody;
+using namespace nbody::bench;
+
+namespace
+{
+	// the root node is enlarged until at most this fraction of bodies lie outside it, as in a running simulation,
+	// so that the changing number of bodies handled outside the tree does not show up as drift
+	double constexpr s_MAX_RENEGADE_FRAC = 0.01;
+	size_t constexpr s_MAX_WARMUP_EVALS = 50;
+
+	template<typename T>
+	struct Named
+	{
+		char const* name;
+		T value;
+	};
+
+	std::array<Named<DistributorType>, 4> constexpr s_DISTS = { {
+		{ "exponential", DistributorType::EXPONENTIAL },
+		{ "isothermal", DistributorType::ISOTHERMAL },
+		{ "plummer", DistributorType::PLUMMER },
+		{ "realistic", DistributorType::REALISTIC }
+		} };
+
+	std::array<Named<ModelType>, 2> constexpr s_MODELS = { {
+		{ "brute-force", ModelType::BRUTE_FORCE },
+		{ "barnes-hut", ModelType::BARNES_HUT }
+		} };
+
+	std::array<Named<IntegratorType>, 4> constexpr s_INTEGRATORS = { {
+		{ "euler", IntegratorType::EULER },
+		{ "modified-euler", IntegratorType::MODIFIED_EULER },
+		{ "adb2", IntegratorType::ADB2 },
+		{ "adb6", IntegratorType::ADB6 }
+		} };
+
+	template<typename T, size_t N>
+	T lookUp(std::array<Named<T>, N> const& names, std::string const& name)
+	{
+		auto it = std::find_if(names.begin(), names.end(), [&](auto const& n) { return name == n.name; });
+		if (it == names.end())
+			throw MAKE_ERROR("Unknown name " + name);
+		return it->value;
+	}
+
+	template<typename T, size_t N>
+	char const* nameOf(std::array<Named<T>, N> const& names, T const value)
+	{
+		auto it = std::find_if(names.begin(), names.end(), [&](auto const& n) { return value == n.value; });
+		return it == names.end() ? "unknown" : it->name;
+	}
+
+	struct Options
+	{
+		size_t n = 10000;
+		DistributorType dist = DistributorType::PLUMMER;
+		ModelType model = ModelType::BARNES_HUT;
+		std::vector<IntegratorType> integrators{ IntegratorType::EULER, IntegratorType::MODIFIED_EULER,
+			IntegratorType::ADB2, IntegratorType::ADB6 };
+		std::vector<double> theta_list{ 0.5, 0.9 };
+		double step = 1e10;
+		size_t steps = 1000;
+		size_t every = 10;
+		std::string out_file;
+	};
+
+	Options parseOptions(int argc, char** argv)
+	{
+		Options opts;
+		for (auto i = 1; i < argc; i++)
+		{
+			auto arg = std::string(argv[i]);
+			if (i + 1 >= argc)
+				throw MAKE_ERROR("Missing value for option " + arg);
+			auto value = std::string(argv[++i]);
+
+			if (arg == "--n")
+				opts.n = std::stoull(value);
+			else if (arg == "--dist")
+				opts.dist = lookUp(s_DISTS, value);
+			else if (arg == "--model")
+				opts.model = lookUp(s_MODELS, value);
+			else if (arg == "--integrator")
+			{
+				opts.integrators.clear();
+				std::stringstream ss(value);
+				std::string name;
+				while (std::getline(ss, name, ','))
+					opts.integrators.push_back(lookUp(s_INTEGRATORS, name));
+			}
+			else if (arg == "--theta")
+				opts.theta_list = parseRealList(value);
+			else if (arg == "--step")
+				opts.step = std::stod(value);
+			else if (arg == "--steps")
+				opts.steps = std::stoull(value);
+			else if (arg == "--every")
+				opts.every = std::max<size_t>(1, std::stoull(value));
+			else if (arg == "--out")
+				opts.out_file = value;
+			else
+				throw MAKE_ERROR("Unknown option " + arg);
+		}
+		return opts;
+	}
+
+	void run(std::ostream& out, Options const& opts, IntegratorType const type, double const theta)
+	{
+		BHTreeNode::setTheta(theta);
+		auto model = makeModel(opts.model, opts.dist, opts.n, opts.step);
+		auto integrator = makeIntegrator(type, model.get(), opts.step);
+
+		if (opts.model == ModelType::BARNES_HUT)
+		{
+			std::vector<Vector2d> state(model->getInitialStateVector(), model->getInitialStateVector() + model->getDim());
+			std::vector<Vector2d> deriv(model->getDim());
+			for (size_t i = 0; i < s_MAX_WARMUP_EVALS; i++)
+			{
+				model->eval(state.data(), 0, deriv.data());
+				if (BHTreeNode::getNumRenegades() <= s_MAX_RENEGADE_FRAC * opts.n)
+					break;
+			}
+		}
+
+		model->trackConserved(integrator->getStateVector());
+		integrator->setInitialState(model->getInitialStateVector());
+
+		ConservationMonitor monitor;
+		for (size_t s = 1; s <= opts.steps; s++)
+		{
+			integrator->singleStep();
+			// the state evaluated in a step depends on the integrator, so rows are written by its time
+			if (monitor.record(model->getConserved()) && (s % opts.every == 0 || s == opts.steps))
+			{
+				out << nameOf(s_MODELS, opts.model) << ',' << nameOf(s_INTEGRATORS, type) << ',' << theta << ',' << s << ',';
+				ConservationMonitor::writeDrift(out, monitor.getLatestDrift());
+				out << std::flush;
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		auto opts = parseOptions(argc, argv);
+
+		std::ofstream file;
+		if (!opts.out_file.empty())
+		{
+			file.open(opts.out_file);
+			if (!file.is_open())
+				throw MAKE_ERROR("Could not open file " + opts.out_file);
+		}
+		auto& out = opts.out_file.empty() ? std::cout : file;
+
+		out << "model,integrator,theta,step,";
+		ConservationMonitor::writeHeader(out);
+
+		// the opening angle makes no difference to the brute-force model
+		auto theta_list = opts.model == ModelType::BARNES_HUT ? opts.theta_list : std::vector<double>{ BHTreeNode::getTheta() };
+		for (auto type : opts.integrators)
+			for (auto theta : theta_list)
+				run(out, opts, type, theta);
+		return 0;
+	}
+	catch (Error const& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception const& e)
+	{
+		std::cerr << "UNCAUGHT ERROR! " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,164 @@
+// Settings file harness: checks that settings files come back unchanged after being saved and loaded.
+//
+// Usage: nbody2_settings file.dat [file.dat ...]
+//
+// Each file is loaded, saved to a copy beside it and the copy loaded back, which must give the same
+// properties. Every group is then given embedded bodies, and the copy is saved, loaded and saved again
+// over itself while its bodies are still mapped, which must keep the same bodies. Groups of files in the
+// legacy format, which stores no seeds, must each be given their own seed. The program fails if any
+// check does, and removes the copies either way.
+
+#include "BenchCommon.h"
+#include "BodyGroupProperties.h"
+#include "DistributorFile.h"
+#include "Error.h"
+#include "MappedFile.h"
+#include "SettingsFile.h"
+#include "Sim.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace nbody;
+using namespace nbody::bench;
+
+namespace
+{
+	bool sameImage(std::shared_ptr<ParticleImage const> const& a, std::shared_ptr<ParticleImage const> const& b)
+	{
+		if (!a || !b)
+			return !a && !b;
+		return a->size == b->size && std::memcmp(a->data, b->data, a->size) == 0;
+	}
+
+	bool sameGroup(BodyGroupProperties const& a, BodyGroupProperties const& b)
+	{
+		return a.dist == b.dist && a.num == b.num && a.pos == b.pos && a.vel == b.vel && a.radius == b.radius
+			&& a.use_parsecs == b.use_parsecs && a.min_mass == b.min_mass && a.max_mass == b.max_mass
+			&& a.has_central_mass == b.has_central_mass && a.central_mass == b.central_mass && a.colour == b.colour
+			&& std::equal(std::begin(a.cols), std::end(a.cols), std::begin(b.cols)) && a.seed == b.seed
+			&& a.file_name == b.file_name && sameImage(a.embedded, b.embedded);
+	}
+
+	bool sameProperties(SimProperties const& a, SimProperties const& b)
+	{
+		return a.timestep == b.timestep && a.int_type == b.int_type && a.mod_type == b.mod_type
+			&& a.n_bodies == b.n_bodies && a.reorder_interval == b.reorder_interval
+			&& a.mixed_precision == b.mixed_precision && a.merge_radius == b.merge_radius
+			&& std::equal(a.bg_props.begin(), a.bg_props.end(), b.bg_props.begin(), b.bg_props.end(), sameGroup);
+	}
+
+	bool isLegacy(std::string const& file_name)
+	{
+		MappedFile file(file_name);
+		char constexpr header[] = "nb_settings";
+		return file.size() >= sizeof(header) && std::memcmp(file.data(), header, sizeof(header)) == 0;
+	}
+
+	/**
+	 * \brief Embed the bodies of every group which generates them, as the start menu does.
+	 */
+	void embedBodies(SimProperties & props)
+	{
+		for (auto& bgp : props.bg_props)
+		{
+			if (bgp.num <= 0 || bgp.dist == DistributorType::INVALID || bgp.dist == DistributorType::FROM_FILE)
+				continue;
+			auto const num = static_cast<size_t>(bgp.num);
+			std::vector<ParticleState> state(num);
+			std::vector<ParticleAuxState> aux_state(num);
+			ParticleData bodies(state.data(), aux_state.data());
+			makeDistributor(bgp.dist)->createDistribution(bodies, bgp);
+			bgp.embedded = DistributorFile::makeImage(bodies, num, bgp);
+		}
+	}
+
+	/**
+	 * \brief Run every check on a file.
+	 * \return The number of checks which failed.
+	 */
+	size_t checkFile(std::string const& file_name)
+	{
+		size_t num_failed = 0;
+		auto const fail = [&](char const* what)
+		{
+			std::cerr << "FAIL " << file_name << ": " << what << '\n';
+			num_failed++;
+		};
+
+		SimProperties original;
+		SettingsFile::load(file_name, original);
+
+		if (isLegacy(file_name))
+		{
+			std::set<uint32_t> seeds;
+			for (auto const& bgp : original.bg_props)
+				seeds.insert(bgp.seed);
+			if (seeds.size() != original.bg_props.size())
+				fail("legacy groups share a seed");
+		}
+
+		auto const copy_name = file_name + ".check";
+		try
+		{
+			SimProperties copy;
+			SettingsFile::save(copy_name, original);
+			SettingsFile::load(copy_name, copy);
+			if (!sameProperties(original, copy))
+				fail("properties changed by saving and loading");
+
+			embedBodies(original);
+			SettingsFile::save(copy_name, original);
+			SimProperties mapped;
+			SettingsFile::load(copy_name, mapped);
+			// the embedded bodies are read from the file being replaced
+			SettingsFile::save(copy_name, mapped);
+			SettingsFile::load(copy_name, copy);
+			if (!sameProperties(original, copy))
+				fail("embedded bodies changed by saving over the file they were loaded from");
+		}
+		catch (Error const& e)
+		{
+			std::cerr << "FAIL " << file_name << ": " << e.what() << '\n';
+			num_failed++;
+		}
+		std::remove(copy_name.c_str());
+		return num_failed;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		if (argc < 2)
+			throw MAKE_ERROR("Usage: nbody2_settings file.dat [file.dat ...]");
+
+		size_t num_failed = 0;
+		for (auto i = 1; i < argc; i++)
+			num_failed += checkFile(argv[i]);
+
+		if (num_failed)
+		{
+			std::cerr << num_failed << " settings file checks failed\n";
+			return 1;
+		}
+		std::cerr << "All " << argc - 1 << " settings files survive saving and loading\n";
+		return 0;
+	}
+	catch (Error const& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	catch (std::exception const& e)
+	{
+		std::cerr << "UNCAUGHT ERROR! " << e.what() << std::endl;
+		return 1;
+	}
+}
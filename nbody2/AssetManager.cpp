@@ -5,6 +5,7 @@
 #include "ColourerVelocity.h"
 #include "IDistributor.h"
 #include "DistributorExponential.h"
+#include "DistributorFile.h"
 #include "DistributorIsothermal.h"
 #include "DistributorPlummer.h"
 #include "DistributorRealistic.h"
@@ -76,6 +77,7 @@ namespace nbody
 		m_distributors[DistributorType::ISOTHERMAL] = DistributorIsothermal::create;
 		m_distributors[DistributorType::PLUMMER] = DistributorPlummer::create;
 		m_distributors[DistributorType::REALISTIC] = DistributorRealistic::create;
+		m_distributors[DistributorType::FROM_FILE] = DistributorFile::create;
 	}
 
 	void AssetManager::loadColourers()
@@ -1,34 +1,51 @@
 #include "BHTreeNode.h"
 #include "Constants.h"
 #include "Error.h"
+#include "PerfCounters.h"
+#include "Profiler.h"
 
 #include <immintrin.h>
 #include <emmintrin.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include <algorithm>
 #include <cassert>
 #include <functional>
+#include <limits>
+#include <numeric>
 
 
 namespace nbody
 {
 	std::vector<ParticleData> BHTreeNode::s_renegades;
 	std::vector<BHTreeNode const*> BHTreeNode::s_crit_cells;
-	DebugStats BHTreeNode::s_stat = { 0, 0, 0, 0, 0 };
-	double constexpr BHTreeNode::s_THETA;
-	size_t constexpr BHTreeNode::s_CRIT_SIZE;
+	std::vector<BHTreeNode const*> BHTreeNode::s_nodes;
+	PackedNode * BHTreeNode::s_packed = nullptr;
+	size_t BHTreeNode::s_packed_cap = 0;
+	std::vector<std::vector<size_t>> BHTreeNode::s_ilist_cache;
+	std::vector<double> BHTreeNode::s_body_cost;
+	std::vector<double> BHTreeNode::s_cell_cost;
+	ParticleData BHTreeNode::s_all;
+	DebugStats BHTreeNode::s_stat = { 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, {} };
+	double BHTreeNode::s_potential_energy = 0;
+	double BHTreeNode::s_theta = 0.9;
+	size_t BHTreeNode::s_crit_size = 32;
 
 	BHTreeNode::BHTreeNode(Quad const& q, size_t const level, BHTreeNode const* parent) :
-		m_more(nullptr),
-		m_next(nullptr),
 		m_level(level),
 		m_body(),
-		m_c_state(),
-		m_c_aux_state(),
-		m_rcrit_sq((q.getLength() / s_THETA) * (q.getLength() / s_THETA)),
+		m_centre_mass(),
+		m_mass(0),
+		m_rcrit_sq((q.getLength() / s_theta) * (q.getLength() / s_theta)),
 		m_quad(q),
+		m_min(),
+		m_max(),
 		m_parent(parent),
 		m_num(0),
+		m_index(0),
 		m_subdivided(false)
 	{
 		m_daughters[0] = m_daughters[1] = m_daughters[2] = m_daughters[3] = nullptr;
@@ -46,7 +63,7 @@ namespace nbody
 		}
 	}
 
-	void BHTreeNode::reset(Quad const& q)
+	void BHTreeNode::reset(Quad const& q, ParticleData const& all, size_t const num_all)
 	{
 		if (!isRoot())
 			throw MAKE_ERROR("Non-root node attempted to reset tree");
@@ -58,16 +75,20 @@ namespace nbody
 		}
 
 		m_quad = q;
-		m_rcrit_sq = (q.getLength() / s_THETA) * (q.getLength() / s_THETA);
+		m_rcrit_sq = (q.getLength() / s_theta) * (q.getLength() / s_theta);
 		m_num = 0;
-		m_c_state = {};
-		m_c_aux_state = {};
+		m_centre_mass = {};
+		m_mass = 0;
 
 		treeStatReset();
 		forceCalcStatReset();
 
 		s_renegades.clear();
 		s_crit_cells.clear();
+		s_nodes.clear();
+		s_ilist_cache.clear();
+		s_all = all;
+		s_body_cost.resize(num_all, 0.0);
 	}
 
 	bool BHTreeNode::isRoot() const
@@ -87,7 +108,7 @@ namespace nbody
 
 	double BHTreeNode::getMass() const
 	{
-		return m_c_aux_state.mass;
+		return m_mass;
 	}
 
 	size_t BHTreeNode::getLevel() const
@@ -100,6 +121,11 @@ namespace nbody
 		return m_num;
 	}
 
+	size_t BHTreeNode::getIndex() const
+	{
+		return m_index;
+	}
+
 	Quad const & BHTreeNode::getQuad() const
 	{
 		return m_quad;
@@ -107,7 +133,7 @@ namespace nbody
 
 	const Vector2d & BHTreeNode::getCentreMass() const
 	{
-		return m_c_state.pos;
+		return m_centre_mass;
 	}
 
 	size_t BHTreeNode::getNumRenegades()
@@ -115,9 +141,34 @@ namespace nbody
 		return s_renegades.size();
 	}
 
+	double BHTreeNode::getPotentialEnergy()
+	{
+		return s_potential_energy;
+	}
+
 	double BHTreeNode::getTheta()
 	{
-		return s_THETA;
+		return s_theta;
+	}
+
+	size_t BHTreeNode::getCritSize()
+	{
+		return s_crit_size;
+	}
+
+	void BHTreeNode::setTheta(double const theta)
+	{
+		if (theta <= 0)
+			throw MAKE_ERROR("Opening angle must be positive");
+		s_theta = theta;
+	}
+
+	void BHTreeNode::setCritSize(size_t const crit_size)
+	{
+		// cells hold fewer bodies than the size, so a size of 1 would leave only empty cells and no forces
+		if (crit_size < 2)
+			throw MAKE_ERROR("Critical cell size must be at least 2");
+		s_crit_size = crit_size;
 	}
 
 	DebugStats const& BHTreeNode::getStats()
@@ -125,6 +176,22 @@ namespace nbody
 		return s_stat;
 	}
 
+	void BHTreeNode::resetCacheStats()
+	{
+		s_stat.m_ilist_hits = 0;
+		s_stat.m_ilist_lookups = 0;
+		s_stat.m_walk_saved_ms = 0;
+	}
+
+	void BHTreeNode::permuteBodyCosts(std::vector<size_t> const& order)
+	{
+		// bodies added since the last build have no cost yet
+		if (!order.empty())
+			s_body_cost.resize(std::max(s_body_cost.size(), *std::max_element(order.begin(), order.end()) + 1), 0.0);
+		applyOrder(s_body_cost.data(), order);
+		s_body_cost.resize(order.size());
+	}
+
 	void BHTreeNode::forceCalcStatReset() const
 	{
 		if (!isRoot())
@@ -170,6 +237,148 @@ namespace nbody
 		return which ? which->getHovered(pos) : this;
 	}
 
+	bool BHTreeNode::findBodies(Vector2d const& min, Vector2d const& max, size_t const max_bodies, std::vector<uint32_t> & indices) const
+	{
+		if (!isRoot())
+			throw MAKE_ERROR("Non-root node attempted to search tree");
+
+		auto const disjoint = [&](BHTreeNode const* n) {
+			return n->m_max.x < min.x || n->m_min.x > max.x || n->m_max.y < min.y || n->m_min.y > max.y;
+		};
+		auto const inside = [&](BHTreeNode const* n) {
+			return n->m_min.x >= min.x && n->m_max.x <= max.x && n->m_min.y >= min.y && n->m_max.y <= max.y;
+		};
+
+		// walk the nodes in depth-first order, jumping past the subtree of any node outside the rectangle
+		// count first, only descending into nodes which straddle its edge, so that giving up is cheap
+		auto const num_nodes = s_nodes.size();
+		auto count = s_renegades.size();
+		for (size_t i = 0; i < num_nodes && count <= max_bodies; )
+		{
+			auto const n = s_nodes[i];
+			if (disjoint(n) || inside(n))
+			{
+				count += disjoint(n) ? 0 : n->m_num;
+				i = s_packed[i].next;
+			}
+			else
+				i++;
+		}
+		if (count > max_bodies)
+			return false;
+
+		for (size_t i = 0; i < num_nodes; )
+		{
+			auto const n = s_nodes[i];
+			if (disjoint(n))
+			{
+				i = s_packed[i].next;
+				continue;
+			}
+			if (n->isExternal())
+				indices.push_back(static_cast<uint32_t>(n->m_body.m_state - s_all.m_state));
+			i++;
+		}
+
+		for (auto const& r : s_renegades)
+			indices.push_back(static_cast<uint32_t>(r.m_state - s_all.m_state));
+		return true;
+	}
+
+	void BHTreeNode::findClosePairs(double const radius, std::vector<std::pair<uint32_t, uint32_t>> & pairs) const
+	{
+		if (!isRoot())
+			throw MAKE_ERROR("Non-root node attempted to search tree");
+
+		using Pair = std::pair<uint32_t, uint32_t>;
+		auto const radius_sq = radius * radius;
+		auto const num_nodes = s_nodes.size();
+		auto const index_of = [](ParticleData const& b) { return static_cast<uint32_t>(b.m_state - s_all.m_state); };
+
+		// append the leaves whose bodies may lie within radius of a box
+		auto const findNear = [&](Vector2d const& min, Vector2d const& max, std::vector<ParticleData const*> & near)
+		{
+			for (size_t i = 0; i < num_nodes; )
+			{
+				auto const n = s_nodes[i];
+				if (n->m_max.x < min.x - radius || n->m_min.x > max.x + radius
+					|| n->m_max.y < min.y - radius || n->m_min.y > max.y + radius)
+				{
+					i = s_packed[i].next;
+					continue;
+				}
+				if (n->isExternal())
+					near.push_back(&n->m_body);
+				i++;
+			}
+		};
+
+		auto const close = [&](ParticleData const& a, ParticleData const& b)
+		{
+			return (b.m_state->pos - a.m_state->pos).mag_sq() < radius_sq;
+		};
+
+		auto const num_cells = static_cast<int>(s_crit_cells.size());
+		auto const num_renegades = static_cast<int>(s_renegades.size());
+		auto const first_pair = pairs.size();
+
+#pragma omp parallel
+		{
+			std::vector<Pair> found;
+			std::vector<ParticleData const*> near;
+
+			// each pair of bodies in the tree is seen from both ends, and kept from the lower index
+#pragma omp for schedule(dynamic) nowait
+			for (auto c = 0; c < num_cells; c++)
+			{
+				auto const cell = s_crit_cells[c];
+				near.clear();
+				findNear(cell->m_min, cell->m_max, near);
+
+				auto const end = s_packed[cell->m_index].next;
+				for (auto j = cell->m_index; j < end; j++)
+				{
+					if (s_packed[j].next != j + 1)
+						continue;
+					auto const& a = s_nodes[j]->m_body;
+					auto const ia = index_of(a);
+					for (auto const b : near)
+					{
+						auto const ib = index_of(*b);
+						if (ia < ib && close(a, *b))
+							found.emplace_back(ia, ib);
+					}
+				}
+			}
+
+			// renegades are not in the tree, so their pairs are seen only from the renegade
+#pragma omp for schedule(dynamic) nowait
+			for (auto r = 0; r < num_renegades; r++)
+			{
+				auto const& a = s_renegades[r];
+				auto const ia = index_of(a);
+				near.clear();
+				findNear(a.m_state->pos, a.m_state->pos, near);
+				for (auto const b : near)
+				{
+					if (close(a, *b))
+						found.emplace_back(std::min(ia, index_of(*b)), std::max(ia, index_of(*b)));
+				}
+				for (auto k = r + 1; k < num_renegades; k++)
+				{
+					if (close(a, s_renegades[k]))
+						found.emplace_back(std::min(ia, index_of(s_renegades[k])), std::max(ia, index_of(s_renegades[k])));
+				}
+			}
+
+#pragma omp critical
+			pairs.insert(pairs.end(), found.begin(), found.end());
+		}
+
+		// threads finish in any order
+		std::sort(pairs.begin() + first_pair, pairs.end());
+	}
+
 	BHTreeNode const * BHTreeNode::getParent() const
 	{
 		return m_parent;
@@ -247,10 +456,11 @@ namespace nbody
 	{
 		// preallocate space to prevent repeated reallocations
 		if (isRoot())
-			s_crit_cells.reserve(static_cast<size_t>(m_num / s_CRIT_SIZE * 1.1));
+			s_crit_cells.reserve(static_cast<size_t>(m_num / s_crit_size * 1.1));
 
-		m_c_state = {};		// initialise centre of mass
-		m_c_aux_state = {}; // and total mass
+		m_centre_mass = {}; // initialise centre of mass
+		m_mass = 0;			// and total mass
+		clearBounds();
 
 		for (auto d : m_daughters)
 		{
@@ -258,13 +468,14 @@ namespace nbody
 			{
 				d->computeMassDistribution();
 				// contribution to centre of mass and total mass from daughters
-				m_c_state.pos += d->m_c_state.pos * d->m_c_aux_state.mass;
-				m_c_aux_state.mass += d->m_c_aux_state.mass;
+				m_centre_mass += d->m_centre_mass * d->m_mass;
+				m_mass += d->m_mass;
+				growBounds(*d);
 			}
 		}
 
 		// test whether node is first in hierarchy to be smaller than critical size
-		if (isRoot() && m_num < s_CRIT_SIZE || m_num < s_CRIT_SIZE && m_parent->m_num > s_CRIT_SIZE)
+		if (m_num < s_crit_size && (isRoot() || m_parent->m_num >= s_crit_size))
 		{
 			s_crit_cells.push_back(this);
 			s_stat.m_num_crit_size++;
@@ -275,183 +486,540 @@ namespace nbody
 			assert(m_body.isNotNull());
 
 			// for external node, mass and centre of mass are mass and position of body
-			m_c_state = *m_body.m_state;
-			m_c_aux_state = *m_body.m_aux_state;
+			m_centre_mass = m_body.m_state->pos;
+			m_mass = m_body.m_aux_state->mass;
+			m_min = m_max = m_centre_mass;
 		}
 		else // !isExternal() 
-			m_c_state.pos /= m_c_aux_state.mass;
+			finishCentreMass();
 	}
 
-	void BHTreeNode::threadTree(BHTreeNode * next)
+	void BHTreeNode::threadTree()
 	{
-		// this node's next always points to next sibling passed in
-		m_next = next;
+		// number nodes in depth-first order so that they can be referred to by index
+		// and each subtree occupies a contiguous range of indices
+		if (isRoot())
+			s_nodes.clear();
+		m_index = s_nodes.size();
+		s_nodes.push_back(this);
 
 		if (!isExternal())
 		{
-			auto n_daughters = 0;
-			// NB extra size of array
-			// so that loop below automatically threads final daughter to this node's next sibling
-			BHTreeNode * actual_daughters[NUM_DAUGHTERS + 1];
-			for (auto const & d : m_daughters)
+			for (auto d : m_daughters)
 			{
 				if (d)
-					actual_daughters[n_daughters++] = d;
+					d->threadTree();
 			}
-			// more points to first daughter
-			m_more = actual_daughters[0];
-			actual_daughters[n_daughters] = next;
-			for (auto i = 0; i < n_daughters; i++)
+		}
+
+		if (isRoot())
+			packNodes();
+	}
+
+	void BHTreeNode::packNodes()
+	{
+		auto const num_nodes = s_nodes.size();
+		if (num_nodes > s_packed_cap)
+		{
+			_mm_free(s_packed);
+			s_packed_cap = std::max(num_nodes, 2 * s_packed_cap);
+			s_packed = static_cast<PackedNode *>(_mm_malloc(s_packed_cap * sizeof(PackedNode), 64));
+			if (!s_packed)
+				throw MAKE_ERROR("Failed to allocate packed tree nodes");
+		}
+
+		auto constexpr pc_sq = Constants::PARSEC * Constants::PARSEC;
+
+#pragma omp parallel for schedule(static)
+		for (auto i = 0; i < static_cast<int>(num_nodes); i++)
+		{
+			auto const n = s_nodes[i];
+			auto& p = s_packed[i];
+
+			// the node is far enough away when beyond its critical radius of the centre of mass,
+			// plus the offset of the centre of mass from the geometric centre
+			auto delta_sq = (n->m_centre_mass - n->m_quad.getPos()).mag_sq();
+
+			p.centre_mass = n->m_centre_mass;
+			p.mass = n->m_mass;
+			p.accept_sq = static_cast<float>((n->m_rcrit_sq + delta_sq) / pc_sq);
+		}
+
+		// a subtree's nodes are numbered contiguously, so the node after it follows its last daughter's subtree
+		// fill in the next indices from the end, so each daughter's is known before its parent's
+		for (auto i = num_nodes; i-- > 0; )
+		{
+			auto const n = s_nodes[i];
+			auto next = i + 1;
+			for (auto d : n->m_daughters)
 			{
-				// each daughter receives its sibling as next, except for final one
-				// which receives this node's sibling instead
-				actual_daughters[i]->threadTree(actual_daughters[i + 1]);
+				if (d)
+					next = std::max<size_t>(next, s_packed[d->m_index].next);
 			}
+			s_packed[i].next = static_cast<uint32_t>(next);
+		}
+	}
+
+	void BHTreeNode::refit(ParticleData const& all)
+	{
+		if (!isRoot())
+			throw MAKE_ERROR("Non-root node attempted to refit tree");
+
+		for (auto& r : s_renegades)
+		{
+			auto idx = r.m_state - s_all.m_state;
+			r = ParticleData{ all.m_state + idx, all.m_aux_state + idx, all.m_deriv_state + idx };
 		}
+
+		refitNode(all);
+		packNodes();
+		s_all = all;
 	}
 
-	void BHTreeNode::calcForces() const
+	void BHTreeNode::refitNode(ParticleData const& all)
+	{
+		if (isExternal())
+		{
+			// body keeps its position in the arrays, so only the base pointers change
+			auto idx = m_body.m_state - s_all.m_state;
+			m_body = ParticleData{ all.m_state + idx, all.m_aux_state + idx, all.m_deriv_state + idx };
+
+			m_centre_mass = m_body.m_state->pos;
+			m_mass = m_body.m_aux_state->mass;
+			m_min = m_max = m_centre_mass;
+			return;
+		}
+
+		m_centre_mass = {};
+		m_mass = 0;
+		clearBounds();
+
+		for (auto d : m_daughters)
+		{
+			if (d)
+			{
+				d->refitNode(all);
+				m_centre_mass += d->m_centre_mass * d->m_mass;
+				m_mass += d->m_mass;
+				growBounds(*d);
+			}
+		}
+
+		finishCentreMass();
+	}
+
+	void BHTreeNode::finishCentreMass()
+	{
+		// a node holding only removed bodies has no mass, and so pulls on nothing from wherever it is put
+		if (m_mass > 0)
+			m_centre_mass /= m_mass;
+		else
+			m_centre_mass = 0.5 * (m_min + m_max);
+	}
+
+	void BHTreeNode::clearBounds()
+	{
+		m_min = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+		m_max = { std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest() };
+	}
+
+	void BHTreeNode::growBounds(BHTreeNode const& daughter)
+	{
+		m_min = { std::min(m_min.x, daughter.m_min.x), std::min(m_min.y, daughter.m_min.y) };
+		m_max = { std::max(m_max.x, daughter.m_max.x), std::max(m_max.y, daughter.m_max.y) };
+	}
+
+	void BHTreeNode::calcForces(bool use_cache, bool mixed_precision) const
 	{
 		assert(isRoot());
 
-		auto len = s_crit_cells.size();
+		auto const len = s_crit_cells.size();
+
+		// lists are only reusable if they were built for this set of critical cells
+		auto cache_valid = use_cache && s_ilist_cache.size() == len;
+		if (use_cache && !cache_valid)
+			s_ilist_cache.assign(len, {});
+
+		// bodies not timed yet (e.g. on the first step, or just added) are assumed to take the mean time of
+		// those which were, so that both are in the same units, or the same time as each other if none were
+		auto const num_costs = static_cast<int>(s_body_cost.size());
+		auto sum_cost = 0.0;
+		auto num_timed = 0;
+#pragma omp parallel for schedule(static) reduction(+:sum_cost,num_timed)
+		for (int i = 0; i < num_costs; i++)
+		{
+			if (s_body_cost[i] > 0.0)
+			{
+				sum_cost += s_body_cost[i];
+				num_timed++;
+			}
+		}
+		auto const default_cost = num_timed > 0 ? sum_cost / num_timed : 1.0;
+
+		// estimate the cost of each cell from the time its bodies took last step,
+		// and store the running total so that cells can be split evenly by cost
+		s_cell_cost.assign(len + 1, 0.0);
+		auto const num_cells = static_cast<int>(len);
 #pragma omp parallel for schedule(static)
-		for (auto i = 0; i < len; i++)
+		for (int i = 0; i < num_cells; i++)
+			s_cell_cost[i + 1] = s_crit_cells[i]->estimateCost(default_cost);
+		std::partial_sum(s_cell_cost.begin(), s_cell_cost.end(), s_cell_cost.begin());
+
+		auto const max_threads = getMaxThreads();
+		s_stat.m_thread_busy_ms.assign(max_threads, 0.0);
+		s_stat.m_thread_idle_ms.assign(max_threads, 0.0);
+
+		auto num_calc = size_t{ 0 };
+		auto walk_ms = 0.0;
+		auto potential = 0.0;
+		auto num_threads = 1;
+
+#pragma omp parallel reduction(+:num_calc,walk_ms,potential)
 		{
-			auto cell = s_crit_cells[i];
+			ScopedZone zone{ Zone::FORCE_THREAD };
+			auto const busy_start = Clock::now();
+			auto thread_id = 0;
+#ifdef _OPENMP
+			thread_id = omp_get_thread_num();
+#pragma omp master
+			num_threads = omp_get_num_threads();
+#endif
+			// each thread takes a contiguous run of cells holding an equal share of the estimated cost
+			auto const n_share = getNumThreads();
+			auto const total = s_cell_cost.back();
+			auto const cost_begin = s_cell_cost.begin();
+			auto const cost_end = s_cell_cost.end() - 1;
+			auto const first = static_cast<size_t>(std::lower_bound(cost_begin, cost_end, total * thread_id / n_share) - cost_begin);
+			auto const last = (thread_id == n_share - 1) ? len :
+				static_cast<size_t>(std::lower_bound(cost_begin, cost_end, total * (thread_id + 1) / n_share) - cost_begin);
+
+			for (auto i = first; i < last; i++)
+				calcCellForces(i, use_cache, cache_valid, mixed_precision, num_calc, walk_ms, potential);
+
+			s_stat.m_thread_busy_ms[thread_id] = Dble_ms{ Clock::now() - busy_start }.count();
+		}
+
+		// threads which finished early wait at the end of the parallel region for the slowest
+		s_stat.m_thread_busy_ms.resize(num_threads);
+		s_stat.m_thread_idle_ms.resize(num_threads);
+		auto const slowest = *std::max_element(s_stat.m_thread_busy_ms.begin(), s_stat.m_thread_busy_ms.end());
+		for (auto t = 0; t < num_threads; t++)
+			s_stat.m_thread_idle_ms[t] = slowest - s_stat.m_thread_busy_ms[t];
+
+		calcRenegadeForces(num_calc, potential);
 
-			// discover bodies in group
-			std::vector<std::reference_wrapper<ParticleData const>> bodies;
-			bodies.reserve(cell->m_num);
+		s_stat.m_num_calc = num_calc;
+		// each pair was counted from both ends
+		s_potential_energy = 0.5 * potential;
 
-			for (auto q = cell; q != cell->m_next; )
+		if (use_cache)
+		{
+			s_stat.m_ilist_lookups += len;
+			if (cache_valid)
 			{
-				if (q->isExternal())
-				{
-					bodies.push_back(q->m_body);
-					q = q->m_next;
-				}
-				else
-					q = q->m_more;
+				s_stat.m_ilist_hits += len;
+				s_stat.m_walk_saved_ms += s_stat.m_walk_ms;
 			}
+		}
+
+		if (!cache_valid)
+			s_stat.m_walk_ms = walk_ms;
+	}
+
+	void BHTreeNode::calcCellForces(size_t const i, bool const use_cache, bool const cache_valid, bool const mixed_precision,
+									size_t & num_calc, double & walk_ms, double & potential) const
+	{
+		auto const cell_start = Clock::now();
+		auto cell = s_crit_cells[i];
+
+		// discover bodies in group, which are the leaves in the cell's range of node indices
+		std::vector<std::reference_wrapper<ParticleData const>> bodies;
+		bodies.reserve(cell->m_num);
+
+		// an empty node has no children either, so is told apart from a leaf by its count
+		auto const end = s_packed[cell->m_index].next;
+		for (auto j = cell->m_index; j < end; j++)
+		{
+			if (s_nodes[j]->isExternal())
+				bodies.push_back(s_nodes[j]->m_body);
+		}
+
+		// find interactions for bodies in group
+		std::vector<size_t> walked;
+		if (!cache_valid)
+		{
+			ScopedCounters counters{ CounterPhase::TREE_WALK };
+			auto walk_start = Clock::now();
+			walked = cell->makeInteractionList();
+			walk_ms += Dble_ms{ Clock::now() - walk_start }.count();
 
-			// find interactions for bodies in group
-			auto ilist = cell->makeInteractionList(this);
+			if (use_cache)
+				s_ilist_cache[i] = std::move(walked);
+		}
+		auto const& ilist = use_cache ? s_ilist_cache[i] : walked;
 
+		ScopedCounters counters{ CounterPhase::FORCE_KERNEL };
+		if (mixed_precision)
+			cell->calcCellAccelMixed(bodies, ilist, potential);
+		else
+		{
 			std::for_each(bodies.begin(), bodies.end(), [&](auto &a)
 			{
 				auto b = a.get();
+				auto phi = 0.0;
 				b.m_deriv_state->acc = {};
-				for (auto const& elem : ilist)
-					b.m_deriv_state->acc += calcAccel(b, elem);
+				for (auto const idx : ilist)
+				{
+					// only the node moments are read, so a cached list sees the refitted tree
+					auto const& q = s_packed[idx];
+					b.m_deriv_state->acc += calcAccel(b, q.centre_mass, q.mass, phi);
+				}
 				for (auto const& b2 : bodies)
-					b.m_deriv_state->acc += calcAccel(b, b2);
+					b.m_deriv_state->acc += calcAccel(b, b2, phi);
 				if (s_renegades.size())
 					for (auto const& r : s_renegades)
-						b.m_deriv_state->acc += calcAccel(b, r);
-
-				s_stat.m_num_calc += (ilist.size() + bodies.size() + s_renegades.size());
+						b.m_deriv_state->acc += calcAccel(b, r, phi);
+				potential += b.m_aux_state->mass * phi;
 			});
 		}
+
+		num_calc += bodies.size() * (ilist.size() + bodies.size() + s_renegades.size());
+
+		// share the measured time between the bodies so next step's estimate survives a tree rebuild
+		auto const cost_per_body = Dble_ms{ Clock::now() - cell_start }.count() / bodies.size();
+		for (auto const& b : bodies)
+			s_body_cost[b.get().m_state - s_all.m_state] = cost_per_body;
 	}
 
-	std::vector<ParticleData> BHTreeNode::makeInteractionList(BHTreeNode const * root) const
+	void BHTreeNode::calcCellAccelMixed(std::vector<std::reference_wrapper<ParticleData const>> const& bodies,
+										std::vector<size_t> const& ilist, double & potential) const
 	{
-		std::vector<ParticleData> ilist;
-		//ilist.reserve(100);
+		auto const centre = m_quad.getPos();
+		auto const len = s_nodes[0]->m_quad.getLength();
+		auto const inv_len = 1.0 / len;
+		// with lengths in units of len, G m / len**2 gives accelerations in m s**-2 directly
+		auto const mass_scale = Constants::G * inv_len * inv_len;
+		auto const eps = Constants::SOFTENING * inv_len;
+
+		// gather the sources into single precision arrays, padded to a multiple of the SIMD width
+		// padding has zero mass so contributes nothing
+		auto const num_src = ilist.size() + bodies.size() + s_renegades.size();
+		auto const padded = (num_src + 3) & ~size_t{ 3 };
+		std::vector<float> xs(padded, 0.f), ys(padded, 0.f), ms(padded, 0.f);
+
+		auto n = size_t{ 0 };
+		auto add_source = [&](Vector2d const& pos, double const mass)
+		{
+			xs[n] = static_cast<float>((pos.x - centre.x) * inv_len);
+			ys[n] = static_cast<float>((pos.y - centre.y) * inv_len);
+			ms[n] = static_cast<float>(mass * mass_scale);
+			n++;
+		};
+
+		for (auto const idx : ilist)
+			add_source(s_packed[idx].centre_mass, s_packed[idx].mass);
+		for (auto const& b : bodies)
+			add_source(b.get().m_state->pos, b.get().m_aux_state->mass);
+		for (auto const& r : s_renegades)
+			add_source(r.m_state->pos, r.m_aux_state->mass);
 
-		for (auto q = root; q != root->m_next; )
+		auto const veps2 = _mm_set1_ps(static_cast<float>(eps * eps));
+		auto const zero = _mm_setzero_ps();
+		auto const one_half = _mm_set1_ps(0.5f);
+		auto const three_halves = _mm_set1_ps(1.5f);
+
+		for (auto const& a : bodies)
 		{
-			// ignore self-interactions
-			if (q == this)
+			auto const& b = a.get();
+			auto const xi = _mm_set1_ps(static_cast<float>((b.m_state->pos.x - centre.x) * inv_len));
+			auto const yi = _mm_set1_ps(static_cast<float>((b.m_state->pos.y - centre.y) * inv_len));
+
+			auto ax_lo = _mm_setzero_pd(), ax_hi = _mm_setzero_pd();
+			auto ay_lo = _mm_setzero_pd(), ay_hi = _mm_setzero_pd();
+			auto phi_lo = _mm_setzero_pd(), phi_hi = _mm_setzero_pd();
+
+			for (size_t k = 0; k < padded; k += 4)
 			{
-				q = q->m_next;
-				continue;
+				auto dx = _mm_sub_ps(_mm_loadu_ps(&xs[k]), xi);
+				auto dy = _mm_sub_ps(_mm_loadu_ps(&ys[k]), yi);
+				auto r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)); // |r|**2
+
+				// ignore self-interactions (and padding, which may coincide with the body)
+				auto not_self = _mm_cmpgt_ps(r2, zero);
+
+				// a = G m r / max(|r|, eps)**3, as in the double precision kernel
+				auto soft_r2 = _mm_max_ps(r2, veps2);
+				auto denom = _mm_mul_ps(soft_r2, _mm_sqrt_ps(soft_r2));
+				auto f = _mm_and_ps(_mm_div_ps(_mm_loadu_ps(&ms[k]), denom), not_self);
+				auto fx = _mm_mul_ps(f, dx);
+				auto fy = _mm_mul_ps(f, dy);
+				// G m (3 max(|r|, eps)**2 - |r|**2) / (2 max(|r|, eps)**3), as in the double precision kernel
+				auto phi = _mm_mul_ps(f, _mm_sub_ps(_mm_mul_ps(three_halves, soft_r2), _mm_mul_ps(one_half, r2)));
+
+				// accumulate in double precision
+				ax_lo = _mm_add_pd(ax_lo, _mm_cvtps_pd(fx));
+				ax_hi = _mm_add_pd(ax_hi, _mm_cvtps_pd(_mm_movehl_ps(fx, fx)));
+				ay_lo = _mm_add_pd(ay_lo, _mm_cvtps_pd(fy));
+				ay_hi = _mm_add_pd(ay_hi, _mm_cvtps_pd(_mm_movehl_ps(fy, fy)));
+				phi_lo = _mm_add_pd(phi_lo, _mm_cvtps_pd(phi));
+				phi_hi = _mm_add_pd(phi_hi, _mm_cvtps_pd(_mm_movehl_ps(phi, phi)));
 			}
 
-			// if this node is leaf, use direct calculation
-			if (q->isExternal())
+			auto acc = _mm_hadd_pd(_mm_add_pd(ax_lo, ax_hi), _mm_add_pd(ay_lo, ay_hi));
+			b.m_deriv_state->acc = Vector2d{ acc };
+
+			// the potential is in units of len, so must be scaled back
+			auto phi = _mm_add_pd(phi_lo, phi_hi);
+			potential -= b.m_aux_state->mass * len * _mm_cvtsd_f64(_mm_hadd_pd(phi, phi));
+		}
+	}
+
+	void BHTreeNode::calcRenegadeForces(size_t & num_calc, double & potential) const
+	{
+		auto const num_renegades = static_cast<int>(s_renegades.size());
+		auto const none = s_nodes.size();
+
+#pragma omp parallel for schedule(dynamic) reduction(+:num_calc,potential)
+		for (auto i = 0; i < num_renegades; i++)
+		{
+			auto const& b = s_renegades[i];
+
+			// a group of one body, which every node is tested against
+			PackedNode group{};
+			group.centre_mass = b.m_state->pos;
+			auto ilist = makeInteractionList(group, none);
+
+			auto phi = 0.0;
+			b.m_deriv_state->acc = {};
+			for (auto const idx : ilist)
 			{
-				ilist.push_back(q->m_body);
+				auto const& q = s_packed[idx];
+				b.m_deriv_state->acc += calcAccel(b, q.centre_mass, q.mass, phi);
+			}
+			for (auto const& r : s_renegades)
+				b.m_deriv_state->acc += calcAccel(b, r, phi);
+			potential += b.m_aux_state->mass * phi;
+
+			num_calc += ilist.size() + s_renegades.size();
+		}
+	}
+
+	double BHTreeNode::estimateCost(double const default_cost) const
+	{
+		auto cost = 0.0;
 
-				q = q->m_next;
-				//s_stat.m_num_calc++;
+		auto const end = s_packed[m_index].next;
+		for (auto j = m_index; j < end; j++)
+		{
+			if (s_nodes[j]->isExternal())
+			{
+				auto const body_cost = s_body_cost[s_nodes[j]->m_body.m_state - s_all.m_state];
+				cost += body_cost > 0.0 ? body_cost : default_cost;
 			}
-			else // !q->isExternal()
+		}
+		return cost;
+	}
+
+	int BHTreeNode::getMaxThreads()
+	{
+#ifdef _OPENMP
+		return omp_get_max_threads();
+#else
+		return 1;
+#endif
+	}
+
+	int BHTreeNode::getNumThreads()
+	{
+#ifdef _OPENMP
+		return omp_get_num_threads();
+#else
+		return 1;
+#endif
+	}
+
+	std::vector<size_t> BHTreeNode::makeInteractionList() const
+	{
+		return makeInteractionList(s_packed[m_index], m_index);
+	}
+
+	std::vector<size_t> BHTreeNode::makeInteractionList(PackedNode const& group, size_t const self)
+	{
+		std::vector<size_t> ilist;
+		//ilist.reserve(100);
+
+		auto const num_nodes = s_nodes.size();
+
+		for (size_t i = 0; i < num_nodes; )
+		{
+			auto const& q = s_packed[i];
+
+			// ignore self-interactions
+			if (i == self)
 			{
-				// if node is far enough, use BH approx
-				if (accept(q))
-				{
-					// construct 'combined particle'
-					ilist.emplace_back(&q->m_c_state, &q->m_c_aux_state);
+				i = q.next;
+				continue;
+			}
 
-					//q->m_subdivided = false;
-					q = q->m_next;
-					//s_stat.m_num_calc++;
-				}
-				else // try daughters
-				{
-					//q->m_subdivided = true;
-					q = q->m_more;
-				}
+			// if this node is leaf, use direct calculation
+			// if node is far enough, use BH approx with 'combined particle'
+			if (q.next == i + 1 || accept(group, q))
+			{
+				ilist.push_back(i);
+				i = q.next;
 			}
+			else // try daughters
+				i++;
 		}
 		return ilist;
 	}
 
 	// accel caused by p2 on p1
-	Vector2d BHTreeNode::calcAccel(ParticleData const & p1, ParticleData const & p2)
+	Vector2d BHTreeNode::calcAccel(ParticleData const & p1, ParticleData const & p2, double & potential)
 	{
-		auto const& s1 = *p1.m_state;
-		auto const& s2 = *p2.m_state;
+		return calcAccel(p1, p2.m_state->pos, p2.m_aux_state->mass, potential);
+	}
 
-		auto r1 = _mm_load_pd(&s1.pos.x);
-		auto r2 = _mm_load_pd(&s2.pos.x);
-		auto m2 = p2.m_aux_state->mass;
+	Vector2d BHTreeNode::calcAccel(ParticleData const & p1, Vector2d const & pos2, double const m2, double & potential)
+	{
+		auto r1 = _mm_load_pd(&p1.m_state->pos.x);
+		auto r2 = _mm_load_pd(&pos2.x);
 
 		// ignore self-interactions
 		auto cmp = _mm_cmpeq_pd(r1, r2);
 		auto cmp_equal = _mm_movemask_pd(cmp);
-		if (cmp_equal)
+		if (cmp_equal == 3)
 			return {};
 
 		auto rel_pos = _mm_sub_pd(r2, r1); // relative position vector r
-		auto rel_pos_mag_sq = _mm_dp_pd(rel_pos, rel_pos, 0x33); // |r|**2
-		auto rel_pos_mag = _mm_sqrt_pd(rel_pos_mag_sq); // |r|
+		auto unsoft_mag_sq = _mm_dp_pd(rel_pos, rel_pos, 0x33); // |r|**2
 
-		auto unit_vec = _mm_div_pd(rel_pos, rel_pos_mag); // rhat = r/|r|
+		// softened as in the brute-force model, so the force falls to zero inside the softening length
 		auto eps2 = Constants::SOFTENING * Constants::SOFTENING;
 		auto veps2 = _mm_set_pd(eps2, eps2);
-		rel_pos_mag_sq = _mm_max_pd(rel_pos_mag_sq, veps2);
-		auto scale = _mm_set_pd(Constants::G * m2, Constants::G * m2); // F = (G m1 m2 / (|r|**2) * r_hat
-		auto res = _mm_mul_pd(scale, _mm_div_pd(unit_vec, rel_pos_mag_sq)); // a = F / m1
+		auto rel_pos_mag_sq = _mm_max_pd(unsoft_mag_sq, veps2);
+		auto rel_pos_mag = _mm_sqrt_pd(rel_pos_mag_sq); // max(|r|, eps)
+
+		// G m / max(|r|, eps)**3, shared by the force and the potential
+		auto gm = Constants::G * m2;
+		auto scale = _mm_div_pd(_mm_set_pd(gm, gm), _mm_mul_pd(rel_pos_mag_sq, rel_pos_mag));
+		auto res = _mm_mul_pd(scale, rel_pos); // a = G m r / max(|r|, eps)**3
+
+		// the potential whose gradient is the softened force: -G m / |r| outside the softening length,
+		// and -G m (3 eps**2 - |r|**2) / (2 eps**3) inside it
+		auto phi = _mm_sub_sd(_mm_mul_sd(_mm_set_sd(1.5), rel_pos_mag_sq), _mm_mul_sd(_mm_set_sd(0.5), unsoft_mag_sq));
+		potential -= _mm_cvtsd_f64(_mm_mul_sd(scale, phi));
 
 		return Vector2d{ res };
 	}
 
-	bool BHTreeNode::accept(BHTreeNode const * n) const
+	bool BHTreeNode::accept(PackedNode const& group, PackedNode const& n)
 	{
-		/*auto group_centre = group->m_quad.getPos();
-		auto group_half_len = group->m_quad.getLength() / 2.0;
-		auto delta_pos = n->getCentreMass() - group_centre;
-
-		auto contact_x = std::min(abs(delta_pos.x), group_half_len);
-		auto contact_y = std::min(abs(delta_pos.y), group_half_len);
-		contact_x *= delta_pos.x > 0 ? 1 : -1;
-		contact_y *= delta_pos.y > 0 ? 1 : -1;
-
-		auto contact = Vector2d{ contact_x, contact_y } +group_centre;
-
-		auto rel_pos = n->getCentreMass() - contact;
-		auto rel_pos_mag_sq = rel_pos.mag_sq();
-
-		return rel_pos_mag_sq > n->m_rcrit_sq;*/
+		auto constexpr inv_pc_sq = 1.0 / (Constants::PARSEC * Constants::PARSEC);
 
-		auto delta = n->getCentreMass() - n->getQuad().getPos();
-		auto delta_sq = delta.mag_sq();
-		auto rel_pos = getCentreMass() - n->getCentreMass();
+		auto rel_pos = group.centre_mass - n.centre_mass;
 		auto rel_pos_mag_sq = rel_pos.mag_sq();
 
-		return rel_pos_mag_sq > n->m_rcrit_sq + delta_sq;
+		return rel_pos_mag_sq * inv_pc_sq > n.accept_sq;
 	}
 }
@@ -5,6 +5,9 @@
 #include "Types.h"
 #include "Vector.h"
 
+#include <cstdint>
+#include <functional>
+#include <utility>
 #include <vector>
 
 namespace nbody
@@ -19,8 +22,29 @@ namespace nbody
 		size_t m_body_ct; // Number of bodies in tree
 		size_t m_max_level; // Deepest level in tree
 		size_t m_num_crit_size; // Number of cells containing fewer than CRIT_SIZE bodies
+		size_t m_ilist_hits; // Number of interaction lists reused from the cache since caching was enabled
+		size_t m_ilist_lookups; // Number of interaction lists requested since caching was enabled
+		double m_walk_ms; // CPU time spent walking the tree, summed over threads, the last time interaction lists were built
+		double m_walk_saved_ms; // Estimated walk CPU time avoided by reusing cached interaction lists
+		std::vector<double> m_thread_busy_ms; // Time each thread spent calculating forces in the last step
+		std::vector<double> m_thread_idle_ms; // Time each thread spent waiting for the slowest thread in the last step
 	};
 
+	/**
+	 * \brief The part of a tree node needed to walk the tree and evaluate forces, packed into 32 bytes
+	 *		  so that two nodes share each cache line. Nodes are stored depth-first, so the first daughter
+	 *		  of node i is always node i + 1, and node i is a leaf exactly when next is i + 1.
+	 */
+	struct alignas(32) PackedNode
+	{
+		Vector2d centre_mass;
+		double mass;
+		float accept_sq; // Squared distance beyond which the node may be aggregated, in square parsecs
+		uint32_t next; // Index of the first node after this node's subtree
+	};
+
+	static_assert(sizeof(PackedNode) == 32, "PackedNode should fill exactly half a cache line");
+
 	class BHTreeNode
 	{
 	public:
@@ -43,8 +67,11 @@ namespace nbody
 		 * \brief Recursively re-initialise this tree node and any daughter nodes.
 		 *		  May only be called from the root node.
 		 * \param q The Quad object encapsulating the new physical size of the root node.
+		 * \param all The ParticleData object encapsulating the arrays into which bodies subsequently
+		 *			  inserted into the tree will point.
+		 * \param num_all The number of bodies in those arrays.
 		 */
-		void reset(Quad const& q);
+		void reset(Quad const& q, ParticleData const& all, size_t const num_all);
 
 		bool isRoot() const;
 		bool isExternal() const;
@@ -53,12 +80,39 @@ namespace nbody
 		double getMass() const;
 		size_t getLevel() const;
 		size_t getNumBodies() const;
+		size_t getIndex() const;
 		Quad const& getQuad() const;
 		Vector2d const& getCentreMass() const;
 		
 		static size_t getNumRenegades();
-		static double getTheta();	
+
+		/**
+		 * \brief The potential energy of the bodies in the last call to calcForces, in J, found alongside the
+		 *		  forces and so as accurate as them. The potential is softened consistently with the force.
+		 */
+		static double getPotentialEnergy();
+		static double getTheta();
+		static size_t getCritSize();
+
+		/**
+		 * \brief Set the opening angle used by the BH criterion. Takes effect when the tree is next reset.
+		 */
+		static void setTheta(double const theta);
+
+		/**
+		 * \brief Set the number of bodies below which a node becomes a critical cell, whose bodies share
+		 *		  an interaction list. Takes effect when the tree is next built. Throws an Error if it is less
+		 *		  than 2, as no node with a body would then be a critical cell.
+		 */
+		static void setCritSize(size_t const crit_size);
 		static DebugStats const& getStats();
+		static void resetCacheStats();
+
+		/**
+		 * \brief Rearrange the per-body force calculation costs after the particle arrays have been sorted or compacted.
+		 * \param order The body now in slot i was previously in slot order[i].
+		 */
+		static void permuteBodyCosts(std::vector<size_t> const& order);
 		
 		/**
 		 * \brief Recursively search this tree node and any daughter nodes to determine a point lies within
@@ -68,6 +122,28 @@ namespace nbody
 		 *		   pointer to the deepest node in the tree containing the point. Otherwise, returns null.
 		 */
 		BHTreeNode const* getHovered(Vector2d const& pos) const;
+
+		/**
+		 * \brief Find the bodies which may lie within a rectangle, skipping every subtree whose bodies all lay
+		 *		  outside it when the tree was last built or refitted. Renegades are always included.
+		 *		  May only be called from the root node.
+		 * \param min The corner of the rectangle with the lowest coordinates, in world coordinates.
+		 * \param max The corner of the rectangle with the highest coordinates, in world coordinates.
+		 * \param max_bodies The most bodies worth finding, beyond which it is quicker to look at every body.
+		 * \param indices Appended with the array index of each body found, in depth-first order.
+		 * \return False, having found nothing, if more than max_bodies bodies would be found.
+		 */
+		bool findBodies(Vector2d const& min, Vector2d const& max, size_t const max_bodies, std::vector<uint32_t> & indices) const;
+
+		/**
+		 * \brief Find every pair of bodies closer together than a distance. The tree is walked once for the
+		 *		  bodies of each critical cell and once for each renegade, in parallel, skipping every subtree
+		 *		  whose bodies are all too far away. Bodies at the same position are always found.
+		 *		  May only be called from the root node, after the tree has been built or refitted to the current positions.
+		 * \param radius The distance, in m.
+		 * \param pairs Appended with the array indices of each pair, lower index first, in ascending order.
+		 */
+		void findClosePairs(double const radius, std::vector<std::pair<uint32_t, uint32_t>> & pairs) const;
 		
 		BHTreeNode const* getParent() const;
 
@@ -81,26 +157,39 @@ namespace nbody
 		
 		/**
 		 * \brief Recursively calculate masses and centres of masses for this cell and its daughters,
-		 *		  and dstore a pointer to every node containing fewer than s_CRIT_SIZE bodies in the 
+		 *		  and dstore a pointer to every node containing fewer than s_crit_size bodies in the 
 		 *		  vector s_crit_cells. Children of such nodes are not also added to this vector.
 		 */
 		void computeMassDistribution();
 
 		/**
-		 * \brief Recursively assign values to the m_next and m_more pointers used to thread the tree so
-		 *		  that it may be traversed iteratively.
-		 * \param next Pointer to this node's next sibling, or to the parent node's sibling if this node
-		 *			   is the last child. Null if no value is supplied.
+		 * \brief Recursively number this node and its daughters in depth-first order, and copy the data
+		 *		  needed to walk the tree into the packed node array so that it may be traversed iteratively.
+		 *		  Must be called from the root node after computeMassDistribution.
 		 */
-		void threadTree(BHTreeNode * next = nullptr);
+		void threadTree();
+
+		/**
+		 * \brief Recompute masses and centres of mass of the existing tree after the bodies have moved,
+		 *		  without re-inserting them. Bodies keep the cells they were inserted into, so the tree
+		 *		  topology (and any cached interaction lists) remains valid. May only be called from the root node.
+		 * \param all The ParticleData object encapsulating the arrays now holding the bodies' states.
+		 *			  Must be laid out identically to the arrays the tree was built from.
+		 */
+		void refit(ParticleData const& all);
 
 		/**
 		 * \brief Calculate forces on all bodies within this node.
+		 *		  Critical cells are split between threads in contiguous runs of equal estimated cost,
+		 *		  using the time taken by each cell's bodies in the previous call. Renegades are then
+		 *		  given their own interaction lists, always in double precision.
+		 * \param use_cache If true, the interaction list of each critical cell is stored the first time
+		 *		  it is built and reused by later calls until the tree is next reset.
+		 * \param mixed_precision If true, use the single precision kernel (see calcCellAccelMixed).
 		 */
-		void calcForces() const;
+		void calcForces(bool use_cache = false, bool mixed_precision = false) const;
 
 		BHTreeNode *m_daughters[NUM_DAUGHTERS];
-		BHTreeNode *m_more, *m_next;
 
 	private:
 		/**
@@ -116,6 +205,75 @@ namespace nbody
 		*/
 		void treeStatReset() const;
 		
+		/**
+		 * \brief Calculate forces on the bodies in one critical cell, and record the time taken.
+		 * \param i Index of the cell in s_crit_cells.
+		 * \param use_cache Whether the cell's interaction list should be stored in or taken from s_ilist_cache.
+		 * \param cache_valid Whether s_ilist_cache already holds the list for this cell.
+		 * \param mixed_precision Whether to use the single precision kernel.
+		 * \param num_calc Incremented by the number of interactions evaluated.
+		 * \param walk_ms Incremented by the time spent building the interaction list.
+		 * \param potential Incremented by the sum over the cell's bodies of mass times potential.
+		 */
+		void calcCellForces(size_t const i, bool const use_cache, bool const cache_valid, bool const mixed_precision,
+							size_t & num_calc, double & walk_ms, double & potential) const;
+
+		/**
+		 * \brief Calculate accelerations on the bodies in this critical cell in single precision.
+		 *		  Positions are taken relative to the cell's centre and measured in units of the root
+		 *		  node's side length, so the nearby sources that dominate the force keep their precision
+		 *		  and nothing overflows; four interactions are evaluated per SSE instruction and the
+		 *		  partial accelerations are summed in double precision.
+		 *		  Against the double precision kernel on the same tree, the relative error in a body's
+		 *		  acceleration has a median of ~1e-7, a 99th percentile of ~1e-6 and a worst case of ~2e-5
+		 *		  (20000 bodies, Plummer, exponential and realistic distributions), far below the error of
+		 *		  the Barnes-Hut approximation itself.
+		 * \param bodies The bodies in this cell.
+		 * \param ilist The cell's interaction list.
+		 * \param potential Incremented by the sum over the cell's bodies of mass times potential.
+		 */
+		void calcCellAccelMixed(std::vector<std::reference_wrapper<ParticleData const>> const& bodies,
+								std::vector<size_t> const& ilist, double & potential) const;
+
+		/**
+		 * \brief Calculate forces on the renegade bodies outside the root node, walking the tree once for each.
+		 * \param num_calc Incremented by the number of interactions evaluated.
+		 * \param potential Incremented by the sum over the renegades of mass times potential.
+		 */
+		void calcRenegadeForces(size_t & num_calc, double & potential) const;
+
+		/**
+		 * \brief Estimate the time needed to calculate forces on the bodies in this node from the
+		 *		  time they took in the previous step.
+		 * \param default_cost The time assumed for a body which has not been timed yet.
+		 */
+		double estimateCost(double const default_cost) const;
+
+		static int getMaxThreads();
+		static int getNumThreads();
+
+		/**
+		 * \brief Fill s_packed from the numbered nodes in s_nodes, growing it if needed.
+		 */
+		static void packNodes();
+
+		/**
+		 * \brief Recursively remap the body pointers of this node and its daughters from the arrays
+		 *		  in s_all to those in all, and recompute the masses and centres of mass.
+		 */
+		void refitNode(ParticleData const& all);
+
+		/**
+		 * \brief Divide the mass-weighted sum of positions by the mass, once the daughters have been added.
+		 */
+		void finishCentreMass();
+
+		/**
+		 * \brief Empty the bounding box, so that it may be grown to enclose the daughters' boxes.
+		 */
+		void clearBounds();
+		void growBounds(BHTreeNode const& daughter);
+
 		/**
 		 * \brief Create a new tree node which will become one of this node's daughters.
 		 * \param which The Daughter enumeration specifying which daughter to create.
@@ -127,46 +285,73 @@ namespace nbody
 		 * \brief Calculate the acceleration due to the gravitational interaction between two masses.
 		 * \param p1 The ParticleData object encapsulating the properties of the first object.
 		 * \param p2 The ParticleData object encapsulating the properties of the second object.
+		 * \param potential Decreased by the gravitational potential at p1 due to p2, in J/kg.
 		 * \return The acceleration experienced by p1 due to p2. If p1 and p2 have the same coordinates
-		 *		   (e.g. they are the same object), a zero vector is returned.
+		 *		   (e.g. they are the same object), a zero vector is returned and potential is unchanged.
+		 */
+		static Vector2d calcAccel(ParticleData const& p1, ParticleData const& p2, double & potential);
+
+		/**
+		 * \brief Calculate the acceleration of p1 due to a point mass m2 at pos2.
+		 *		  pos2 must be 16-byte aligned.
 		 */
-		static Vector2d calcAccel(ParticleData const& p1, ParticleData const& p2);
+		static Vector2d calcAccel(ParticleData const& p1, Vector2d const& pos2, double const m2, double & potential);
 
 		/**
-		 * \brief Construct a list of ParticleData objects for which interactions should be evaluated for
-		 *		  bodies within this node. The interaction list may contain both external bodies and combined
-		 *		  masses from internal nodes for which the BH criterion permits multiple bodies to be
-		 *		  aggregated into one.
-		 * \param root Pointer to the root node of the tree.
+		 * \brief Construct a list of the tree nodes for which interactions should be evaluated for
+		 *		  bodies within this node. The interaction list may contain both external nodes and
+		 *		  internal nodes for which the BH criterion permits multiple bodies to be aggregated into one.
+		 *		  Nodes are stored by their index into s_packed, so the list stays valid while the tree is refitted.
+		 *		  Only the packed node array is read.
 		 * \return The complete list of interactions after the entire tree has been searched.
 		 */
-		std::vector<ParticleData> makeInteractionList(BHTreeNode const* root) const;
+		std::vector<size_t> makeInteractionList() const;
+
+		/**
+		 * \brief Construct the interaction list for a group of bodies described by a packed node,
+		 *		  which need not be part of the tree.
+		 * \param group The packed node whose centre of mass the BH criterion is tested against.
+		 * \param self Index of the group's own node, which is skipped. Pass s_nodes.size() for none.
+		 */
+		static std::vector<size_t> makeInteractionList(PackedNode const& group, size_t const self);
 		
 		/**
 		 * \brief Determine whether the BH criterion permits the bodies within a tree node to be aggregated.
-		 * \param node_to_test The tree node to determine the BH criterion for.
+		 * \param group The packed node for the group of bodies whose interactions are being found.
+		 * \param node_to_test The packed node to determine the BH criterion for.
 		 * \return True if the node satisfies the criterion and the bodies within it may be aggregated.
 		 */
-		bool accept(BHTreeNode const* node_to_test) const;
+		static bool accept(PackedNode const& group, PackedNode const& node_to_test);
 
 		size_t m_level;
 		ParticleData m_body;
 
 		// 'combined' particle
-		ParticleState m_c_state;
-		ParticleAuxState m_c_aux_state;
+		Vector2d m_centre_mass;
+		double m_mass;
 
 		double m_rcrit_sq;
 		Quad m_quad;
+		// bounding box of the bodies when the tree was last built or refitted, which may extend past m_quad
+		Vector2d m_min, m_max;
 		BHTreeNode const* m_parent;
 		size_t m_num;
+		size_t m_index;
 		mutable bool m_subdivided;
 
 		static std::vector<ParticleData> s_renegades;
 		static std::vector<BHTreeNode const*> s_crit_cells;
+		static std::vector<BHTreeNode const*> s_nodes;
+		static PackedNode * s_packed;
+		static size_t s_packed_cap;
+		static std::vector<std::vector<size_t>> s_ilist_cache;
+		static ParticleData s_all;
+		static std::vector<double> s_body_cost;
+		static std::vector<double> s_cell_cost;
 
-		double static constexpr s_THETA = 0.9;
-		size_t static constexpr s_CRIT_SIZE = 32;
+		static double s_potential_energy;
+		static double s_theta;
+		static size_t s_crit_size;
 		
 		static DebugStats s_stat;
 	};
@@ -7,14 +7,19 @@
 
 #include <SFML/Graphics/Color.hpp>
 
+#include <memory>
+#include <string>
+
 namespace nbody
 {
+	struct ParticleImage;
+
 	struct BodyGroupProperties
 	{
 		BodyGroupProperties() :
 			dist(DistributorType::INVALID), num(0), pos(), vel(), radius(0), use_parsecs(true),
 			min_mass(0), max_mass(0), has_central_mass(false), central_mass(0),
-			colour(ColourerType::INVALID), cols{} {}
+			colour(ColourerType::INVALID), cols{}, seed(IDistributor::randomSeed()) {}
 
 		DistributorType dist;
 		int num;
@@ -28,6 +33,12 @@ namespace nbody
 		double central_mass;
 		ColourerType colour;
 		sf::Color cols[MAX_COLS_PER_COLOURER];
+		// the random numbers used by the distributor are derived from this alone
+		uint32_t seed;
+		// the particle file read by DistributorType::FROM_FILE
+		std::string file_name;
+		// bodies saved in the settings file, which are used instead of the distribution if set
+		std::shared_ptr<ParticleImage const> embedded;
 	};
 }
 
@@ -1,88 +1,257 @@
+#include "BHTreeNode.h"
 #include "BodyManager.h"
 #include "Display.h"
 #include "Types.h"
 
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
 namespace nbody
 {
-	BodyManager::BodyManager() : m_vtx_array(sf::Triangles), m_scl(0), m_first_update(true)
+	BodyManager::BodyManager() : m_vtx_array(sf::Quads), m_mode(BodyRenderMode::AUTO), m_density_colour(true),
+		m_drawing_density(false), m_num_examined(0), m_scl(0), m_first_update(true)
 	{
-		// cache the vertices of a unit circle
-		for (size_t i = 0; i < s_VERTICES; i++)
+		// draw the disc once, with an antialiased edge, rather than building each body from triangles
+		auto const centre = 0.5f * s_TEXTURE_SIZE;
+		sf::Image disc;
+		disc.create(s_TEXTURE_SIZE, s_TEXTURE_SIZE, sf::Color::Transparent);
+		for (unsigned y = 0; y < s_TEXTURE_SIZE; y++)
 		{
-			m_unit_circle[i] = { cos(i * s_THETA), sin(i * s_THETA) };
+			for (unsigned x = 0; x < s_TEXTURE_SIZE; x++)
+			{
+				auto const dist = std::hypot(x + 0.5f - centre, y + 0.5f - centre);
+				auto const coverage = std::max(0.f, std::min(centre - dist, 1.f));
+				disc.setPixel(x, y, { 255, 255, 255, static_cast<sf::Uint8>(255 * coverage) });
+			}
 		}
+		m_disc.loadFromImage(disc);
+		m_disc.setSmooth(true);
 	}
 
 	BodyManager::~BodyManager()
 	{
 	}
 
-	void BodyManager::update(Vector2d const* state, ParticleAuxState const* aux_state, ParticleColourState const* colour_state, size_t const num_bodies)
+	void BodyManager::update(Vector2d const* state, ParticleAuxState const* aux_state, ParticleColourState const* colour_state,
+							 bool const* removed, size_t const num_bodies, BHTreeNode const* tree)
 	{
 		auto bodies = reinterpret_cast<ParticleState const*>(state);
 
-		if (m_first_update)
+		if (m_first_update || num_bodies != m_radii.size())
 		{
-			// on first step, cache all (screen-coordinate) radii
+			// on first step, or when bodies have been added or compacted away, cache all (screen-coordinate) radii
 			m_radii.resize(num_bodies);
 			for (size_t i = 0; i < num_bodies; i++)
 			{
-				m_radii[i] = radiusFromMass(aux_state[i].mass);
+				m_radii[i] = removed[i] ? 0.f : radiusFromMass(aux_state[i].mass);
 			}
 			m_first_update = false;
 		}
 
 		m_scl = Display::bodyScalingFunc(Display::screen_scale);
 
-		m_vtx_array.clear();
+		uint32_t const* indices = nullptr;
+		auto num = num_bodies;
+		if (tree)
+		{
+			// look only at the bodies in subtrees which reach the screen, widened by the largest body
+			// and by a margin for bodies which have moved since the tree was built
+			auto const transform = Display::worldToScreenTransform();
+			auto const margin = s_BH_SIZE * m_scl + s_CULL_MARGIN;
+			auto const x0 = (-margin - transform.offset_x) / transform.scale_x;
+			auto const x1 = (Display::screen_size.x + margin - transform.offset_x) / transform.scale_x;
+			auto const y0 = (-margin - transform.offset_y) / transform.scale_y;
+			auto const y1 = (Display::screen_size.y + margin - transform.offset_y) / transform.scale_y;
+
+			m_candidates.clear();
+			if (tree->findBodies({ std::min(x0, x1), std::min(y0, y1) }, { std::max(x0, x1), std::max(y0, y1) },
+								 num_bodies / s_CULL_RATIO, m_candidates))
+			{
+				indices = m_candidates.data();
+				num = m_candidates.size();
+			}
+		}
+
+		m_num_examined = num;
+		m_drawing_density = m_mode == BodyRenderMode::DENSITY
+			|| (m_mode == BodyRenderMode::AUTO && Display::screen_scale > s_DENSITY_SCALE);
+		if (m_drawing_density)
+			updateDensity(bodies, colour_state, indices, num);
+		else
+			updateCircles(bodies, colour_state, indices, num);
+	}
+
+	void BodyManager::updateCircles(ParticleState const* bodies, ParticleColourState const* colour_state, uint32_t const* indices, size_t const num)
+	{
+		auto const num_looked = static_cast<int>(num);
+		auto const transform = Display::worldToScreenTransform();
+
+		// find the visible bodies, then give each a quad in the order they were looked at
+		m_slots.resize(num + 1);
+		m_slots[0] = 0;
+		#pragma omp parallel for schedule(static)
+		for (auto k = 0; k < num_looked; k++)
+		{
+			auto const i = indices ? indices[k] : k;
+			auto const screen_x = transform.toScreenX(bodies[i].pos.x);
+			auto const screen_y = transform.toScreenY(bodies[i].pos.y);
+			auto const radius = m_radii[i] * m_scl;
+			// bodies partly on screen are drawn
+			m_slots[k + 1] = radius > 0 && screen_x + radius > 0 && screen_x - radius < Display::screen_size.x
+				&& screen_y + radius > 0 && screen_y - radius < Display::screen_size.y;
+		}
+		std::partial_sum(m_slots.begin(), m_slots.end(), m_slots.begin());
+		m_vtx_array.resize(4 * m_slots[num]);
 
-		for (size_t i = 0; i < num_bodies; i++)
+		auto const tex_size = static_cast<float>(s_TEXTURE_SIZE);
+		#pragma omp parallel for schedule(static)
+		for (auto k = 0; k < num_looked; k++)
 		{
-			drawBody(bodies[i], colour_state[i], i);
+			if (m_slots[k + 1] == m_slots[k])
+				continue;
+
+			auto const i = indices ? indices[k] : k;
+			auto const pos = sf::Vector2f{ transform.toScreenX(bodies[i].pos.x), transform.toScreenY(bodies[i].pos.y) };
+			auto const radius = m_radii[i] * m_scl;
+			auto const col = colour_state[i].colour;
+			auto quad = &m_vtx_array[4 * m_slots[k]];
+			quad[0] = { { pos.x - radius, pos.y - radius }, col, { 0, 0 } };
+			quad[1] = { { pos.x + radius, pos.y - radius }, col, { tex_size, 0 } };
+			quad[2] = { { pos.x + radius, pos.y + radius }, col, { tex_size, tex_size } };
+			quad[3] = { { pos.x - radius, pos.y + radius }, col, { 0, tex_size } };
 		}
 	}
 
-	void BodyManager::drawBody(ParticleState const & p, ParticleColourState const& c, size_t const idx)
+	void BodyManager::updateDensity(ParticleState const* bodies, ParticleColourState const* colour_state, uint32_t const* indices, size_t const num)
 	{
-		auto world_pos = p.pos;
+		auto const width = static_cast<unsigned>(Display::screen_size.x);
+		auto const height = static_cast<unsigned>(Display::screen_size.y);
+		if (width == 0 || height == 0)
+			return;
 
-		auto screen_x = Display::worldToScreenX(world_pos.x);
-		auto screen_y = Display::worldToScreenY(world_pos.y);
+		auto const num_pixels = static_cast<size_t>(width) * height;
+		auto const num_strips = static_cast<int>((height + s_STRIP_ROWS - 1) / s_STRIP_ROWS);
+		if (m_density.getSize() != sf::Vector2u{ width, height })
+		{
+			m_density.create(width, height);
+			m_accum.assign(4 * num_pixels, 0);
+			m_pixels.resize(4 * num_pixels);
+			m_strip_max.assign(num_strips, 0);
+		}
 
-		auto is_visible = screen_x < Display::screen_size.x && screen_x > 0 && screen_y < Display::screen_size.y && screen_y > 0;
+		// find each body's pixel, and count the bodies of each block in each strip
+		auto const transform = Display::worldToScreenTransform();
+		auto const block_size = (num + s_DENSITY_BLOCKS - 1) / s_DENSITY_BLOCKS;
+		m_pixel.resize(num);
+		m_cells.assign(static_cast<size_t>(num_strips) * s_DENSITY_BLOCKS, 0);
+		#pragma omp parallel for schedule(static)
+		for (auto b = 0; b < s_DENSITY_BLOCKS; b++)
+		{
+			auto const end = std::min(num, (b + 1) * block_size);
+			for (auto k = b * block_size; k < end; k++)
+			{
+				auto const i = indices ? indices[k] : k;
+				auto const screen_x = transform.toScreenX(bodies[i].pos.x);
+				auto const screen_y = transform.toScreenY(bodies[i].pos.y);
+				if (m_radii[i] == 0 || screen_x < 0 || screen_x >= width || screen_y < 0 || screen_y >= height)
+				{
+					m_pixel[k] = s_OFF_SCREEN;
+					continue;
+				}
+				auto const y = static_cast<uint32_t>(screen_y);
+				m_pixel[k] = y * width + static_cast<uint32_t>(screen_x);
+				m_cells[(y / s_STRIP_ROWS) * s_DENSITY_BLOCKS + b]++;
+			}
+		}
 
-		if (is_visible)
+		// sort the bodies by strip, keeping their order within each, so the sums are the same every time
+		m_strip_start.resize(num_strips + 1);
+		uint32_t total = 0;
+		for (size_t c = 0; c < m_cells.size(); c++)
+		{
+			if (c % s_DENSITY_BLOCKS == 0)
+				m_strip_start[c / s_DENSITY_BLOCKS] = total;
+			auto const count = m_cells[c];
+			m_cells[c] = total;
+			total += count;
+		}
+		m_strip_start[num_strips] = total;
+		m_splats.resize(total);
+		#pragma omp parallel for schedule(static)
+		for (auto b = 0; b < s_DENSITY_BLOCKS; b++)
 		{
-			auto pos = sf::Vector2f{ screen_x, screen_y };
-			auto radius = m_radii[idx] * m_scl;
+			auto const end = std::min(num, (b + 1) * block_size);
+			for (auto k = b * block_size; k < end; k++)
+			{
+				auto const pixel = m_pixel[k];
+				if (pixel != s_OFF_SCREEN)
+					m_splats[m_cells[(pixel / width / s_STRIP_ROWS) * s_DENSITY_BLOCKS + b]++] = { pixel, colour_state[indices ? indices[k] : k].colour };
+			}
+		}
 
-			auto col = c.colour;
-			auto count = radius > 5 ? s_VERTICES : s_VERTICES_SMALL;
+		// each strip is summed by one thread
+		#pragma omp parallel for schedule(dynamic)
+		for (auto s = 0; s < num_strips; s++)
+		{
+			auto const first = static_cast<size_t>(s) * s_STRIP_ROWS * width;
+			auto const last = std::min(num_pixels, first + s_STRIP_ROWS * width);
+			if (m_strip_max[s] > 0)
+				std::fill(m_accum.begin() + 4 * first, m_accum.begin() + 4 * last, 0);
 
-			// Calculate positions of vertices around the edge of the body
-			for (size_t i = 0; i < count; i++)
+			uint32_t strip_max = 0;
+			for (auto k = m_strip_start[s]; k < m_strip_start[s + 1]; k++)
 			{
-				m_scratch[i] = m_unit_circle[radius > 5 ? i : i * 2] * radius;
-				m_scratch[i] += pos;
+				auto const& splat = m_splats[k];
+				auto const acc = &m_accum[4 * static_cast<size_t>(splat.pixel)];
+				acc[0] += splat.colour.r;
+				acc[1] += splat.colour.g;
+				acc[2] += splat.colour.b;
+				strip_max = std::max(strip_max, ++acc[3]);
 			}
+			m_strip_max[s] = strip_max;
+		}
 
-			// put into vertex array
-			for (size_t i = 0; i < count - 1; i++)
+		// tone map logarithmically, so that both sparse outskirts and dense cores are visible
+		auto const max_count = *std::max_element(m_strip_max.begin(), m_strip_max.end());
+		auto const scale = 255.f / std::log(1.f + std::max(max_count, 1u));
+		#pragma omp parallel for schedule(static)
+		for (auto s = 0; s < num_strips; s++)
+		{
+			auto const first = static_cast<size_t>(s) * s_STRIP_ROWS * width;
+			auto const last = std::min(num_pixels, first + s_STRIP_ROWS * width);
+			if (m_strip_max[s] == 0)
 			{
-				m_vtx_array.append({ pos, col });
-				m_vtx_array.append({ m_scratch[i], col });
-				m_vtx_array.append({ m_scratch[i + 1], col });
+				std::fill(m_pixels.begin() + 4 * first, m_pixels.begin() + 4 * last, sf::Uint8(0));
+				continue;
+			}
+			for (auto p = first; p < last; p++)
+			{
+				auto const acc = &m_accum[4 * p];
+				auto const out = &m_pixels[4 * p];
+				if (acc[3] == 0)
+				{
+					out[0] = out[1] = out[2] = out[3] = 0;
+					continue;
+				}
+				// the mean colour of the pixel's bodies, with the opacity given by their number
+				for (auto c = 0; c < 3; c++)
+					out[c] = m_density_colour ? static_cast<sf::Uint8>(acc[c] / acc[3]) : 255;
+				out[3] = static_cast<sf::Uint8>(std::min(255.f, scale * std::log(1.f + acc[3])));
 			}
-			// last point reconnects to first
-			m_vtx_array.append({ pos, col });
-			m_vtx_array.append({ m_scratch[count - 1], col });
-			m_vtx_array.append({ m_scratch[0], col });
 		}
+		m_density.update(m_pixels.data());
 	}
 
 	void BodyManager::draw(sf::RenderTarget & target, sf::RenderStates states) const
 	{
-		target.draw(m_vtx_array);
+		if (m_drawing_density)
+		{
+			target.draw(sf::Sprite(m_density), states);
+			return;
+		}
+		states.texture = &m_disc;
+		target.draw(m_vtx_array, states);
 	}
 
 	void BodyManager::setDirty()
@@ -90,6 +259,36 @@ namespace nbody
 		m_first_update = true;
 	}
 
+	void BodyManager::setRenderMode(BodyRenderMode const mode)
+	{
+		m_mode = mode;
+	}
+
+	BodyRenderMode BodyManager::getRenderMode() const
+	{
+		return m_mode;
+	}
+
+	void BodyManager::setDensityColour(bool const use_colour)
+	{
+		m_density_colour = use_colour;
+	}
+
+	bool BodyManager::getDensityColour() const
+	{
+		return m_density_colour;
+	}
+
+	bool BodyManager::isDrawingDensity() const
+	{
+		return m_drawing_density;
+	}
+
+	size_t BodyManager::getNumExamined() const
+	{
+		return m_num_examined;
+	}
+
 	float BodyManager::radiusFromMass(double mass) const
 	{
 		if (mass < Constants::SOLAR_MASS * 1e5)
@@ -5,6 +5,7 @@
 
 #include <SFML/Graphics.hpp>
 
+#include <cstdint>
 #include <vector>
 
 namespace nbody
@@ -17,35 +18,110 @@ namespace nbody
 	struct ParticleState;
 	struct ParticleAuxState;
 	struct ParticleColourState;
+	class BHTreeNode;
 
+	enum class BodyRenderMode
+	{
+		AUTO, // circles, or the density once zoomed out past BodyManager::s_DENSITY_SCALE
+		CIRCLES,
+		DENSITY
+	};
+
+	/**
+	 * \brief Draws the bodies, either as a circle each or, when zoomed out, as their density on screen.
+	 *		  The density is accumulated per pixel, tone mapped and drawn as one texture, so its cost
+	 *		  barely grows with the number of bodies.
+	 *		  If the model has a tree, subtrees away from the screen are skipped, so that when zoomed in
+	 *		  the cost grows with the number of bodies on screen rather than in the simulation.
+	 */
 	class BodyManager : public sf::Drawable
 	{
 	public:
 		BodyManager();
 		~BodyManager();
 
-		void update(Vector2d const* state, ParticleAuxState const* aux_state, ParticleColourState const* colour_state, size_t const num_bodies);
+		/**
+		 * \brief Find the bodies on screen and build what is drawn for them.
+		 *		  The radii of the bodies are cached, and found again when the number of bodies changes.
+		 * \param removed Whether each body is a tombstone, which is not drawn.
+		 * \param tree The root of a tree built from the bodies' recent positions, used to skip the bodies
+		 *			   away from the screen, or null to look at every body. Bodies which have moved more than
+		 *			   s_CULL_MARGIN pixels since the tree was last built or refitted may be missed.
+		 */
+		void update(Vector2d const* state, ParticleAuxState const* aux_state, ParticleColourState const* colour_state,
+					bool const* removed, size_t const num_bodies, BHTreeNode const* tree = nullptr);
 		void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
 
 		void setDirty();
 
+		void setRenderMode(BodyRenderMode const mode);
+		BodyRenderMode getRenderMode() const;
+		// whether the density is tinted by the colours of the bodies, rather than white
+		void setDensityColour(bool const use_colour);
+		bool getDensityColour() const;
+		// whether the last update drew the density rather than circles
+		bool isDrawingDensity() const;
+		// the number of bodies looked at by the last update
+		size_t getNumExamined() const;
+
 	private:
-		void drawBody(ParticleState const& p, ParticleColourState const& c, size_t const idx);
+		// the bodies looked at are indices[0] to indices[num - 1], or the first num bodies if indices is null
+		void updateCircles(ParticleState const* bodies, ParticleColourState const* colour_state, uint32_t const* indices, size_t const num);
+		void updateDensity(ParticleState const* bodies, ParticleColourState const* colour_state, uint32_t const* indices, size_t const num);
 		float radiusFromMass(double mass) const;
 
 		float static constexpr s_MIN_SIZE = 1;
 		float static constexpr s_MAX_SIZE = 5;
 		float static constexpr s_BH_SIZE = 8;
-		size_t static constexpr s_VERTICES = 20;
-		size_t static constexpr s_VERTICES_SMALL = 10;
-		float static constexpr s_THETA = static_cast<float>(2 * Constants::PI) / s_VERTICES;
+		// side length in pixels of the disc texture drawn for each body
+		unsigned static constexpr s_TEXTURE_SIZE = 64;
+		float static constexpr s_DENSITY_SCALE = 4;
+		// the bodies are binned in this many blocks, so that the sums do not depend on the number of threads
+		int static constexpr s_DENSITY_BLOCKS = 64;
+		// rows of pixels summed together by one thread
+		unsigned static constexpr s_STRIP_ROWS = 8;
+		uint32_t static constexpr s_OFF_SCREEN = UINT32_MAX;
+		// distance in pixels beyond the largest body within which subtrees off screen are still looked at
+		float static constexpr s_CULL_MARGIN = 32;
+		// the tree is only used if it finds at most this fraction of the bodies, as walking it is serial
+		// and slower per body than looking at every body in parallel
+		size_t static constexpr s_CULL_RATIO = 16;
 
-		sf::Vector2f m_unit_circle[s_VERTICES];
-		sf::Vector2f m_scratch[s_VERTICES];
+		// a white disc, tinted by each body's colour
+		sf::Texture m_disc;
+		// one quad per visible body, whose storage is kept from frame to frame
 		sf::VertexArray m_vtx_array;
+		// m_slots[k + 1] - m_slots[k] is 1 if the k-th body looked at is visible, and m_slots[k] is then the index of its quad
+		std::vector<uint32_t> m_slots;
+		// the bodies in the subtrees near the screen
+		std::vector<uint32_t> m_candidates;
+
+		BodyRenderMode m_mode;
+		bool m_density_colour;
+		bool m_drawing_density;
+		size_t m_num_examined;
+		// the pixel of each body looked at, or s_OFF_SCREEN
+		std::vector<uint32_t> m_pixel;
+		// the number of bodies of each block in each strip, then where they start in m_splats
+		std::vector<uint32_t> m_cells;
+		// the pixel and colour of each on-screen body in order of strip, and where each strip starts
+		struct Splat
+		{
+			uint32_t pixel;
+			sf::Color colour;
+		};
+		std::vector<Splat> m_splats;
+		std::vector<uint32_t> m_strip_start;
+		// the summed colour and number of bodies of each pixel
+		std::vector<uint32_t> m_accum;
+		// the most bodies in one pixel of each strip, which is 0 if its sums are already clear
+		std::vector<uint32_t> m_strip_max;
+		std::vector<sf::Uint8> m_pixels;
+		sf::Texture m_density;
 
 		float m_scl;
 
+		// the radius of each body in pixels before scaling, or 0 if it is not drawn
 		std::vector<float> m_radii;
 		bool m_first_update;
 	};
@@ -0,0 +1,63 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace nbody
+{
+	/**
+	 * \brief Conversion of numbers to and from little-endian bytes, the byte order of every binary file
+	 *		  written by the simulator, whatever the byte order of the machine.
+	 */
+	namespace byteorder
+	{
+		inline bool isLittleEndian()
+		{
+			uint16_t const one = 1;
+			unsigned char first;
+			std::memcpy(&first, &one, 1);
+			return first == 1;
+		}
+
+		/**
+		 * \brief Read a number from little-endian bytes, which need not be aligned.
+		 */
+		template<typename T>
+		T readLE(void const* src)
+		{
+			static_assert(std::is_arithmetic<T>::value, "Only numbers have a defined byte order");
+			unsigned char bytes[sizeof(T)];
+			std::memcpy(bytes, src, sizeof(T));
+			if (!isLittleEndian())
+			{
+				for (size_t i = 0; i < sizeof(T) / 2; i++)
+					std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+			}
+			T value;
+			std::memcpy(&value, bytes, sizeof(T));
+			return value;
+		}
+
+		/**
+		 * \brief Write a number as little-endian bytes, which need not be aligned.
+		 */
+		template<typename T>
+		void writeLE(T const value, void * dest)
+		{
+			static_assert(std::is_arithmetic<T>::value, "Only numbers have a defined byte order");
+			unsigned char bytes[sizeof(T)];
+			std::memcpy(bytes, &value, sizeof(T));
+			if (!isLittleEndian())
+			{
+				for (size_t i = 0; i < sizeof(T) / 2; i++)
+					std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+			}
+			std::memcpy(dest, bytes, sizeof(T));
+		}
+	}
+}
+
+#endif // BYTE_ORDER_H
@@ -43,16 +43,22 @@ namespace nbody
 
 		CircularBuffer& operator=(CircularBuffer const& src)
 		{
+			if (this == &src)
+				return *this;
+
+			// copy before releasing the old buffer, which was previously leaked
+			auto buf = new value_type[src.buf_size_];
+			for (size_t i = 0; i < src.buf_size_; i++)
+			{
+				buf[i] = src.buf_[i];
+			}
+			delete[] buf_;
+
+			buf_ = buf;
 			head_ = src.head_;
 			tail_ = src.tail_;
 			contents_size_ = src.contents_size_;
 			buf_size_ = src.buf_size_;
-			buf_ = new value_type[buf_size_];
-
-			for (size_t i = 0; i < buf_size_; i++)
-			{
-				buf_[i] = src.buf_[i];
-			}
 
 			return *this;
 		}
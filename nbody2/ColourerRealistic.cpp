@@ -3,16 +3,44 @@
 #include "specrend.h"
 
 #include <cassert>
+#include <cmath>
 
 namespace nbody
 {
-	ColourerRealistic::ColourerRealistic() : IColourer(), m_colours(nullptr)
+	namespace
+	{
+		std::array<sf::Color, ColourerRealistic::N_COLS> makePalette()
+		{
+			using namespace specrend;
+
+			std::array<sf::Color, ColourerRealistic::N_COLS> palette;
+			DecimalColour col;
+			double x, y, z;
+			auto cs = &SMPTEsystem;
+			for (size_t i = 0; i < ColourerRealistic::N_TEMPS; i++)
+			{
+				auto const temp = ColourerRealistic::MIN_TEMP + ColourerRealistic::TEMP_STEP * i;
+				spectrum_to_xyz(bb_spectrum, temp, &x, &y, &z);
+				xyz_to_rgb(cs, x, y, z, &col.r, &col.g, &col.b);
+				constrain_rgb(&col.r, &col.g, &col.b);
+				norm_rgb(&col.r, &col.g, &col.b);
+
+				palette[i] = { static_cast<sf::Uint8>(col.r * 255),
+							   static_cast<sf::Uint8>(col.g * 255),
+							   static_cast<sf::Uint8>(col.b * 255),
+							   255 };
+			}
+			palette[ColourerRealistic::BLACK_HOLE_IDX] = { 70, 70, 70 };
+			return palette;
+		}
+	}
+
+	ColourerRealistic::ColourerRealistic() : IColourer()
 	{
 	}
 
 	ColourerRealistic::~ColourerRealistic()
 	{
-		delete[] m_colours;
 	}
 
 	std::unique_ptr<IColourer> ColourerRealistic::create()
@@ -24,53 +52,47 @@ namespace nbody
 	{
 		IColourer::setup(offset, num_bodies, cols);
 
-		m_colours = new sf::Color[num_bodies];
-		sf::Color colours[N_COLS];
-
-		using namespace specrend;
-
-		DecimalColour col;
-		double x, y, z;
-		auto cs = &SMPTEsystem;
-		for (auto i = 0; i < N_COLS; i++)
+		m_col_idx.resize(num_bodies);
+#pragma omp parallel for schedule(static)
+		for (auto i = 0; i < static_cast<int>(num_bodies); i++)
 		{
-			bbTemp = MIN_TEMP + TEMP_STEP * i;
-			spectrum_to_xyz(bb_spectrum, &x, &y, &z);
-			xyz_to_rgb(cs, x, y, z, &col.r, &col.g, &col.b);
-			constrain_rgb(&col.r, &col.g, &col.b);
-			norm_rgb(&col.r, &col.g, &col.b);
+			auto const mass = state->m_aux_state[i].mass / Constants::SOLAR_MASS;
 
-			colours[i] = { static_cast<sf::Uint8>(col.r * 255),
-						   static_cast<sf::Uint8>(col.g * 255),
-						   static_cast<sf::Uint8>(col.b * 255),
-						   255 };
-		}
+			// special case for black hole
+			if (mass > 1e5)
+			{
+				m_col_idx[i] = BLACK_HOLE_IDX;
+				continue;
+			}
 
-		for (auto i = 0; i < num_bodies; i++)
-		{
-			auto temp = T_SUN * pow(state->m_aux_state[i].mass / Constants::SOLAR_MASS, 0.875);
+			auto temp = T_SUN * pow(mass, 0.875);
 			if (temp < MIN_TEMP)
 				temp = MIN_TEMP;
 			if (temp > MAX_TEMP)
 				temp = MAX_TEMP;
 
-			auto col_idx = static_cast<size_t>(floor((temp - MIN_TEMP) / TEMP_STEP));
-
-			m_colours[i] = colours[col_idx];
-
-			// special case for black hole
-			if (state->m_aux_state[i].mass / Constants::SOLAR_MASS > 1e5)
-				m_colours[i] = { 70, 70, 70 };
+			m_col_idx[i] = static_cast<uint8_t>(floor((temp - MIN_TEMP) / TEMP_STEP));
 		}
 	}
 
-	void ColourerRealistic::applyImpl(ParticleData const * state, ParticleColourState * colour)
+	void ColourerRealistic::applyBatch(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours,
+									   size_t const* slots, size_t const first, size_t const num)
 	{
-		static size_t idx = 0;
+		auto const& palette = getPalette();
+		for (size_t k = 0; k < num; k++)
+			if (slots[k] != NO_SLOT)
+				colours[slots[k]].colour = palette[m_col_idx[first + k]];
+	}
 
-		colour->colour = m_colours[idx];
+	bool ColourerRealistic::isStatic() const
+	{
+		return true;
+	}
 
-		if (++idx == m_num_bodies)
-			idx = 0;
+	std::array<sf::Color, ColourerRealistic::N_COLS> const& ColourerRealistic::getPalette()
+	{
+		// built by whichever thread gets here first, while any others wait
+		static auto const palette = makePalette();
+		return palette;
 	}
 }
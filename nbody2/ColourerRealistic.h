@@ -3,6 +3,10 @@
 
 #include "IColourer.h"
 
+#include <array>
+#include <cstdint>
+#include <vector>
+
 namespace nbody
 {
 	struct DecimalColour
@@ -10,6 +14,11 @@ namespace nbody
 		double r, g, b;
 	};
 
+	/**
+	 * \brief Colours each body as a blackbody at the temperature of a main sequence star of its mass.
+	 *		  The colours are looked up in a palette built once per process, and each body keeps only
+	 *		  its one byte index into the palette.
+	 */
 	class ColourerRealistic : public IColourer
 	{
 	public:
@@ -20,16 +29,28 @@ namespace nbody
 
 		void setup(size_t const offset, size_t const num_bodies, sf::Color const* cols, const ParticleData* state) override;
 
-		void applyImpl(ParticleData const* state, ParticleColourState * colour) override;
+		void applyBatch(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours,
+						size_t const* slots, size_t const first, size_t const num) override;
+		bool isStatic() const override;
 
-		static constexpr size_t N_COLS = 400;
+		static constexpr size_t N_COLS = 256;
+		static constexpr size_t N_TEMPS = N_COLS - 1;
+		static constexpr uint8_t BLACK_HOLE_IDX = N_COLS - 1;
 		static constexpr double MIN_TEMP = 1000;
 		static constexpr double MAX_TEMP = 50000;
-		static constexpr double TEMP_STEP = (MAX_TEMP - MIN_TEMP) / (N_COLS - 1);
+		static constexpr double TEMP_STEP = (MAX_TEMP - MIN_TEMP) / (N_TEMPS - 1);
 
 		static constexpr double T_SUN = 5778;
 
-		sf::Color * m_colours;
+		/**
+		 * \brief The palette: the colours of N_TEMPS temperatures from MIN_TEMP to MAX_TEMP, then the colour
+		 *		  of black holes. It is built on first use, which is safe from any thread.
+		 */
+		static std::array<sf::Color, N_COLS> const& getPalette();
+
+	private:
+		// index into the palette of each body, in the order the bodies were added
+		std::vector<uint8_t> m_col_idx;
 	};
 }
 
@@ -15,8 +15,16 @@ namespace nbody
 		return std::make_unique<ColourerSolid>();
 	}
 
-	void ColourerSolid::applyImpl(ParticleData const * state, ParticleColourState * colour)
+	void ColourerSolid::applyBatch(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours,
+								   size_t const* slots, size_t const first, size_t const num)
 	{
-		colour->colour = m_cols[0];
+		for (size_t k = 0; k < num; k++)
+			if (slots[k] != NO_SLOT)
+				colours[slots[k]].colour = m_cols[0];
+	}
+
+	bool ColourerSolid::isStatic() const
+	{
+		return true;
 	}
 }
\ No newline at end of file
@@ -13,7 +13,9 @@ namespace nbody
 
 		static std::unique_ptr<IColourer> create();
 
-		void applyImpl(ParticleData const* state, ParticleColourState * colour) override;
+		void applyBatch(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours,
+						size_t const* slots, size_t const first, size_t const num) override;
+		bool isStatic() const override;
 	};
 }
 
@@ -2,7 +2,10 @@
 #include "Types.h"
 #include "Vector.h"
 
+#include <emmintrin.h>
+
 #include <algorithm>
+#include <cstdint>
 
 namespace nbody
 {
@@ -25,25 +28,53 @@ namespace nbody
 
 		auto fastest = std::max_element(
 			&state->m_state[0],
-			&state->m_state[num_bodies - 1],
+			&state->m_state[num_bodies],
 			[](ParticleState const& a, ParticleState const& b) { return a.vel.mag() < b.vel.mag(); });
 
 		m_max_vel = fastest->vel.mag();
 	}
 
-	void ColourerVelocity::applyImpl(ParticleData const * state, ParticleColourState * colour)
+	void ColourerVelocity::applyBatch(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours,
+									  size_t const* slots, size_t const first, size_t const num)
 	{
-		// WIP
-		auto v_mag = state->m_state->vel.mag();
+		// squared speeds as fractions of the squared maximum, padded to a whole number of SSE registers
+		alignas(16) float speed_sq[s_BATCH_SIZE];
+		alignas(16) uint32_t packed[s_BATCH_SIZE];
+		auto const inv_max_sq = m_max_vel > 0 ? 1 / (m_max_vel * m_max_vel) : 0.0;
+		auto const num_padded = (num + 3) & ~size_t(3);
+		for (size_t k = 0; k < num; k++)
+			speed_sq[k] = slots[k] != NO_SLOT ? static_cast<float>(state[slots[k]].vel.mag_sq() * inv_max_sq) : 0.f;
+		for (auto k = num; k < num_padded; k++)
+			speed_sq[k] = 0;
+
+		auto const one = _mm_set1_ps(1.f);
+		auto const alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+		auto const from_r = _mm_set1_ps(m_cols[0].r), to_r = _mm_set1_ps(m_cols[1].r);
+		auto const from_g = _mm_set1_ps(m_cols[0].g), to_g = _mm_set1_ps(m_cols[1].g);
+		auto const from_b = _mm_set1_ps(m_cols[0].b), to_b = _mm_set1_ps(m_cols[1].b);
 
-		auto phase = std::min(1.0, v_mag / m_max_vel);
-		auto w1 = 1 - phase;
-		auto w2 = phase;
+		for (size_t k = 0; k < num_padded; k += 4)
+		{
+			auto const w2 = _mm_min_ps(one, _mm_sqrt_ps(_mm_load_ps(&speed_sq[k])));
+			auto const w1 = _mm_sub_ps(one, w2);
+			auto const blend = [&](__m128 const from, __m128 const to) {
+				return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(w1, from), _mm_mul_ps(w2, to)));
+			};
 
-		auto red = static_cast<sf::Uint8>(w1 * m_cols[0].r + w2 * m_cols[1].r);
-		auto green = static_cast<sf::Uint8>(w1 * m_cols[0].g + w2 * m_cols[1].g);
-		auto blue = static_cast<sf::Uint8>(w1 * m_cols[0].b + w2 * m_cols[1].b);
+			// shift each channel into its byte of a packed rgba value
+			auto rgba = _mm_or_si128(alpha, blend(from_r, to_r));
+			rgba = _mm_or_si128(rgba, _mm_slli_epi32(blend(from_g, to_g), 8));
+			rgba = _mm_or_si128(rgba, _mm_slli_epi32(blend(from_b, to_b), 16));
+			_mm_store_si128(reinterpret_cast<__m128i *>(&packed[k]), rgba);
+		}
 
-		colour->colour = sf::Color{ red, green, blue };
+		for (size_t k = 0; k < num; k++)
+		{
+			if (slots[k] == NO_SLOT)
+				continue;
+			auto const p = packed[k];
+			colours[slots[k]].colour = sf::Color{ static_cast<sf::Uint8>(p), static_cast<sf::Uint8>(p >> 8),
+				static_cast<sf::Uint8>(p >> 16), static_cast<sf::Uint8>(p >> 24) };
+		}
 	}
 }
@@ -15,7 +15,12 @@ namespace nbody
 
 		void setup(size_t const offset, size_t const num_bodies, sf::Color const* cols, const ParticleData* state) override;
 
-		void applyImpl(ParticleData const* state, ParticleColourState * colour) override;
+		/**
+		 * \brief Blend between the two colours by speed, up to the fastest speed at setup.
+		 *		  Speeds are gathered from the bodies' slots, then four bodies are coloured per SSE instruction.
+		 */
+		void applyBatch(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours,
+						size_t const* slots, size_t const first, size_t const num) override;
 
 	private:
 		double m_max_vel;
@@ -2,38 +2,50 @@
 #include "Error.h"
 #include <cassert>
 #include <cmath> // for size_t under GCC
+#include <map>
+#include <mutex>
+#include <tuple>
 
 namespace nbody
 {
-	ComplexCDF::ComplexCDF() :
-		m_min(0),
-		m_max(0),
-		m_width(0),
-		//m_n_steps(0),
-		m_i0(0),
-		m_k(0),
-		m_a(0),
-		m_r_bulge(0)
+	size_t constexpr ComplexCDF::s_MAX_CACHED;
+
+	ComplexCDF::ComplexCDF(double const i0, double const k, double const a, double const rad_bulge,
+		double const min, double const max, size_t const n_steps) :
+		m_min(min),
+		m_max(max),
+		m_i0(i0),
+		m_k(k),
+		m_a(a),
+		m_r_bulge(rad_bulge),
+		m_i_disc(intensityBulge(rad_bulge, i0, k))
 	{
+		build(n_steps);
 	}
 
 	ComplexCDF::~ComplexCDF()
 	{
 	}
-	void ComplexCDF::setup(double const i0, double const k, double const a, double const rad_bulge,
-		double const min, double const max, size_t const n_steps)
-	{
-		m_min = min;
-		m_max = max;
-		//m_n_steps = n_steps;
 
-		m_i0 = i0;
-		m_k = k;
-		m_a = a;
-		m_r_bulge = rad_bulge;
-
-		//build(m_n_steps);
-		build(n_steps);
+	std::shared_ptr<ComplexCDF const> ComplexCDF::create(double const i0, double const k, double const a,
+		double const rad_bulge, double const min, double const max, size_t const n_steps)
+	{
+		using Key = std::tuple<double, double, double, double, double, double, size_t>;
+		static std::map<Key, std::shared_ptr<ComplexCDF const>> cache;
+		static std::mutex mutex;
+
+		auto key = Key{ i0, k, a, rad_bulge, min, max, n_steps };
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = cache.find(key);
+		if (it != cache.end())
+			return it->second;
+
+		// tables are only reused while the same galaxy is regenerated, so there is no need to keep many
+		if (cache.size() >= s_MAX_CACHED)
+			cache.clear();
+		auto cdf = std::make_shared<ComplexCDF const>(i0, k, a, rad_bulge, min, max, n_steps);
+		cache.emplace(key, cdf);
+		return cdf;
 	}
 
 	double ComplexCDF::valFromProbability(double p) const
@@ -49,60 +61,85 @@ namespace nbody
 		return m_y2[i] + m_m2[i] * remainder;
 	}
 
+	void ComplexCDF::sample(size_t const n, double const* p, double * out) const
+	{
+		auto const h = 1.0 / (m_y2.size() - 1);
+		auto const y = m_y2.data();
+		auto const m = m_m2.data();
+		for (size_t j = 0; j < n; j++)
+		{
+			assert(p[j] >= 0 && p[j] <= 1);
+			auto i = static_cast<size_t>(p[j] / h);
+			out[j] = y[i] + m[i] * (p[j] - i * h);
+		}
+	}
+
 	void ComplexCDF::build(size_t const n_steps)
 	{
 		auto h = (m_max - m_min) / n_steps;
-		auto x = 0.0, y = 0.0;
 
-		m_y1.push_back(0.0);
-		m_x1.push_back(0.0);
+		// the intensity at every sample point, each of which is shared by up to two Simpson intervals
+		std::vector<double> f(n_steps + 1);
+		for (size_t i = 0; i <= n_steps; i++)
+			f[i] = intensity(m_min + i * h);
+
+		auto const n1 = n_steps / 2 + (n_steps % 2) + 1;
+		std::vector<double> x1, y1, m1;
+		x1.reserve(n1);
+		y1.reserve(n1);
+		m1.reserve(n1);
+
+		auto x = 0.0, y = 0.0;
+		y1.push_back(0.0);
+		x1.push_back(0.0);
 
 		// Simpson's rule to integrate distribution function
-		for (auto i = 0; i < n_steps; i += 2)
+		for (size_t i = 0; i < n_steps; i += 2)
 		{
 			x = (i + 2) * h;
-			y += h / 3 * (intensity(m_min + i * h)
-				+ 4 * intensity(m_min + (i + 1) * h)
-				+ intensity(m_min + (i + 2) * h));
+			// beyond the last sample when n_steps is odd
+			auto f2 = i + 2 <= n_steps ? f[i + 2] : intensity(m_min + (i + 2) * h);
+			y += h / 3 * (f[i] + 4 * f[i + 1] + f2);
 
-			m_m1.push_back((y - m_y1.back()) / (2 * h));
-			m_y1.push_back(y);
-			m_x1.push_back(x);
+			m1.push_back((y - y1.back()) / (2 * h));
+			y1.push_back(y);
+			x1.push_back(x);
 		}
-		m_m1.push_back(0.0);
+		m1.push_back(0.0);
 
-		if (m_m1.size() != m_x1.size() || m_m1.size() != m_y1.size())
+		if (m1.size() != x1.size() || m1.size() != y1.size())
 			throw MAKE_ERROR("ComplexCDF array size msimatch (1)");
 
 		// normalise
-		for (auto i = 0; i < m_y1.size(); i++)
+		auto const total = y1.back();
+		for (size_t i = 0; i < y1.size(); i++)
 		{
-			m_m1[i] /= m_y1.back();
-			m_y1[i] /= m_y1.back();
+			m1[i] /= total;
+			y1[i] /= total;
 		}
 
+		m_y2.reserve(n_steps);
+		m_m2.reserve(n_steps);
 		m_y2.push_back(0.0);
-		m_x2.push_back(0.0);
 
-		auto p = 0.0;
+		// the probabilities increase, so the search for each continues from the last
+		size_t k = 0;
 		h = 1.0 / n_steps;
-		for (auto i = 1; i < n_steps; i++)
+		for (size_t i = 1; i < n_steps; i++)
 		{
-			auto k = 0;
-			p = i * h;
+			auto p = i * h;
 
-			while (m_y1[k + 1] <= p)
+			while (y1[k + 1] <= p)
 				k++;
 
-			y = m_x1[k] + (p - m_y1[k]) / m_m1[k];
+			y = x1[k] + (p - y1[k]) / m1[k];
 
 			m_m2.push_back((y - m_y2.back()) / h);
 			m_y2.push_back(y);
-			m_x2.push_back(p);
 		}
 		m_m2.push_back(0.0);
 
-		if (m_m2.size() != m_x2.size() || m_m2.size() != m_y2.size())
+		if (m_m2.size() != m_y2.size())
 			throw MAKE_ERROR("ComplexCDF array size msimatch (2)");
 	}
 
@@ -110,7 +147,7 @@ namespace nbody
 	{
 		return (x < m_r_bulge) ?
 			intensityBulge(x, m_i0, m_k) :
-			intensityDisc(x - m_r_bulge, intensityBulge(m_r_bulge, m_i0, m_k), m_a);
+			intensityDisc(x - m_r_bulge, m_i_disc, m_a);
 	}
 
 	double ComplexCDF::intensityBulge(double const r, double const i0, double const k) const
@@ -2,34 +2,45 @@
 #define COMPLEX_CDF_H
 
 #include <cstddef> // for size_t under GCC
+#include <memory>
 #include <vector>
 
 namespace nbody
 {
+	/**
+	 * \brief The inverse of the cumulative distribution of a galaxy's surface brightness, with an
+	 *		  r^1/4 bulge inside rad_bulge and an exponential disc outside it, tabulated over [min, max].
+	 */
 	class ComplexCDF
 	{
 	public:
-		ComplexCDF();
+		ComplexCDF(double const i0, double const k, double const a, double const rad_bulge,
+			double const min, double const max, size_t const n_steps);
 		~ComplexCDF();
 
-		void setup(double const i0, double const k, double const a, double const rad_bulge,
-			double const min, double const max, size_t const n_steps);
+		/**
+		 * \brief Get the table for the given parameters, building it only if it was not recently used.
+		 *		  Safe to call from any thread.
+		 */
+		static std::shared_ptr<ComplexCDF const> create(double const i0, double const k, double const a,
+			double const rad_bulge, double const min, double const max, size_t const n_steps);
 
 		double valFromProbability(double p) const;
 
+		/**
+		 * \brief Convert n probabilities in [0, 1] to values at once. out may be the same array as p.
+		 */
+		void sample(size_t const n, double const* p, double * out) const;
+
 	private:
-		double m_min, m_max, m_width;
-		//size_t m_n_steps;
-		
-		double m_i0, m_k, m_a, m_r_bulge;
+		double m_min, m_max;
 
-		std::vector<double> m_m1;
-		std::vector<double> m_y1;
-		std::vector<double> m_x1;
+		double m_i0, m_k, m_a, m_r_bulge;
+		// intensity at the inner edge of the disc
+		double m_i_disc;
 
 		std::vector<double> m_m2;
 		std::vector<double> m_y2;
-		std::vector<double> m_x2;
 
 		void build(size_t const n_steps);
 
@@ -37,7 +48,8 @@ namespace nbody
 		double intensityBulge(double const r, double const i0, double const k) const;
 		double intensityDisc(double const r, double const i0, double  const a) const;
 
+		static size_t constexpr s_MAX_CACHED = 8;
 	};
 }
 
-#endif // COMPLEX_CDF_H
+#endif // COMPLEX_CDF_H
\ No newline at end of file
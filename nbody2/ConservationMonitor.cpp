@@ -0,0 +1,120 @@
+#include "ConservationMonitor.h"
+
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+
+namespace nbody
+{
+	constexpr size_t ConservationMonitor::s_MAX_SAMPLES;
+
+	ConservationMonitor::ConservationMonitor()
+	{
+		reset();
+	}
+
+	void ConservationMonitor::reset()
+	{
+		m_reference = {};
+		m_reference.time = -1;
+		m_rebase = false;
+		m_offset = {};
+		m_latest = m_reference;
+		m_latest_drift = {};
+		m_history.clear();
+		m_history.reserve(s_MAX_SAMPLES);
+		m_stride = 1;
+		m_num_recorded = 0;
+	}
+
+	void ConservationMonitor::rebase()
+	{
+		if (!hasReference())
+			return;
+		m_rebase = true;
+		m_offset = m_latest_drift;
+	}
+
+	bool ConservationMonitor::record(ConservedQuantities const & q)
+	{
+		if (q.time < 0 || (hasReference() && q.time <= m_latest.time))
+			return false;
+
+		if (!hasReference() || m_rebase)
+		{
+			m_reference = q;
+			m_rebase = false;
+		}
+		m_latest = q;
+		m_latest_drift = calcDrift(q);
+
+		if (m_num_recorded++ % m_stride == 0)
+		{
+			if (m_history.size() == s_MAX_SAMPLES)
+			{
+				// halve the resolution, keeping the reference sample
+				for (size_t i = 0; 2 * i < m_history.size(); i++)
+					m_history[i] = m_history[2 * i];
+				m_history.resize(s_MAX_SAMPLES / 2);
+				m_stride *= 2;
+			}
+			m_history.push_back(m_latest_drift);
+		}
+		return true;
+	}
+
+	bool ConservationMonitor::hasReference() const
+	{
+		return m_reference.time >= 0;
+	}
+
+	ConservedQuantities const& ConservationMonitor::getReference() const
+	{
+		return m_reference;
+	}
+
+	ConservedQuantities const& ConservationMonitor::getLatest() const
+	{
+		return m_latest;
+	}
+
+	ConservationDrift const& ConservationMonitor::getLatestDrift() const
+	{
+		return m_latest_drift;
+	}
+
+	std::vector<ConservationDrift> const& ConservationMonitor::getHistory() const
+	{
+		return m_history;
+	}
+
+	void ConservationMonitor::writeHeader(std::ostream & out)
+	{
+		out << "time,energy,momentum,angular_momentum,centre_mass\n";
+	}
+
+	void ConservationMonitor::writeDrift(std::ostream & out, ConservationDrift const & d)
+	{
+		out << std::setprecision(9) << d.time << ',' << d.energy << ',' << d.momentum << ','
+			<< d.angular_momentum << ',' << d.centre_mass << '\n';
+	}
+
+	ConservationDrift ConservationMonitor::calcDrift(ConservedQuantities const & q) const
+	{
+		auto const& r = m_reference;
+		auto const e0 = r.kinetic + r.potential;
+
+		// the centre of mass moves uniformly with the initial total momentum
+		auto const com_vel = r.momentum / r.mass;
+		auto const expected_com = r.centre_mass + com_vel * (q.time - r.time);
+
+		ConservationDrift d;
+		d.time = q.time;
+		d.energy = m_offset.energy + (e0 != 0 ? (q.kinetic + q.potential - e0) / std::abs(e0) : 0);
+		d.momentum = m_offset.momentum + (r.momentum_scale > 0 ? (q.momentum - r.momentum).mag() / r.momentum_scale : 0);
+		d.angular_momentum = m_offset.angular_momentum
+			+ (r.angular_momentum_scale > 0 ? (q.angular_momentum - r.angular_momentum) / r.angular_momentum_scale : 0);
+		d.centre_mass = m_offset.centre_mass + (q.centre_mass - expected_com).mag();
+		return d;
+	}
+}
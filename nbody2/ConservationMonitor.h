@@ -0,0 +1,84 @@
+#ifndef CONSERVATION_MONITOR_H
+#define CONSERVATION_MONITOR_H
+
+#include "IModel.h"
+
+#include <iosfwd>
+#include <vector>
+
+namespace nbody
+{
+	/**
+	 * \brief How far the conserved quantities of one state have moved from those of the first state,
+	 *		  or from those of the reference and the drift carried over at the last rebase.
+	 */
+	struct ConservationDrift
+	{
+		double time;
+		// (E - E0) / |E0|
+		double energy;
+		// |P - P0|, relative to the sum of the magnitudes of the bodies' momenta at the start
+		double momentum;
+		// (L - L0), relative to the sum of the magnitudes of the bodies' angular momenta at the start
+		double angular_momentum;
+		// distance of the centre of mass from where its initial velocity would have carried it, in m
+		double centre_mass;
+	};
+
+	/**
+	 * \brief Keeps the drift of the conserved quantities over a run, to judge the integrator and opening
+	 *		  angle by. The first state recorded is the reference. The history keeps at most s_MAX_SAMPLES
+	 *		  samples spread over the whole run: when it is full every other sample is dropped and
+	 *		  samples are kept half as often from then on.
+	 */
+	class ConservationMonitor
+	{
+	public:
+		ConservationMonitor();
+
+		/**
+		 * \brief Forget the history, so that the next state recorded becomes the reference.
+		 */
+		void reset();
+
+		/**
+		 * \brief Keep the history, but take the next state recorded as the reference for later drifts,
+		 *		  which carry on from the latest drift. Used when the quantities are changed on purpose,
+		 *		  e.g. by a merger, so that only drift from then on is added.
+		 */
+		void rebase();
+
+		/**
+		 * \brief Add the quantities of a state, if it is later than the last one added.
+		 * \return Whether the state was added.
+		 */
+		bool record(ConservedQuantities const& q);
+
+		bool hasReference() const;
+		ConservedQuantities const& getReference() const;
+		ConservedQuantities const& getLatest() const;
+		ConservationDrift const& getLatestDrift() const;
+		std::vector<ConservationDrift> const& getHistory() const;
+
+		static void writeHeader(std::ostream& out);
+		static void writeDrift(std::ostream& out, ConservationDrift const& d);
+
+		static size_t constexpr s_MAX_SAMPLES = 1024;
+
+	private:
+		ConservationDrift calcDrift(ConservedQuantities const& q) const;
+
+		ConservedQuantities m_reference;
+		// whether the next state recorded becomes the reference, and the drift carried over from before it
+		bool m_rebase;
+		ConservationDrift m_offset;
+		ConservedQuantities m_latest;
+		ConservationDrift m_latest_drift;
+		std::vector<ConservationDrift> m_history;
+		// keep one sample in this many
+		size_t m_stride;
+		size_t m_num_recorded;
+	};
+}
+
+#endif // CONSERVATION_MONITOR_H
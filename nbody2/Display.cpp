@@ -45,6 +45,16 @@ namespace nbody
 			return static_cast<double>(screen_length * RADIUS * 2 * screen_scale / screen_size.y);
 		}
 
+		ScreenTransform worldToScreenTransform()
+		{
+			ScreenTransform t;
+			t.scale_x = screen_size.x / (RADIUS * screen_scale * aspect_ratio * 2);
+			t.scale_y = -screen_size.y / (RADIUS * screen_scale * 2);
+			t.offset_x = 0.5 * screen_size.x - screen_offset.x;
+			t.offset_y = 0.5 * screen_size.y - screen_offset.y;
+			return t;
+		}
+
 		float bodyScalingFunc(float rad)
 		{
 			auto blend = [](auto x, auto cross, auto smooth) { return 0.5 + 0.5 * tanh((x - cross) / smooth); };
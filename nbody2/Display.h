@@ -22,6 +22,19 @@ namespace nbody
 		double screenToWorldY(float screen_y);
 		double screenToWorldLength(float screen_length);
 
+		/**
+		 * \brief The world to screen mapping as screen = world * scale + offset, for mapping many points at once.
+		 */
+		struct ScreenTransform
+		{
+			double scale_x, scale_y;
+			double offset_x, offset_y;
+
+			float toScreenX(double world_x) const { return static_cast<float>(world_x * scale_x + offset_x); }
+			float toScreenY(double world_y) const { return static_cast<float>(world_y * scale_y + offset_y); }
+		};
+		ScreenTransform worldToScreenTransform();
+
 		float bodyScalingFunc(float rad);
 	}
 }
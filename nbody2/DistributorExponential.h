@@ -12,14 +12,6 @@ namespace nbody
 	class DistributorExponential : public IDistributor
 	{
 	public:
-		DistributorExponential()
-		{
-			getExpRand = []()
-			{
-				return m_exp_dist(m_gen);
-			};
-		}
-
 		virtual ~DistributorExponential();
 		
 		static std::unique_ptr<IDistributor> create();
@@ -27,9 +19,6 @@ namespace nbody
 		void createDistribution(ParticleData & bodies, BodyGroupProperties const& props) const override;
 
 	private:
-		static std::exponential_distribution<> m_exp_dist;
-		double(*getExpRand)();
-
 		double static constexpr s_LAMBDA = 4.0;
 	};
 }
@@ -0,0 +1,371 @@
+#include "BodyGroupProperties.h"
+#include "ByteOrder.h"
+#include "Constants.h"
+#include "DistributorFile.h"
+#include "Error.h"
+#include "MappedFile.h"
+#include "Types.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <vector>
+
+namespace nbody
+{
+	char constexpr DistributorFile::s_MAGIC[8];
+	uint32_t constexpr DistributorFile::s_VERSION;
+
+	namespace
+	{
+		size_t constexpr s_HEADER_SIZE = 32;
+		size_t constexpr s_NUM_VALUES = 5;
+		size_t constexpr s_RECORD_SIZE = s_NUM_VALUES * sizeof(double);
+		// CSV files are split into pieces of about this many bytes, which are parsed in parallel
+		size_t constexpr s_CHUNK_SIZE = 1 << 20;
+		// longer fields cannot be a number
+		size_t constexpr s_MAX_FIELD = 64;
+
+		/**
+		 * \brief A range of whole lines of a CSV file.
+		 */
+		struct Chunk
+		{
+			char const* begin;
+			char const* end;
+			// the index of the chunk's first body in the file
+			size_t first;
+			size_t count;
+			// the index in the file of the first body which could not be parsed
+			size_t bad_body;
+		};
+
+		char const* lineEnd(char const* begin, char const* end)
+		{
+			auto eol = static_cast<char const*>(std::memchr(begin, '\n', end - begin));
+			return eol ? eol : end;
+		}
+
+		char const* skipSpace(char const* p, char const* end)
+		{
+			while (p != end && (*p == ' ' || *p == '\t' || *p == '\r'))
+				p++;
+			return p;
+		}
+
+		bool isBodyLine(char const* begin, char const* end)
+		{
+			begin = skipSpace(begin, end);
+			return begin != end && *begin != '#';
+		}
+
+		/**
+		 * \brief Skip a header, which is the first non-blank, non-comment line if it does not start with a number.
+		 */
+		char const* skipHeader(char const* begin, char const* end)
+		{
+			for (auto line = begin; line != end;)
+			{
+				auto eol = lineEnd(line, end);
+				auto next = eol == end ? end : eol + 1;
+				if (isBodyLine(line, eol))
+				{
+					auto p = skipSpace(line, eol);
+					return *p != '\0' && std::strchr("0123456789+-.", *p) ? line : next;
+				}
+				line = next;
+			}
+			return end;
+		}
+
+		/**
+		 * \brief Split a range into chunks of whole lines.
+		 */
+		std::vector<Chunk> splitLines(char const* begin, char const* end)
+		{
+			std::vector<Chunk> chunks;
+			while (begin != end)
+			{
+				auto split = static_cast<size_t>(end - begin) > s_CHUNK_SIZE ? begin + s_CHUNK_SIZE : end;
+				if (split != end)
+				{
+					split = lineEnd(split, end);
+					if (split != end)
+						split++;
+				}
+				chunks.push_back({ begin, split, 0, 0, std::numeric_limits<size_t>::max() });
+				begin = split;
+			}
+			return chunks;
+		}
+
+		size_t countBodyLines(char const* begin, char const* end)
+		{
+			size_t count = 0;
+			for (auto line = begin; line != end;)
+			{
+				auto eol = lineEnd(line, end);
+				if (isBodyLine(line, eol))
+					count++;
+				line = eol == end ? end : eol + 1;
+			}
+			return count;
+		}
+
+		/**
+		 * \brief Parse the comma separated values of a line.
+		 * \return false unless the line holds exactly s_NUM_VALUES numbers.
+		 */
+		bool parseLine(char const* begin, char const* end, double (&values)[s_NUM_VALUES])
+		{
+			auto p = begin;
+			for (size_t v = 0; v < s_NUM_VALUES; v++)
+			{
+				p = skipSpace(p, end);
+				auto field_end = static_cast<char const*>(std::memchr(p, ',', end - p));
+				if (!field_end)
+					field_end = end;
+				auto len = static_cast<size_t>(field_end - p);
+				if (len == 0 || len >= s_MAX_FIELD)
+					return false;
+
+				// the mapped file is not null terminated, so each field is copied out for strtod
+				char field[s_MAX_FIELD];
+				std::memcpy(field, p, len);
+				field[len] = '\0';
+				char * parsed_end;
+				values[v] = std::strtod(field, &parsed_end);
+				if (parsed_end == field || skipSpace(parsed_end, field + len) != field + len)
+					return false;
+
+				p = field_end;
+				if (v + 1 < s_NUM_VALUES)
+				{
+					if (p == end)
+						return false;
+					p++; // ','
+				}
+			}
+			return skipSpace(p, end) == end;
+		}
+
+		void setBody(ParticleData & bodies, size_t const i, double const (&values)[s_NUM_VALUES],
+			Vector2d const& pos_offset, Vector2d const& vel_offset)
+		{
+			bodies.m_state[i].pos = Vector2d{ values[0], values[1] } + pos_offset;
+			bodies.m_state[i].vel = Vector2d{ values[2], values[3] } + vel_offset;
+			bodies.m_aux_state[i].mass = values[4];
+		}
+
+		Vector2d posOffset(BodyGroupProperties const& props)
+		{
+			return props.use_parsecs ? props.pos * Constants::PARSEC : props.pos;
+		}
+
+		void checkCount(size_t const count, BodyGroupProperties const& props)
+		{
+			if (count == static_cast<size_t>(props.num))
+				return;
+			auto source = props.embedded ? std::string("the embedded particles") : "file " + props.file_name;
+			throw MAKE_ERROR("Found " + std::to_string(count) + " bodies in " + source + ", but the group has "
+				+ std::to_string(props.num));
+		}
+	}
+
+	std::unique_ptr<IDistributor> DistributorFile::create()
+	{
+		return std::make_unique<DistributorFile>();
+	}
+
+	void DistributorFile::createDistribution(ParticleData & bodies, BodyGroupProperties const & props) const
+	{
+		if (props.embedded)
+		{
+			readBinary(props.embedded->data, props.embedded->size, &bodies, &props);
+			return;
+		}
+
+		MappedFile file(props.file_name);
+		if (isBinary(file.data(), file.size()))
+			readBinary(file.data(), file.size(), &bodies, &props);
+		else
+			readCSV(file.data(), file.size(), &bodies, &props);
+	}
+
+	size_t DistributorFile::countBodies(std::string const & file_name)
+	{
+		MappedFile file(file_name);
+		return isBinary(file.data(), file.size()) ?
+			readBinary(file.data(), file.size(), nullptr, nullptr) :
+			readCSV(file.data(), file.size(), nullptr, nullptr);
+	}
+
+	size_t DistributorFile::countBodies(ParticleImage const & image)
+	{
+		if (!isBinary(image.data, image.size))
+			throw MAKE_ERROR("Embedded particles are not in the binary particle format");
+		return readBinary(image.data, image.size, nullptr, nullptr);
+	}
+
+	void DistributorFile::save(std::string const & file_name, ParticleData const & bodies, size_t const num, Format const format)
+	{
+		std::ofstream file;
+		file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+		try
+		{
+			if (format == Format::CSV)
+			{
+				file.open(file_name);
+				// enough digits to read back every value exactly
+				file << std::setprecision(17) << "x,y,vx,vy,m\n";
+				for (size_t i = 0; i < num; i++)
+				{
+					auto const& s = bodies.m_state[i];
+					file << s.pos.x << ',' << s.pos.y << ',' << s.vel.x << ',' << s.vel.y << ','
+						<< bodies.m_aux_state[i].mass << '\n';
+				}
+				return;
+			}
+
+			auto buf = encodeBinary(bodies, num, Vector2d(), Vector2d());
+			file.open(file_name, std::ios::binary);
+			file.write(buf.data(), buf.size());
+		}
+		catch (std::ofstream::failure const& fail)
+		{
+			throw MAKE_ERROR("Could not write file " + file_name + ": " + fail.what());
+		}
+	}
+
+	std::shared_ptr<ParticleImage const> DistributorFile::makeImage(ParticleData const & bodies, size_t const num,
+		BodyGroupProperties const & props)
+	{
+		auto image = std::make_shared<ParticleImage>();
+		image->buffer = encodeBinary(bodies, num, posOffset(props), props.vel);
+		image->data = image->buffer.data();
+		image->size = image->buffer.size();
+		return image;
+	}
+
+	std::vector<char> DistributorFile::encodeBinary(ParticleData const & bodies, size_t const num,
+		Vector2d const & pos_offset, Vector2d const & vel_offset)
+	{
+		std::vector<char> buf(s_HEADER_SIZE + num * s_RECORD_SIZE);
+		std::memcpy(buf.data(), s_MAGIC, sizeof(s_MAGIC));
+		byteorder::writeLE(s_VERSION, &buf[8]);
+		byteorder::writeLE(static_cast<uint32_t>(s_NUM_VALUES), &buf[12]);
+		byteorder::writeLE(static_cast<uint64_t>(num), &buf[16]);
+
+		#pragma omp parallel for schedule(static)
+		for (auto i = 0; i < static_cast<int>(num); i++)
+		{
+			auto const pos = bodies.m_state[i].pos - pos_offset;
+			auto const vel = bodies.m_state[i].vel - vel_offset;
+			double const values[s_NUM_VALUES] = { pos.x, pos.y, vel.x, vel.y, bodies.m_aux_state[i].mass };
+			auto record = &buf[s_HEADER_SIZE + i * s_RECORD_SIZE];
+			for (size_t v = 0; v < s_NUM_VALUES; v++)
+				byteorder::writeLE(values[v], record + v * sizeof(double));
+		}
+		return buf;
+	}
+
+	bool DistributorFile::isBinary(char const* data, size_t const size)
+	{
+		return size >= sizeof(s_MAGIC) && !std::memcmp(data, s_MAGIC, sizeof(s_MAGIC));
+	}
+
+	size_t DistributorFile::readBinary(char const* data, size_t const size, ParticleData * bodies, BodyGroupProperties const * props)
+	{
+		if (size < s_HEADER_SIZE)
+			throw MAKE_ERROR("Particle file header is truncated");
+
+		auto const version = byteorder::readLE<uint32_t>(data + 8);
+		auto const num_values = byteorder::readLE<uint32_t>(data + 12);
+		auto const count = byteorder::readLE<uint64_t>(data + 16);
+		if (version != s_VERSION)
+			throw MAKE_ERROR("Unsupported particle file version " + std::to_string(version));
+		if (num_values != s_NUM_VALUES)
+			throw MAKE_ERROR("Particle file has " + std::to_string(num_values) + " values per body, expected "
+				+ std::to_string(s_NUM_VALUES));
+		if ((size - s_HEADER_SIZE) / s_RECORD_SIZE < count)
+			throw MAKE_ERROR("Particle file is truncated");
+
+		if (!bodies)
+			return count;
+
+		checkCount(count, *props);
+		auto const pos_offset = posOffset(*props);
+		auto const vel_offset = props->vel;
+		auto const records = data + s_HEADER_SIZE;
+
+		#pragma omp parallel for schedule(static)
+		for (auto i = 0; i < static_cast<int>(count); i++)
+		{
+			auto record = records + i * s_RECORD_SIZE;
+			double values[s_NUM_VALUES];
+			for (size_t v = 0; v < s_NUM_VALUES; v++)
+				values[v] = byteorder::readLE<double>(record + v * sizeof(double));
+			setBody(*bodies, i, values, pos_offset, vel_offset);
+		}
+		return count;
+	}
+
+	size_t DistributorFile::readCSV(char const* data, size_t const size, ParticleData * bodies, BodyGroupProperties const * props)
+	{
+		auto const end = data + size;
+		auto chunks = splitLines(skipHeader(data, end), end);
+		auto const num_chunks = static_cast<int>(chunks.size());
+
+		// count the bodies of each chunk to find where each chunk's bodies go
+		#pragma omp parallel for schedule(dynamic)
+		for (auto c = 0; c < num_chunks; c++)
+			chunks[c].count = countBodyLines(chunks[c].begin, chunks[c].end);
+
+		size_t count = 0;
+		for (auto& chunk : chunks)
+		{
+			chunk.first = count;
+			count += chunk.count;
+		}
+
+		if (!bodies)
+			return count;
+
+		checkCount(count, *props);
+		auto const pos_offset = posOffset(*props);
+		auto const vel_offset = props->vel;
+
+		#pragma omp parallel for schedule(dynamic)
+		for (auto c = 0; c < num_chunks; c++)
+		{
+			auto& chunk = chunks[c];
+			auto i = chunk.first;
+			for (auto line = chunk.begin; line != chunk.end;)
+			{
+				auto eol = lineEnd(line, chunk.end);
+				if (isBodyLine(line, eol))
+				{
+					double values[s_NUM_VALUES];
+					if (!parseLine(line, eol, values))
+					{
+						chunk.bad_body = i;
+						break;
+					}
+					setBody(*bodies, i++, values, pos_offset, vel_offset);
+				}
+				line = eol == chunk.end ? chunk.end : eol + 1;
+			}
+		}
+
+		// errors are reported once every thread has finished
+		for (auto const& chunk : chunks)
+		{
+			if (chunk.bad_body != std::numeric_limits<size_t>::max())
+				throw MAKE_ERROR("Could not read body " + std::to_string(chunk.bad_body + 1) + " of " + props->file_name
+					+ ", expected " + std::to_string(s_NUM_VALUES) + " comma separated numbers (x,y,vx,vy,m)");
+		}
+		return count;
+	}
+}
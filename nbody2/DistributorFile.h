@@ -0,0 +1,93 @@
+#ifndef DISTRIBUTOR_FILE_H
+#define DISTRIBUTOR_FILE_H
+
+#include "IDistributor.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace nbody
+{
+	// forward declaration
+	struct BodyGroupProperties;
+	struct ParticleData;
+	class MappedFile;
+
+	/**
+	 * \brief A binary particle file held in memory, e.g. embedded in a settings file.
+	 */
+	struct ParticleImage
+	{
+		char const* data;
+		size_t size;
+		// keeps data valid, if it is in a mapped file
+		std::shared_ptr<MappedFile const> mapping;
+		// holds data, if it is not
+		std::vector<char> buffer;
+	};
+
+	/**
+	 * \brief Reads the bodies of a group from a particle file, e.g. initial conditions made by another code.
+	 *		  Each body has a position, velocity and mass in SI units (m, m/s, kg), to which the group's
+	 *		  position and velocity are added. Two formats are read:
+	 *		  - binary: the 8 bytes of s_MAGIC, a uint32 format version (1), a uint32 count of values per
+	 *			body (5), a uint64 count of bodies and 8 reserved bytes, then x, y, vx, vy, m of each body as
+	 *			float64. Every number is little-endian.
+	 *		  - CSV: one body per line as x,y,vx,vy,m. A first line which is not a number (a header),
+	 *			blank lines and lines starting with '#' are skipped.
+	 *		  The file is memory mapped and converted in parallel straight into the model's arrays.
+	 *		  If the group has an embedded particle image, that is read instead of the file.
+	 */
+	class DistributorFile : public IDistributor
+	{
+	public:
+		enum class Format
+		{
+			BINARY,
+			CSV
+		};
+
+		static std::unique_ptr<IDistributor> create();
+
+		void createDistribution(ParticleData & bodies, BodyGroupProperties const& props) const override;
+
+		/**
+		 * \brief Count the bodies in a particle file, throwing an Error if it cannot be read.
+		 */
+		static size_t countBodies(std::string const& file_name);
+
+		/**
+		 * \brief Count the bodies in a binary particle image, throwing an Error if it is malformed.
+		 */
+		static size_t countBodies(ParticleImage const& image);
+
+		/**
+		 * \brief Write bodies to a particle file which can be read back by this distributor.
+		 */
+		static void save(std::string const& file_name, ParticleData const& bodies, size_t const num, Format const format);
+
+		/**
+		 * \brief Store the bodies of a group in memory in the binary format, relative to the group's position
+		 *		  and velocity, which are added again when the image is read.
+		 */
+		static std::shared_ptr<ParticleImage const> makeImage(ParticleData const& bodies, size_t const num,
+			BodyGroupProperties const& props);
+
+		static char constexpr s_MAGIC[8] = "NB2PART";
+		static uint32_t constexpr s_VERSION = 1;
+
+	private:
+		static bool isBinary(char const* data, size_t const size);
+
+		/**
+		 * \brief Read the bodies of a file, or only count them if bodies is null.
+		 */
+		static size_t readBinary(char const* data, size_t const size, ParticleData * bodies, BodyGroupProperties const* props);
+		static size_t readCSV(char const* data, size_t const size, ParticleData * bodies, BodyGroupProperties const* props);
+		static std::vector<char> encodeBinary(ParticleData const& bodies, size_t const num,
+			Vector2d const& pos_offset, Vector2d const& vel_offset);
+	};
+}
+
+#endif // DISTRIBUTOR_FILE_H
@@ -25,11 +25,13 @@ namespace nbody
 		bodies.m_state[0].vel = vel_offset;
 		bodies.m_aux_state[0].mass = props.central_mass * Constants::SOLAR_MASS;
 
-		for (size_t i = 1; i < props.num; i++)
+		#pragma omp parallel for schedule(static)
+		for (auto i = 1; i < static_cast<int>(props.num); i++)
 		{
-			auto mass = getRand(props.min_mass, props.max_mass) * Constants::SOLAR_MASS;
-			auto radius = getRand(0, rad) + Constants::SOFTENING;
-			auto phi = getRand(0, 2 * Constants::PI);
+			auto rng = bodyStream(props, i);
+			auto mass = rng.uniform(props.min_mass, props.max_mass) * Constants::SOLAR_MASS;
+			auto radius = rng.uniform(0, rad) + Constants::SOFTENING;
+			auto phi = rng.uniform(0, 2 * Constants::PI);
 			auto pos = Vector2d{ radius * cos(phi), radius * sin(phi) };
 			auto vel = vCirc(pos, props.central_mass * Constants::SOLAR_MASS);
 			bodies.m_state[i].pos = pos + pos_offset;
@@ -23,14 +23,17 @@ namespace nbody
 		auto m_avg = 0.5 * (props.min_mass + props.max_mass) * Constants::SOLAR_MASS;
 		auto m_tot = props.num * m_avg;
 
-		for (size_t i = 0; i < props.num; i++)
+		#pragma omp parallel for schedule(static)
+		for (auto i = 0; i < static_cast<int>(props.num); i++)
 		{
-			auto mass = getRand(props.min_mass, props.max_mass) * Constants::SOLAR_MASS;
+			// each body has its own stream, so the rejection loop below cannot affect any other body
+			auto rng = bodyStream(props, i);
+			auto mass = rng.uniform(props.min_mass, props.max_mass) * Constants::SOLAR_MASS;
 			// Calculate radius as function of total mass enclosed inside that radius
 			// which is chosen randomly
-			auto fractional_rad = plummer_rad / sqrt(pow(getRand(0, 1), -2.0 / 3.0) - 1);
+			auto fractional_rad = plummer_rad / sqrt(pow(rng.uniform(), -2.0 / 3.0) - 1);
 			// Random distribution for azimuthal angle
-			auto phi = getRand(0, 2 * Constants::PI);
+			auto phi = rng.uniform(0, 2 * Constants::PI);
 			auto pos = Vector2d{ fractional_rad * cos(phi), fractional_rad * sin(phi) };
 
 			// escape velocity v_e
@@ -40,13 +43,13 @@ namespace nbody
 			// g is the value of the distribution function g(q) = q^2 (1 - q^2)^3.5
 			auto g = 0.1;
 			while (g > q * q * pow(1.0 - q * q, 3.5)) {
-				q = getRand(0, 1);
-				g = getRand(0, 0.1);
+				q = rng.uniform();
+				g = rng.uniform(0, 0.1);
 			}
 			// v = q * v_e
 			auto velocity = q * vel_esc;
 			// Random distribution for azimuthal velocity angle
-			auto phi_v = getRand(0, 2 * Constants::PI);
+			auto phi_v = rng.uniform(0, 2 * Constants::PI);
 			// Convert from spherical polar to Cartesian coordinates
 			auto vel = Vector2d{ velocity * cos(phi_v), velocity * sin(phi_v) };
 			bodies.m_state[i].pos = pos + pos_offset;
@@ -1,20 +1,16 @@
 #include "BodyGroupProperties.h"
+#include "ComplexCDF.h"
 #include "Constants.h"
 #include "DistributorRealistic.h"
 
 #include <algorithm>
 #include <numeric>
+#include <vector>
 
 namespace nbody
 {
-	std::uniform_int_distribution<> DistributorRealistic::m_int_dist{};
-
 	DistributorRealistic::DistributorRealistic()
 	{
-		getIntRand = [](int lower, int upper)
-		{
-			return m_int_dist(m_gen, std::uniform_int_distribution<>::param_type{ lower, upper });
-		};
 	}
 
 	DistributorRealistic::~DistributorRealistic()
@@ -35,7 +31,7 @@ namespace nbody
 		auto const core_rad = galaxy_rad * 0.3;
 		auto const delta_ang = 2 * Constants::PI / galaxy_rad;
 
-		m_cdf.setup(1.0, 0.02, galaxy_rad / 3.0, core_rad, 0, galaxy_rad * 2, 1000);
+		auto const cdf = ComplexCDF::create(1.0, 0.02, galaxy_rad / 3.0, core_rad, 0, galaxy_rad * 2, 1000);
 
 		// Initial mass function
 		constexpr auto pow_alpha = 2.35;
@@ -46,41 +42,52 @@ namespace nbody
 		bodies.m_aux_state[0].mass = props.central_mass * Constants::SOLAR_MASS;
 
 		// random distribution properties
-		auto const n_arms = getIntRand(2, 4);
+		auto group_rng = groupStream(props);
+		auto const n_arms = group_rng.uniformInt(2, 4);
 		auto const arm_sep = 2 * Constants::PI / n_arms;
-		auto const angle_offset = getRand(0, 2 * Constants::PI);
+		auto const angle_offset = group_rng.uniform(0, 2 * Constants::PI);
 
 		if (props.use_parsecs)
 		{
 			bodies.m_state[0].pos *= Constants::PARSEC;
 		}
 
-		auto sma = new double[num_bodies];
-		auto ecc = new double[num_bodies];
-		auto beta = new double[num_bodies];
+		std::vector<double> sma(num_bodies);
+		std::vector<double> ecc(num_bodies);
+		std::vector<double> beta(num_bodies);
+
+		// the first number of each body's stream picks its radius, and all radii are sampled at once
+		#pragma omp parallel for schedule(static)
+		for (auto i = 1; i < static_cast<int>(num_bodies); i++)
+			sma[i] = bodyStream(props, i).uniform();
+		if (num_bodies > 1)
+			cdf->sample(num_bodies - 1, &sma[1], &sma[1]);
 
-		for (auto i = 1; i < num_bodies; i++)
+		#pragma omp parallel for schedule(static)
+		for (auto i = 1; i < static_cast<int>(num_bodies); i++)
 		{
-			auto picked_rad = m_cdf.valFromProbability(getRand(0, 1)) + 10 * Constants::SOFTENING / Constants::PARSEC;
+			auto rng = bodyStream(props, i);
+			rng.uniform(); // the radius
+			auto picked_rad = sma[i] + 10 * Constants::SOFTENING / Constants::PARSEC;
 			sma[i] = picked_rad;
 			ecc[i] = eccentricity(sma[i], core_rad, galaxy_rad);
 
 			auto angle = sma[i] * delta_ang;
-			auto alpha = getRand(0, 2 * Constants::PI);
+			auto alpha = rng.uniform(0, 2 * Constants::PI);
 
 
-			beta[i] = angle + angle_offset + arm_sep * getIntRand(0, n_arms - 1);
+			beta[i] = angle + angle_offset + arm_sep * rng.uniformInt(0, n_arms - 1);
 
 			auto r = sma[i] * (1 - ecc[i] * ecc[i]) / (1 + ecc[i] * cos(alpha - beta[i]));
 
 			// smudging
-			alpha += getRand(-0.05, 0.05);
+			alpha += rng.uniform(-0.05, 0.05);
 
 			auto pos = Vector2d{ r * cos(alpha), r * sin(alpha) };
 
 			auto mass_lims = constrainMasses({ props.min_mass, props.max_mass }, picked_rad, core_rad, galaxy_rad);
 			auto k = (1 - pow_alpha) / (pow(mass_lims.second, 1 - pow_alpha) - pow(mass_lims.first, 1 - pow_alpha));
-			auto mass = salpeterIMF(pow_alpha, k, mass_lims.first);
+			auto mass = salpeterIMF(pow_alpha, k, mass_lims.first, rng);
 
 			bodies.m_state[i].pos = pos;
 			bodies.m_aux_state[i].mass = mass * Constants::SOLAR_MASS;
@@ -90,62 +97,45 @@ namespace nbody
 			}
 		}
 
-		auto indices = new size_t[num_bodies];
-		for (auto i = 0; i < num_bodies; i++)
-			indices[i] = i;
-
-		std::sort(indices,
-			indices + num_bodies,
-			[&](auto a, auto b)
+		// the mass enclosed by each body's orbit is that of every body at the same or a smaller radius,
+		// found from a prefix sum over the bodies sorted by radius
+		std::vector<double> rad(num_bodies);
+		#pragma omp parallel for schedule(static)
+		for (auto i = 0; i < static_cast<int>(num_bodies); i++)
+			rad[i] = bodies.m_state[i].pos.mag();
+
+		std::vector<size_t> indices(num_bodies);
+		std::iota(indices.begin(), indices.end(), size_t{ 0 });
+		std::sort(indices.begin(), indices.end(), [&](auto a, auto b) { return rad[a] < rad[b]; });
+
+		std::vector<double> sorted_rad(num_bodies);
+		std::vector<double> encl_mass(num_bodies + 1);
+		encl_mass[0] = 0.0;
+		for (auto j = 0; j < num_bodies; j++)
 		{
-			auto dist_a = bodies.m_state[a].pos.mag();
-			auto dist_b = bodies.m_state[b].pos.mag();
-			return dist_a < dist_b;
-		});
+			sorted_rad[j] = rad[indices[j]];
+			encl_mass[j + 1] = encl_mass[j] + bodies.m_aux_state[indices[j]].mass;
+		}
 
-		for (auto i = 1; i < num_bodies; i++)
+		#pragma omp parallel for schedule(static)
+		for (auto i = 1; i < static_cast<int>(num_bodies); i++)
 		{
-			auto current_body = ParticleData{ bodies.m_state + i, bodies.m_aux_state + i };
-			
-			size_t lb = 0;
-			for(auto j = 0 ; j < num_bodies; j++)
-			{
-				auto idx = indices[j];
-				auto idx_rad = bodies.m_state[idx].pos.mag();
-				if (idx_rad > current_body.m_state->pos.mag())
-				{
-					lb = j;
-					break;
-				}
-			}
-
-			auto encl_mass = std::accumulate(indices,
-				&indices[lb],
-				0.0,
-				[&](auto a, auto b)
-			{
-				return a + bodies.m_aux_state[b].mass;
-			});
+			auto n_inside = std::upper_bound(sorted_rad.begin(), sorted_rad.end(), rad[i]) - sorted_rad.begin();
 
-			auto vel = velocity(current_body.m_state->pos,
+			bodies.m_state[i].vel = velocity(bodies.m_state[i].pos,
 				sma[i] * Constants::PARSEC,
-				encl_mass,
+				encl_mass[n_inside],
 				ecc[i],
 				beta[i]);
-
-			current_body.m_state->vel = vel;
 		}
 
-		for (auto i = 0; i < num_bodies; i++)
+		auto const pos_shift = props.use_parsecs ? pos_offset * Constants::PARSEC : pos_offset;
+		#pragma omp parallel for schedule(static)
+		for (auto i = 0; i < static_cast<int>(num_bodies); i++)
 		{
-			bodies.m_state[i].pos += props.use_parsecs ? pos_offset * Constants::PARSEC : pos_offset;
+			bodies.m_state[i].pos += pos_shift;
 			bodies.m_state[i].vel += vel_offset;
 		}
-
-		delete[] sma;
-		delete[] ecc;
-		delete[] beta;
-		delete[] indices;
 	}
 
 	std::pair<double, double> DistributorRealistic::constrainMasses(std::pair<double, double> const limits, double const rad, double const core_rad, double const galaxy_rad)
@@ -162,9 +152,9 @@ namespace nbody
 		return std::make_pair(limits.first, 2.0);
 	}
 
-	double DistributorRealistic::salpeterIMF(double const alpha, double const k, double const lb) const
+	double DistributorRealistic::salpeterIMF(double const alpha, double const k, double const lb, Philox & rng)
 	{
-		auto x = getRand(0, 1);
+		auto x = rng.uniform();
 		return pow(x * (1 - alpha) / k + pow(lb, 1 - alpha), 1 / (1 - alpha));
 	}
 
@@ -1,7 +1,6 @@
 #ifndef DISTRIBUTOR_REALISTIC_H
 #define DISTRIBUTOR_REALISTIC_H
 
-#include "ComplexCDF.h"
 #include "IDistributor.h"
 
 namespace nbody
@@ -31,9 +30,10 @@ namespace nbody
 		* \param alpha Slope of the power law
 		* \param k Normalisation constant
 		* \param lb Minimum mass value (should be >= 0.5Msun)
+		* \param rng The random number stream of the body
 		* \return The computed mass value
 		*/
-		double salpeterIMF(double const alpha, double const k, double const lb) const;
+		static double salpeterIMF(double const alpha, double const k, double const lb, Philox & rng);
 		
 		
 		/**
@@ -59,11 +59,6 @@ namespace nbody
 		 */
 		static Vector2d velocity(Vector2d const& pos, double const a, double const m, double const e, double const phi);
 
-		int(*getIntRand)(int, int);
-		static std::uniform_int_distribution<> m_int_dist;
-		
-		mutable ComplexCDF m_cdf;
-
 		constexpr static double s_ECC_CORE = 0.35;
 		constexpr static double s_ECC_DISK = 0.2;
 		constexpr static int s_NUM_PERTS = 3;
@@ -14,19 +14,23 @@ namespace nbody
 		Error() = default;
 
 		Error(const std::string& msgIn, const std::string& fileIn, const std::string& funcIn, const int lineIn) :
-			std::runtime_error(msgIn), m_file(fileIn), m_func(funcIn), m_line(lineIn) {};
-
-		const char* what() const noexcept override
+			std::runtime_error(msgIn), m_file(fileIn), m_func(funcIn), m_line(lineIn)
 		{
+			// built once, since what() must return a pointer which outlives the call
 			std::ostringstream builder;
 			builder << "ERROR: " << std::runtime_error::what() << "\nFile: " << m_file << " at: " << m_func << ":" << m_line;
-			auto p_str = std::string(builder.str());
-			return p_str.c_str();
+			m_what = builder.str();
+		};
+
+		const char* what() const noexcept override
+		{
+			return m_what.c_str();
 		}
 
 	private:
 		const std::string m_file, m_func;
 		const int m_line;
+		std::string m_what;
 	};
 }
 
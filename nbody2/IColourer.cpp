@@ -1,9 +1,13 @@
 #include "IColourer.h"
 
+#include <algorithm>
+
 namespace nbody
 {
+	size_t constexpr IColourer::s_BATCH_SIZE;
+
 	IColourer::IColourer(size_t n_cols) :
-		m_offset(0), m_num_bodies(0), m_n_cols(n_cols)
+		m_offset(0), m_num_bodies(0), m_n_cols(n_cols), m_applied(false)
 	{
 	}
 
@@ -15,15 +19,28 @@ namespace nbody
 	{
 		m_offset = offset;
 		m_num_bodies = num_bodies;
+		m_applied = false;
 		std::copy(&cols[0], &cols[0] + MAX_COLS_PER_COLOURER, &m_cols[0]);
 	}
 
-	void IColourer::apply(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours)
+	void IColourer::apply(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours, size_t const* slots)
 	{
-		for(auto i = m_offset; i < m_offset + m_num_bodies; i++)
+		if (m_applied && isStatic())
+			return;
+
+		auto const num_batches = static_cast<int>((m_num_bodies + s_BATCH_SIZE - 1) / s_BATCH_SIZE);
+#pragma omp parallel for schedule(static)
+		for (auto b = 0; b < num_batches; b++)
 		{
-			auto p = ParticleData{ &state[i], &aux_state[i] };
-			applyImpl(&p, colours + i);
+			auto const first = b * s_BATCH_SIZE;
+			auto const num = std::min(s_BATCH_SIZE, m_num_bodies - first);
+			applyBatch(state, aux_state, colours, slots + m_offset + first, first, num);
 		}
+		m_applied = true;
+	}
+
+	bool IColourer::isStatic() const
+	{
+		return false;
 	}
 }
\ No newline at end of file
@@ -65,8 +65,30 @@ namespace nbody
 
 		virtual void setup(size_t const offset, size_t const num_bodies, sf::Color const* cols, const ParticleData* = nullptr);
 		
-		void apply(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours);
-		virtual void applyImpl(ParticleData const* state, ParticleColourState * colour) = 0;
+		/**
+		 * \brief Colour the bodies in this colourer's group, in parallel batches of up to s_BATCH_SIZE bodies.
+		 *		  The bodies of a static colourer are only coloured the first time.
+		 * \param slots Array slot of each body, indexed by the id the body was added with, or NO_SLOT
+		 *		  for bodies which have been removed, which are skipped.
+		 */
+		void apply(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours, size_t const* slots);
+
+		/**
+		 * \brief Colour a run of consecutive bodies of this colourer's group.
+		 * \param slots Array slot of each body in the run, or NO_SLOT for bodies which are skipped.
+		 * \param first Index within the group of the first body in the run, in the order the bodies were added.
+		 * \param num Number of bodies in the run, at most s_BATCH_SIZE.
+		 */
+		virtual void applyBatch(ParticleState const* state, ParticleAuxState const* aux_state, ParticleColourState * colours,
+								size_t const* slots, size_t const first, size_t const num) = 0;
+
+		/**
+		 * \brief Whether the colours depend only on the group's setup, so need only be applied once.
+		 *		  Colours stay with their bodies when the arrays are sorted.
+		 */
+		virtual bool isStatic() const;
+
+		static constexpr size_t s_BATCH_SIZE = 256;
 
 	protected:
 		sf::Color m_cols[MAX_COLS_PER_COLOURER];
@@ -75,6 +97,7 @@ namespace nbody
 	private:
 		size_t m_offset;
 		size_t m_n_cols;
+		bool m_applied;
 
 	};
 }
@@ -1,7 +1,11 @@
+#include "BodyGroupProperties.h"
 #include "IDistributor.h"
 #include "Constants.h"
 #include "Vector.h"
 
+#include <limits>
+#include <random>
+
 namespace nbody
 {
 	namespace priv
@@ -16,7 +20,21 @@ namespace nbody
 		}
 	}
 
-	std::random_device dev{};
-	std::default_random_engine IDistributor::m_gen{ dev() };
-	std::uniform_real_distribution<> IDistributor::m_dist{ 0, 1 };
+	uint32_t IDistributor::randomSeed()
+	{
+		std::random_device dev{};
+		// kept non-negative so that it can be edited as an int
+		return dev() & static_cast<uint32_t>(std::numeric_limits<int>::max());
+	}
+
+	Philox IDistributor::bodyStream(BodyGroupProperties const & props, size_t const i)
+	{
+		return{ props.seed, i };
+	}
+
+	Philox IDistributor::groupStream(BodyGroupProperties const & props)
+	{
+		// after every possible body index
+		return{ props.seed, std::numeric_limits<uint64_t>::max() };
+	}
 }
\ No newline at end of file
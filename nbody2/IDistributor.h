@@ -1,9 +1,11 @@
 #ifndef DISTRIBUTOR_H
 #define DISTRIBUTOR_H
 
+#include "Philox.h"
+
 #include <array>
-//#include <memory>
-#include <random>
+#include <cstdint>
+#include <memory>
 
 namespace nbody
 {
@@ -42,14 +44,13 @@ namespace nbody
 	struct BodyGroupProperties;
 	struct ParticleData;
 
-	using param_t = std::uniform_real_distribution<>::param_type;
-
 	enum class DistributorType
 	{
 		EXPONENTIAL,
 		ISOTHERMAL,
 		PLUMMER,
 		REALISTIC,
+		FROM_FILE,
 		N_DISTRIBUTIONS,
 		INVALID = -1
 	};
@@ -96,28 +97,42 @@ namespace nbody
 			"Realistic",
 			"Bodies are distributed using the density-wave theory for spiral arms.",
 			true
+		},
+		{
+			DistributorType::FROM_FILE,
+			"From file",
+			"Positions, velocities and masses are read from a binary or CSV particle file, e.g. one made by another code.",
+			false
 		}
 		} };
 
+	/**
+	 * \brief Places a group of bodies. Every random number comes from the group's seed, and each body
+	 *		  draws from its own stream, so a distribution is reproducible and may be created in parallel
+	 *		  with identical results for any number of threads.
+	 */
 	class IDistributor
 	{
 	public:
-		IDistributor()
-		{
-			getRand = [](double lower, double upper)
-			{
-				return m_dist(m_gen, param_t{ lower, upper });
-			};
-		}
-
 		virtual ~IDistributor() = default;
 
 		virtual void createDistribution(ParticleData & bodies, BodyGroupProperties const&) const = 0;
 
+		/**
+		 * \brief Get a seed from std::random_device, e.g. for a newly created body group.
+		 */
+		static uint32_t randomSeed();
+
 	protected:
-		double (*getRand)(double, double);
-		static std::default_random_engine m_gen;
-		static std::uniform_real_distribution<> m_dist;
+		/**
+		 * \brief Get the random number stream of body i of the group.
+		 */
+		static Philox bodyStream(BodyGroupProperties const& props, size_t const i);
+
+		/**
+		 * \brief Get the random number stream for properties shared by the whole group.
+		 */
+		static Philox groupStream(BodyGroupProperties const& props);
 	};
 }
 
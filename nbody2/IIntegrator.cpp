@@ -8,7 +8,8 @@ namespace nbody
 		m_step(step),
 		m_time(0),
 		m_n_steps(0),
-		m_dim(model ? model->getDim() : 0)
+		m_dim(model ? model->getDim() : 0),
+		m_capacity(m_dim / 2)
 	{
 		if (!model)
 			throw MAKE_ERROR("Model was nullptr");
@@ -65,4 +66,52 @@ namespace nbody
 	{
 		return m_name;
 	}
+
+	std::vector<size_t> IIntegrator::reorder()
+	{
+		auto order = m_model->sortBodies(getStateVector());
+		permute(order);
+		m_dim = m_model->getDim();
+		return order;
+	}
+
+	size_t IIntegrator::mergeBodies(double const radius, std::vector<size_t> & survivors)
+	{
+		// the state vector belongs to this integrator, which lets the model change it between steps
+		auto const num_merged = m_model->mergeBodies(const_cast<Vector2d *>(getStateVector()), radius, survivors);
+		if (num_merged)
+			merge(survivors);
+		return num_merged;
+	}
+
+	size_t IIntegrator::addBodies(ParticleState const* state, ParticleAuxState const* aux_state, sf::Color const colour, size_t const num)
+	{
+		auto const first = m_model->getNumBodies();
+		auto const old_state = getStateVector();
+		auto const tracking = m_model->isTracking(old_state);
+
+		auto const id = m_model->insertBodies(state, aux_state, colour, num);
+		m_dim = m_model->getDim();
+		insert(state, first, num);
+
+		// the model knows the tracked state by its address, which moves if the arrays grow
+		if (tracking && getStateVector() != old_state)
+			m_model->trackConserved(getStateVector());
+		return id;
+	}
+
+	void IIntegrator::merge(std::vector<size_t> const&)
+	{
+	}
+
+	std::vector<size_t> IIntegrator::compact()
+	{
+		auto order = m_model->compactBodies();
+		if (!order.empty())
+		{
+			permute(order);
+			m_dim = m_model->getDim();
+		}
+		return order;
+	}
 }
\ No newline at end of file
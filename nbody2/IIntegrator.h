@@ -69,11 +69,65 @@ namespace nbody
 		virtual void setInitialState(Vector2d* state) = 0;
 		virtual Vector2d const* getStateVector() const = 0;
 
+		/**
+		 * \brief Sort the bodies along a space-filling curve to improve memory locality,
+		 *		  rearranging the model's arrays along with the state and any history kept here.
+		 *		  Removed bodies are dropped (see compact).
+		 * \return The permutation applied: the body now in slot i was previously in slot order[i].
+		 */
+		std::vector<size_t> reorder();
+
+		/**
+		 * \brief Merge the bodies closer together than a distance (see IModel::mergeBodies), and set any
+		 *		  history kept here for the survivors to their new velocities.
+		 * \param survivors Set to the slots of the bodies which took on a group.
+		 * \return The number of bodies removed.
+		 */
+		size_t mergeBodies(double const radius, std::vector<size_t> & survivors);
+
+		/**
+		 * \brief Add bodies to the simulation after those already in the arrays, which grow as needed
+		 *		  (see IModel::insertBodies). Any history kept here is started from the current derivatives.
+		 * \return The id of the first body added.
+		 */
+		size_t addBodies(ParticleState const* state, ParticleAuxState const* aux_state, sf::Color const colour, size_t const num);
+
+		/**
+		 * \brief Drop the removed bodies from the model's arrays, the state and any history kept here,
+		 *		  after which only the remaining bodies are integrated.
+		 * \return The order applied, as for reorder, or an empty vector if no bodies had been removed.
+		 */
+		std::vector<size_t> compact();
+
 	protected:
+		/**
+		 * \brief Apply a permutation of the bodies to every per-body array the integrator keeps
+		 *		  between steps.
+		 * \param order The body now in slot i was previously in slot order[i].
+		 */
+		virtual void permute(std::vector<size_t> const& order) = 0;
+
+		/**
+		 * \brief Make room for bodies added to the end of the model's arrays, growing every per-body array
+		 *		  kept here to the model's capacity if needed, and set their state.
+		 * \param first The slot of the first new body.
+		 */
+		virtual void insert(ParticleState const* state, size_t const first, size_t const num) = 0;
+
+		/**
+		 * \brief Set the velocities in any history of derivatives kept here for bodies which have just
+		 *		  taken on the momentum of a merged group, so that they move with it from the next step.
+		 *		  Nothing is kept by default.
+		 * \param slots The slots of those bodies.
+		 */
+		virtual void merge(std::vector<size_t> const& slots);
+
 		IModel* m_model;
 		double m_step, m_time;
 		size_t m_n_steps;
-		size_t const m_dim;
+		size_t m_dim;
+		// the number of bodies the per-body arrays can hold
+		size_t m_capacity;
 		std::string m_name;
 
 	private:
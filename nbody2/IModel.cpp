@@ -3,24 +3,38 @@
 #include "IDistributor.h"
 #include "IColourer.h"
 #include "IModel.h"
-#include "Timings.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <utility>
 
 namespace nbody
 {
+	size_t constexpr IModel::s_COMPACT_RATIO;
+
 	IModel::IModel(std::string name, bool has_tree, size_t dim)
 		: m_initial_state(nullptr),
 		m_aux_state(nullptr),
 		m_colour_state(nullptr),
-		m_masked(nullptr),
+		m_removed(nullptr),
 		m_step(1),
 		m_num_bodies(0),
 		m_num_added(0),
 		m_tot_mass(0),
 		m_centre_mass(),
+		m_capacity(0),
+		m_num_removed(0),
+		m_num_merged(0),
+		m_num_tombstones(0),
 		m_has_tree(has_tree),
 		m_dim(dim),
-		m_name(name)
+		m_name(name),
+		m_conserved_state(nullptr),
+		m_conserved()
 	{
+		m_conserved.time = -1;
 	}
 
 	IModel::~IModel()
@@ -28,7 +42,7 @@ namespace nbody
 		delete[] m_initial_state;
 		delete[] m_aux_state;
 		delete[] m_colour_state;
-		delete[] m_masked;
+		delete[] m_removed;
 
 	}
 
@@ -59,8 +73,288 @@ namespace nbody
 	{
 		for (auto& col : m_colourers)
 		{
-			col->apply(reinterpret_cast<ParticleState const*>(state), m_aux_state, m_colour_state);
+			col->apply(reinterpret_cast<ParticleState const*>(state), m_aux_state, m_colour_state, m_slot_of_id.data());
+		}
+	}
+
+	namespace
+	{
+		// Spread the low 16 bits of x out into the even bits of the result
+		uint32_t spreadBits(uint32_t x)
+		{
+			x &= 0x0000ffff;
+			x = (x | (x << 8)) & 0x00ff00ff;
+			x = (x | (x << 4)) & 0x0f0f0f0f;
+			x = (x | (x << 2)) & 0x33333333;
+			x = (x | (x << 1)) & 0x55555555;
+			return x;
+		}
+	}
+
+	std::vector<size_t> IModel::sortBodies(Vector2d const * state)
+	{
+		auto ps = reinterpret_cast<ParticleState const *>(state);
+
+		auto min = ps[0].pos, max = ps[0].pos;
+		for (size_t i = 1; i < m_num_bodies; i++)
+		{
+			min.x = std::min(min.x, ps[i].pos.x);
+			min.y = std::min(min.y, ps[i].pos.y);
+			max.x = std::max(max.x, ps[i].pos.x);
+			max.y = std::max(max.y, ps[i].pos.y);
+		}
+
+		// quantise positions onto a 2^16 x 2^16 grid covering all bodies
+		auto const len = std::max(max.x - min.x, max.y - min.y);
+		auto const scale = len > 0 ? 65535.0 / len : 0.0;
+
+		std::vector<std::pair<uint32_t, size_t>> keys(m_num_bodies);
+#pragma omp parallel for schedule(static)
+		for (int i = 0; i < static_cast<int>(m_num_bodies); i++)
+		{
+			auto const gx = static_cast<uint32_t>((ps[i].pos.x - min.x) * scale);
+			auto const gy = static_cast<uint32_t>((ps[i].pos.y - min.y) * scale);
+			keys[i] = { spreadBits(gx) | (spreadBits(gy) << 1), i };
+		}
+		std::sort(keys.begin(), keys.end());
+
+		// tombstones are dropped on the way
+		std::vector<size_t> order;
+		order.reserve(m_num_bodies - m_num_tombstones);
+		for (size_t i = 0; i < m_num_bodies; i++)
+			if (!m_removed[keys[i].second])
+				order.push_back(keys[i].second);
+
+		reorderArrays(order);
+
+		return order;
+	}
+
+	size_t IModel::mergeBodies(Vector2d * state, double const radius, std::vector<size_t> & survivors)
+	{
+		survivors.clear();
+		std::vector<std::pair<uint32_t, uint32_t>> pairs;
+		findClosePairs(state, radius, pairs);
+		// tombstones have no mass, so are left where they are
+		pairs.erase(std::remove_if(pairs.begin(), pairs.end(),
+			[this](std::pair<uint32_t, uint32_t> const& p) { return m_removed[p.first] || m_removed[p.second]; }), pairs.end());
+		if (pairs.empty())
+			return 0;
+
+		auto ps = reinterpret_cast<ParticleState *>(state);
+
+		// group the bodies in any pair, joining chains of close bodies into one group
+		std::vector<uint32_t> slots;
+		slots.reserve(2 * pairs.size());
+		for (auto const& p : pairs)
+		{
+			slots.push_back(p.first);
+			slots.push_back(p.second);
+		}
+		std::sort(slots.begin(), slots.end());
+		slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+
+		auto const local = [&](uint32_t const slot)
+		{
+			return static_cast<size_t>(std::lower_bound(slots.begin(), slots.end(), slot) - slots.begin());
+		};
+		std::vector<size_t> group(slots.size());
+		std::iota(group.begin(), group.end(), size_t{ 0 });
+		auto const find = [&](size_t g)
+		{
+			while (group[g] != g)
+				g = group[g] = group[group[g]];
+			return g;
+		};
+		for (auto const& p : pairs)
+		{
+			auto const a = find(local(p.first)), b = find(local(p.second));
+			group[std::max(a, b)] = std::min(a, b);
+		}
+
+		// the most massive body of each group takes its total mass, centre of mass and momentum
+		std::vector<size_t> keeper(slots.size());
+		std::iota(keeper.begin(), keeper.end(), size_t{ 0 });
+		for (size_t k = 0; k < slots.size(); k++)
+		{
+			auto& kept = keeper[find(k)];
+			if (m_aux_state[slots[k]].mass > m_aux_state[slots[kept]].mass)
+				kept = k;
+		}
+
+		std::vector<double> mass(slots.size(), 0.0);
+		std::vector<Vector2d> moment(slots.size()), momentum(slots.size());
+		for (size_t k = 0; k < slots.size(); k++)
+		{
+			auto const g = find(k);
+			auto const m = m_aux_state[slots[k]].mass;
+			mass[g] += m;
+			moment[g] += m * ps[slots[k]].pos;
+			momentum[g] += m * ps[slots[k]].vel;
+		}
+
+		auto num_merged = size_t{ 0 };
+		for (size_t k = 0; k < slots.size(); k++)
+		{
+			auto const g = find(k);
+			if (keeper[g] != k)
+			{
+				// the group's mass and centre of mass are unchanged, so the totals are too
+				tombstone(slots[k]);
+				num_merged++;
+				continue;
+			}
+			if (mass[g] > 0)
+			{
+				ps[slots[k]].pos = moment[g] / mass[g];
+				ps[slots[k]].vel = momentum[g] / mass[g];
+			}
+			m_aux_state[slots[k]].mass = mass[g];
+			survivors.push_back(slots[k]);
+		}
+
+		m_num_merged += num_merged;
+		return num_merged;
+	}
+
+	size_t IModel::insertBodies(ParticleState const* state, ParticleAuxState const* aux_state, sf::Color const colour, size_t const num)
+	{
+		auto const first = m_num_bodies;
+		if (first + num > m_capacity)
+			reserve(std::max(first + num, 2 * m_capacity));
+
+		auto const first_id = m_slot_of_id.size();
+		auto moment = m_centre_mass * m_tot_mass;
+		for (size_t k = 0; k < num; k++)
+		{
+			moment += state[k].pos * aux_state[k].mass;
+			m_tot_mass += aux_state[k].mass;
+			m_initial_state[first + k] = state[k];
+			m_aux_state[first + k] = aux_state[k];
+			m_colour_state[first + k].colour = colour;
+			m_removed[first + k] = false;
+			m_slot_of_id.push_back(first + k);
+			m_id_of_slot.push_back(first_id + k);
+		}
+		if (m_tot_mass > 0)
+			m_centre_mass = moment / m_tot_mass;
+
+		m_num_bodies += num;
+		setDim(m_num_bodies * 2);
+
+		onInsert();
+
+		return first_id;
+	}
+
+	void IModel::removeBody(size_t const id, Vector2d const* state)
+	{
+		auto const slot = m_slot_of_id[id];
+		if (slot == NO_SLOT || m_removed[slot])
+			return;
+
+		auto const& pos = reinterpret_cast<ParticleState const*>(state)[slot].pos;
+		auto const mass = m_aux_state[slot].mass;
+		auto const moment = m_centre_mass * m_tot_mass - pos * mass;
+		m_tot_mass -= mass;
+		if (m_tot_mass > 0)
+			m_centre_mass = moment / m_tot_mass;
+
+		tombstone(slot);
+	}
+
+	void IModel::tombstone(size_t const slot)
+	{
+		m_removed[slot] = true;
+		m_aux_state[slot].mass = 0;
+		m_num_tombstones++;
+		m_num_removed++;
+	}
+
+	std::vector<size_t> IModel::compactBodies()
+	{
+		if (m_num_tombstones == 0)
+			return {};
+
+		std::vector<size_t> order;
+		order.reserve(m_num_bodies - m_num_tombstones);
+		for (size_t i = 0; i < m_num_bodies; i++)
+			if (!m_removed[i])
+				order.push_back(i);
+
+		reorderArrays(order);
+
+		return order;
+	}
+
+	bool IModel::shouldCompact() const
+	{
+		return m_num_tombstones * s_COMPACT_RATIO > m_num_bodies;
+	}
+
+	void IModel::reorderArrays(std::vector<size_t> const& order)
+	{
+		// the ids of the bodies left out have no slot afterwards
+		for (size_t i = 0; i < m_num_bodies; i++)
+			if (m_removed[i])
+				m_slot_of_id[m_id_of_slot[i]] = NO_SLOT;
+
+		applyOrder(m_initial_state, order);
+		applyOrder(m_aux_state, order);
+		applyOrder(m_colour_state, order);
+		applyOrder(m_removed, order);
+		applyOrder(m_id_of_slot.data(), order);
+
+		m_num_tombstones -= m_num_bodies - order.size();
+		m_num_bodies = order.size();
+		m_id_of_slot.resize(m_num_bodies);
+		setDim(m_num_bodies * 2);
+
+		for (size_t i = 0; i < m_num_bodies; i++)
+			m_slot_of_id[m_id_of_slot[i]] = i;
+
+		onReorder(order);
+	}
+
+	void IModel::reserve(size_t const capacity)
+	{
+		reallocate(m_initial_state, m_num_bodies, capacity);
+		reallocate(m_aux_state, m_num_bodies, capacity);
+		reallocate(m_colour_state, m_num_bodies, capacity);
+		reallocate(m_removed, m_num_bodies, capacity);
+		m_capacity = capacity;
+	}
+
+	void IModel::findClosePairs(Vector2d * state, double const radius, std::vector<std::pair<uint32_t, uint32_t>> & pairs)
+	{
+		auto ps = reinterpret_cast<ParticleState const *>(state);
+		auto const radius_sq = radius * radius;
+
+		// only bodies within radius of each other along x need comparing
+		std::vector<std::pair<double, uint32_t>> xs(m_num_bodies);
+		for (size_t i = 0; i < m_num_bodies; i++)
+			xs[i] = { ps[i].pos.x, static_cast<uint32_t>(i) };
+		std::sort(xs.begin(), xs.end());
+
+		auto const first_pair = pairs.size();
+		for (size_t i = 0; i < xs.size(); i++)
+		{
+			for (auto j = i + 1; j < xs.size() && xs[j].first - xs[i].first < radius; j++)
+			{
+				auto const a = xs[i].second, b = xs[j].second;
+				if ((ps[b].pos - ps[a].pos).mag_sq() < radius_sq)
+					pairs.emplace_back(std::min(a, b), std::max(a, b));
+			}
 		}
+		std::sort(pairs.begin() + first_pair, pairs.end());
+	}
+
+	void IModel::onReorder(std::vector<size_t> const& order)
+	{
+	}
+
+	void IModel::onInsert()
+	{
 	}
 
 	bool IModel::hasTree() const
@@ -73,6 +367,47 @@ namespace nbody
 		return m_num_bodies;
 	}
 
+	size_t IModel::getSlot(size_t const id) const
+	{
+		return m_slot_of_id[id];
+	}
+
+	size_t IModel::getId(size_t const slot) const
+	{
+		return m_id_of_slot[slot];
+	}
+
+	bool IModel::isRemoved(size_t const id) const
+	{
+		auto const slot = m_slot_of_id[id];
+		return slot == NO_SLOT || m_removed[slot];
+	}
+
+	size_t IModel::getNumRemoved() const
+	{
+		return m_num_removed;
+	}
+
+	size_t IModel::getNumMerged() const
+	{
+		return m_num_merged;
+	}
+
+	size_t IModel::getNumTombstones() const
+	{
+		return m_num_tombstones;
+	}
+
+	size_t IModel::getNumIds() const
+	{
+		return m_slot_of_id.size();
+	}
+
+	size_t IModel::getCapacity() const
+	{
+		return m_capacity;
+	}
+
 	ParticleAuxState const* IModel::getAuxState() const
 	{
 		return m_aux_state;
@@ -83,6 +418,11 @@ namespace nbody
 		return m_colour_state;
 	}
 
+	bool const* IModel::getRemoved() const
+	{
+		return m_removed;
+	}
+
 	Vector2d IModel::getCentreMass() const
 	{
 		return m_centre_mass;
@@ -92,27 +432,85 @@ namespace nbody
 	{
 		auto ke = 0.0, pe = 0.0;
 		auto ps = reinterpret_cast<ParticleState const *>(all);
+		auto const soft_sq = Constants::SOFTENING * Constants::SOFTENING;
+		auto const num = static_cast<int>(m_num_bodies);
 
-		timings[Timings::ENERGY_CALC_START] = Clock::now();
-#pragma omp parallel for schedule(static) reduction(+:pe,ke)
-		for (int i = 0; i < m_num_bodies; i++)
+		ScopedZone zone{ Zone::ENERGY_CALC };
+		// each pair is counted once, so rows get shorter and are handed out dynamically
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:pe,ke)
+		for (int i = 0; i < num; i++)
 		{
 			ke += 0.5 * m_aux_state[i].mass * ps[i].vel.mag_sq();
 
-			for (auto j = 0; j < m_num_bodies; j++)
+			for (auto j = i + 1; j < num; j++)
 			{
-				if (j == i)
-					continue;
-				auto rel_pos_mag = (ps[j].pos - ps[i].pos).mag();
-				pe += -m_aux_state[j].mass * m_aux_state[i].mass * Constants::G / rel_pos_mag;
+				// -G m1 m2 / r, or the potential of the softened force inside the softening length
+				auto r_sq = (ps[j].pos - ps[i].pos).mag_sq();
+				auto s_sq = std::max(r_sq, soft_sq);
+				pe -= Constants::G * m_aux_state[i].mass * m_aux_state[j].mass
+					* (1.5 * s_sq - 0.5 * r_sq) / (s_sq * sqrt(s_sq));
 			}
-
 		}
-		timings[Timings::ENERGY_CALC_END] = Clock::now();
 
 		return ke + pe;
 	}
 
+	void IModel::trackConserved(Vector2d const * state)
+	{
+		m_conserved_state = state;
+		m_conserved = {};
+		m_conserved.time = -1;
+	}
+
+	bool IModel::isTracking(Vector2d const * state) const
+	{
+		return m_conserved_state == state;
+	}
+
+	ConservedQuantities const& IModel::getConserved() const
+	{
+		return m_conserved;
+	}
+
+	void IModel::recordConserved(Vector2d const * state, double const time, double const potential)
+	{
+		if (state != m_conserved_state)
+			return;
+
+		auto ps = reinterpret_cast<ParticleState const *>(state);
+		auto const num = static_cast<int>(m_num_bodies);
+		// OpenMP 2.0 only reduces scalars
+		auto ke = 0.0, px = 0.0, py = 0.0, l = 0.0, cx = 0.0, cy = 0.0, p_scale = 0.0, l_scale = 0.0, mass = 0.0;
+#pragma omp parallel for schedule(static) reduction(+:ke,px,py,l,cx,cy,p_scale,l_scale,mass)
+		for (int i = 0; i < num; i++)
+		{
+			auto const m = m_aux_state[i].mass;
+			auto const& pos = ps[i].pos;
+			auto const& vel = ps[i].vel;
+			auto const speed = vel.mag();
+			ke += 0.5 * m * speed * speed;
+			px += m * vel.x;
+			py += m * vel.y;
+			l += m * (pos.x * vel.y - pos.y * vel.x);
+			cx += m * pos.x;
+			cy += m * pos.y;
+			mass += m;
+			p_scale += m * speed;
+			l_scale += m * pos.mag() * speed;
+		}
+
+		m_conserved.time = time;
+		m_conserved.kinetic = ke;
+		m_conserved.potential = potential;
+		m_conserved.momentum = { px, py };
+		m_conserved.angular_momentum = l;
+		// summed here, as bodies can be added, removed or given a new mass while running
+		m_conserved.centre_mass = mass > 0 ? Vector2d{ cx, cy } / mass : Vector2d{};
+		m_conserved.mass = mass;
+		m_conserved.momentum_scale = p_scale;
+		m_conserved.angular_momentum_scale = l_scale;
+	}
+
 	size_t IModel::getDim() const
 	{
 		return m_dim;
@@ -136,10 +534,16 @@ namespace nbody
 		m_initial_state = new ParticleState[num_bodies];
 		m_aux_state = new ParticleAuxState[num_bodies];
 		m_colour_state = new ParticleColourState[num_bodies];
-		m_masked = new bool[num_bodies];
+		m_removed = new bool[num_bodies];
+		m_capacity = num_bodies;
+
+		for (size_t i = 0; i < num_bodies; i++)
+			m_removed[i] = false;
 
-		for (auto i = 0; i < num_bodies; i++)
-			m_masked[i] = false;
+		// bodies start out in the order they are added
+		m_slot_of_id.resize(num_bodies);
+		std::iota(m_slot_of_id.begin(), m_slot_of_id.end(), 0);
+		m_id_of_slot = m_slot_of_id;
 
 		m_step = step;
 	}
@@ -4,7 +4,9 @@
 #include "Types.h"
 #include "Vector.h"
 
+#include <cstdint>
 #include <memory>
+#include <utility>
 #include <vector>
 
 namespace nbody
@@ -51,6 +53,24 @@ namespace nbody
 		}
 		} };
 
+	/**
+	 * \brief The quantities conserved by the equations of motion, for one state of the bodies.
+	 */
+	struct ConservedQuantities
+	{
+		// simulation time of the state, negative if none has been recorded yet
+		double time;
+		double kinetic; // J
+		double potential; // J
+		Vector2d momentum; // kg m s**-1
+		double angular_momentum; // about the origin, kg m**2 s**-1
+		Vector2d centre_mass; // m
+		double mass; // kg
+		// sums of the magnitudes of each body's momentum and angular momentum, to compare the totals with
+		double momentum_scale;
+		double angular_momentum_scale;
+	};
+
 	class IModel
 	{
 	public:
@@ -64,6 +84,56 @@ namespace nbody
 		void addBodies(IDistributor const& dist, std::unique_ptr<IColourer> col, BodyGroupProperties const& bgp);
 		void updateColours(Vector2d const* all);
 
+		/**
+		 * \brief Sort the bodies along a Morton (Z-order) curve so that bodies close in space are
+		 *		  close in memory. The model's own arrays are rearranged; the caller must apply the
+		 *		  returned order to any arrays it owns (see applyOrder).
+		 * \param state The current state vector, used to find body positions.
+		 * \return The permutation applied: the body now in slot i was previously in slot order[i].
+		 */
+		std::vector<size_t> sortBodies(Vector2d const* state);
+
+		/**
+		 * \brief Merge every group of bodies closer together than a distance into its most massive body,
+		 *		  which takes the group's total mass, centre of mass and momentum. The rest of the group are
+		 *		  removed (see removeBody).
+		 * \param state The current state vector, in which the remaining bodies are updated.
+		 * \param radius The distance, in m.
+		 * \param survivors Set to the slots of the bodies which took on a group.
+		 * \return The number of bodies removed.
+		 */
+		size_t mergeBodies(Vector2d * state, double const radius, std::vector<size_t> & survivors);
+
+		/**
+		 * \brief Add bodies after those already in the arrays, which grow as needed, giving them the next ids
+		 *		  in order. Only the model's arrays are changed: bodies are added to a running simulation with
+		 *		  IIntegrator::addBodies, which also adds them to its state.
+		 * \param colour The colour of the new bodies, which are not in any group so are not recoloured.
+		 * \return The id of the first body added.
+		 */
+		size_t insertBodies(ParticleState const* state, ParticleAuxState const* aux_state, sf::Color const colour, size_t const num);
+
+		/**
+		 * \brief Remove a body, leaving a tombstone in its slot until the arrays are next compacted.
+		 *		  The body loses its mass, so no longer pulls on the others, and is not drawn.
+		 * \param state The current state vector, used to take the body out of the centre of mass.
+		 */
+		void removeBody(size_t const id, Vector2d const* state);
+
+		/**
+		 * \brief Drop the tombstones from the arrays, so that the remaining bodies fill the first getNumBodies()
+		 *		  slots in the same order. Sorting the bodies drops them too. The caller must apply the returned
+		 *		  order to any arrays it owns (see applyOrder).
+		 * \return The order applied, as for sortBodies, or an empty vector if there were no tombstones.
+		 */
+		std::vector<size_t> compactBodies();
+
+		/**
+		 * \brief Whether more than one slot in s_COMPACT_RATIO holds a tombstone, so that compacting the
+		 *		  arrays would save more than it costs.
+		 */
+		bool shouldCompact() const;
+
 		virtual void eval(Vector2d * state, double time, Vector2d * deriv_in) = 0;
 		virtual BHTreeNode const* getTreeRoot() const = 0;
 
@@ -71,21 +141,66 @@ namespace nbody
 		
 		Vector2d getCentreMass() const;
 
+		/**
+		 * \brief Calculate the energy of a state directly, from every pair of bodies, in O(N^2) time.
+		 *		  The potential is softened consistently with the force.
+		 */
 		double getTotalEnergy(Vector2d const* all) const;
 
+		/**
+		 * \brief Record the conserved quantities of each state at this address that is passed to eval,
+		 *		  normally the integrator's own state vector, so that the intermediate stages of a step are
+		 *		  ignored. The potential energy is found alongside the forces, so costs little and is as
+		 *		  accurate as they are; the rest take one pass over the bodies. Null stops the recording.
+		 */
+		void trackConserved(Vector2d const* state);
+		bool isTracking(Vector2d const* state) const;
+
+		/**
+		 * \brief The conserved quantities of the tracked state when it was last evaluated.
+		 */
+		ConservedQuantities const& getConserved() const;
+
 		size_t getNumBodies() const;
+
+		/**
+		 * \brief Get the current array slot of a body. Bodies are numbered in the order they were added,
+		 *		  and this id does not change when the arrays are sorted or compacted.
+		 * \return The slot, or NO_SLOT if the body has been removed and the arrays compacted since.
+		 */
+		size_t getSlot(size_t const id) const;
+		size_t getId(size_t const slot) const;
+
+		/**
+		 * \brief Whether a body has been removed, directly or by merging it into another.
+		 */
+		bool isRemoved(size_t const id) const;
+		size_t getNumRemoved() const;
+		size_t getNumMerged() const;
+		// the number of slots holding tombstones
+		size_t getNumTombstones() const;
+		/**
+		 * \brief The number of ids given out, including those of removed bodies.
+		 */
+		size_t getNumIds() const;
+		// the number of bodies the arrays can hold before they must grow
+		size_t getCapacity() const;
 		size_t getDim() const;
 		void setDim(size_t const dim);
 
 		Vector2d * getInitialStateVector() const;
 		ParticleAuxState const* getAuxState() const;
 		ParticleColourState const* getColourState() const;
+		// whether the body in each slot is a tombstone
+		bool const* getRemoved() const;
+
+		static size_t constexpr s_COMPACT_RATIO = 8;
 
 	protected:
 		ParticleState * m_initial_state;
 		ParticleAuxState * m_aux_state;
 		ParticleColourState * m_colour_state;
-		bool * m_masked;
+		bool * m_removed;
 
 		double m_step;
 		size_t m_num_bodies;
@@ -94,14 +209,64 @@ namespace nbody
 		double m_tot_mass;
 		Vector2d m_centre_mass;
 
+		/**
+		 * \brief Called after the model's arrays have been sorted, to let derived models update any
+		 *		  data that depends on the position of bodies in the arrays.
+		 */
+		virtual void onReorder(std::vector<size_t> const& order);
+
+		/**
+		 * \brief Called after bodies have been added to the end of the arrays, which may have moved.
+		 */
+		virtual void onInsert();
+
+		/**
+		 * \brief Find every pair of bodies closer together than a distance, by sorting them along the x axis.
+		 *		  Models with a tree may search it instead.
+		 * \param pairs Appended with the slots of each pair, lower slot first.
+		 */
+		virtual void findClosePairs(Vector2d * state, double const radius, std::vector<std::pair<uint32_t, uint32_t>> & pairs);
+
+		/**
+		 * \brief Called by eval with the potential energy of the state it was given. If the state is the
+		 *		  tracked one, its other conserved quantities are summed and stored with it.
+		 */
+		void recordConserved(Vector2d const* state, double const time, double const potential);
+
 	private:
 		void resetDim(size_t num_bodies, double step);
 
+		/**
+		 * \brief Move the arrays into ones which can hold this many bodies.
+		 */
+		void reserve(size_t const capacity);
+
+		/**
+		 * \brief Mark the body in a slot as removed and take away its mass, leaving the totals alone.
+		 */
+		void tombstone(size_t const slot);
+
+		/**
+		 * \brief Apply an order, which may leave out tombstones, to the model's arrays and ids,
+		 *		  then tell the derived model.
+		 */
+		void reorderArrays(std::vector<size_t> const& order);
+
+		std::vector<size_t> m_slot_of_id;
+		std::vector<size_t> m_id_of_slot;
+		size_t m_capacity;
+		size_t m_num_removed;
+		size_t m_num_merged;
+		size_t m_num_tombstones;
+
 		bool m_has_tree;
 		size_t m_dim;
 		std::string m_name;
 
 		std::vector<std::unique_ptr<IColourer>> m_colourers;
+
+		Vector2d const* m_conserved_state;
+		ConservedQuantities m_conserved;
 	};
 }
 
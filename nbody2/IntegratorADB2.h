@@ -19,6 +19,10 @@ namespace nbody
 		Vector2d const* getStateVector() const override;
 
 	private:
+		void permute(std::vector<size_t> const& order) override;
+		void insert(ParticleState const* state, size_t const first, size_t const num) override;
+		void merge(std::vector<size_t> const& slots) override;
+
 		Vector2d * m_state;
 		Vector2d * m_f[2];
 	};
@@ -1,4 +1,5 @@
 #include "IntegratorADB6.h"
+#include "PerfCounters.h"
 
 #include <sstream>
 
@@ -36,20 +37,23 @@ namespace nbody
 
 	void IntegratorADB6::singleStep()
 	{
-		for (auto i = 0; i < m_dim; i++)
 		{
-			m_state[i] += m_step * (m_c[0] * m_f[5][i] +
-									m_c[1] * m_f[4][i] +
-									m_c[2] * m_f[3][i] +
-									m_c[3] * m_f[2][i] +
-									m_c[4] * m_f[1][i] +
-									m_c[5] * m_f[0][i] );
-
-			m_f[0][i] = m_f[1][i];
-			m_f[1][i] = m_f[2][i];
-			m_f[2][i] = m_f[3][i];
-			m_f[3][i] = m_f[4][i];
-			m_f[4][i] = m_f[5][i];
+			ScopedCounters counters{ CounterPhase::INTEGRATOR_UPDATE };
+			for (auto i = 0; i < m_dim; i++)
+			{
+				m_state[i] += m_step * (m_c[0] * m_f[5][i] +
+										m_c[1] * m_f[4][i] +
+										m_c[2] * m_f[3][i] +
+										m_c[3] * m_f[2][i] +
+										m_c[4] * m_f[1][i] +
+										m_c[5] * m_f[0][i] );
+
+				m_f[0][i] = m_f[1][i];
+				m_f[1][i] = m_f[2][i];
+				m_f[2][i] = m_f[3][i];
+				m_f[3][i] = m_f[4][i];
+				m_f[4][i] = m_f[5][i];
+			}
 		}
 
 		m_time += m_step;
@@ -123,4 +127,48 @@ namespace nbody
 	{
 		return m_state;
 	}
+
+	void IntegratorADB6::permute(std::vector<size_t> const& order)
+	{
+		applyOrder(reinterpret_cast<ParticleState *>(m_state), order);
+		for (auto i = 0; i < 6; i++)
+		{
+			applyOrder(reinterpret_cast<ParticleDerivState *>(m_f[i]), order);
+		}
+	}
+
+	void IntegratorADB6::insert(ParticleState const* state, size_t const first, size_t const num)
+	{
+		if (m_model->getCapacity() > m_capacity)
+		{
+			m_capacity = m_model->getCapacity();
+			reallocate(m_state, 2 * first, 2 * m_capacity);
+			for (auto i = 0; i < 6; i++)
+			{
+				reallocate(m_f[i], 2 * first, 2 * m_capacity);
+			}
+		}
+		std::copy(state, state + num, reinterpret_cast<ParticleState *>(m_state) + first);
+
+		// the new bodies change the current derivatives of every body, and have no history of their own,
+		// so their earlier derivatives are taken to be the same as the current ones
+		m_model->eval(m_state, m_time, m_f[5]);
+		for (auto i = 0; i < 5; i++)
+		{
+			std::copy(m_f[5] + 2 * first, m_f[5] + 2 * (first + num), m_f[i] + 2 * first);
+		}
+	}
+
+	void IntegratorADB6::merge(std::vector<size_t> const& slots)
+	{
+		// the earlier derivatives of the survivors still hold their velocities from before the merger
+		auto const bodies = reinterpret_cast<ParticleState const *>(m_state);
+		for (auto const slot : slots)
+		{
+			for (auto i = 0; i < 6; i++)
+			{
+				m_f[i][2 * slot] = bodies[slot].vel;
+			}
+		}
+	}
 }
\ No newline at end of file
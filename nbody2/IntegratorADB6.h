@@ -19,6 +19,10 @@ namespace nbody
 		Vector2d const* getStateVector() const override;
 
 	private:
+		void permute(std::vector<size_t> const& order) override;
+		void insert(ParticleState const* state, size_t const first, size_t const num) override;
+		void merge(std::vector<size_t> const& slots) override;
+
 		double static constexpr m_c[6] = { 4277.0 / 1440.0,
 										  -7923.0 / 1440.0,
 										   9982.0 / 1440.0,
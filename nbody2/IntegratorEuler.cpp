@@ -1,5 +1,6 @@
 #include "Error.h"
 #include "IntegratorEuler.h"
+#include "PerfCounters.h"
 #include "Vector.h"
 
 #include <sstream>
@@ -21,6 +22,7 @@ namespace nbody
 	IntegratorEuler::~IntegratorEuler()
 	{
 		delete[] m_state;
+		delete[] m_k1;
 	}
 
 	std::unique_ptr<IIntegrator> IntegratorEuler::create(IModel * model, double step)
@@ -32,6 +34,7 @@ namespace nbody
 	{
 		m_model->eval(m_state, m_time, m_k1);
 
+		ScopedCounters counters{ CounterPhase::INTEGRATOR_UPDATE };
 		for (size_t i = 0; i < m_dim; i++)
 			m_state[i] += m_step * m_k1[i];
 
@@ -51,4 +54,21 @@ namespace nbody
 	{
 		return m_state;
 	}
+
+	void IntegratorEuler::permute(std::vector<size_t> const& order)
+	{
+		// derivative arrays are recalculated every step, so only the state needs rearranging
+		applyOrder(reinterpret_cast<ParticleState *>(m_state), order);
+	}
+
+	void IntegratorEuler::insert(ParticleState const* state, size_t const first, size_t const num)
+	{
+		if (m_model->getCapacity() > m_capacity)
+		{
+			m_capacity = m_model->getCapacity();
+			reallocate(m_state, 2 * first, 2 * m_capacity);
+			reallocate(m_k1, 0, 2 * m_capacity);
+		}
+		std::copy(state, state + num, reinterpret_cast<ParticleState *>(m_state) + first);
+	}
 }
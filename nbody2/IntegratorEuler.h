@@ -20,6 +20,9 @@ namespace nbody
 		Vector2d const* getStateVector() const override;
 
 	private:
+		void permute(std::vector<size_t> const& order) override;
+		void insert(ParticleState const* state, size_t const first, size_t const num) override;
+
 		Vector2d * m_state, * m_k1;
 	};
 }
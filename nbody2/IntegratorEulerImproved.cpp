@@ -1,5 +1,6 @@
 #include "Error.h"
 #include "IntegratorEulerImproved.h"
+#include "PerfCounters.h"
 #include "Vector.h"
 
 #include <sstream>
@@ -40,11 +41,15 @@ namespace nbody
 	{
 		m_model->eval(m_state, m_time, m_k1);
 
-		for (size_t i = 0; i < m_dim; i++)
-			m_tmp[i] = m_state[i] + m_step * m_k1[i];
+		{
+			ScopedCounters counters{ CounterPhase::INTEGRATOR_UPDATE };
+			for (size_t i = 0; i < m_dim; i++)
+				m_tmp[i] = m_state[i] + m_step * m_k1[i];
+		}
 
 		m_model->eval(m_tmp, m_time + m_step, m_k2);
 
+		ScopedCounters counters{ CounterPhase::INTEGRATOR_UPDATE };
 		for (size_t i = 0; i < m_dim; i++)
 			m_state[i] += (m_step / 2.0) * (m_k1[i] + m_k2[i]);
 
@@ -64,4 +69,23 @@ namespace nbody
 	{
 		return m_state;
 	}
+
+	void IntegratorEulerImproved::permute(std::vector<size_t> const& order)
+	{
+		// derivative arrays are recalculated every step, so only the state needs rearranging
+		applyOrder(reinterpret_cast<ParticleState *>(m_state), order);
+	}
+
+	void IntegratorEulerImproved::insert(ParticleState const* state, size_t const first, size_t const num)
+	{
+		if (m_model->getCapacity() > m_capacity)
+		{
+			m_capacity = m_model->getCapacity();
+			reallocate(m_state, 2 * first, 2 * m_capacity);
+			reallocate(m_tmp, 0, 2 * m_capacity);
+			reallocate(m_k1, 0, 2 * m_capacity);
+			reallocate(m_k2, 0, 2 * m_capacity);
+		}
+		std::copy(state, state + num, reinterpret_cast<ParticleState *>(m_state) + first);
+	}
 }
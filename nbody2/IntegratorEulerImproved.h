@@ -18,6 +18,9 @@ namespace nbody
 		Vector2d const* getStateVector() const override;
 
 	private:
+		void permute(std::vector<size_t> const& order) override;
+		void insert(ParticleState const* state, size_t const first, size_t const num) override;
+
 		Vector2d * m_state, * m_tmp, * m_k1, * m_k2;
 	};
 }
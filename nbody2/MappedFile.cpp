@@ -0,0 +1,104 @@
+#include "MappedFile.h"
+#include "Error.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+
+namespace nbody
+{
+#ifdef _WIN32
+	MappedFile::MappedFile(std::string const & file_name)
+		: m_data(nullptr),
+		m_size(0),
+		m_file(INVALID_HANDLE_VALUE),
+		m_mapping(nullptr)
+	{
+		m_file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			throw MAKE_ERROR("Could not open file " + file_name);
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size))
+		{
+			CloseHandle(m_file);
+			throw MAKE_ERROR("Could not get the size of file " + file_name);
+		}
+		m_size = static_cast<size_t>(size.QuadPart);
+		// an empty file cannot be mapped
+		if (m_size == 0)
+			return;
+
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping)
+			m_data = static_cast<char const*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		if (!m_data)
+		{
+			if (m_mapping)
+				CloseHandle(m_mapping);
+			CloseHandle(m_file);
+			throw MAKE_ERROR("Could not map file " + file_name);
+		}
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+	}
+#else
+	MappedFile::MappedFile(std::string const & file_name)
+		: m_data(nullptr),
+		m_size(0),
+		m_fd(-1)
+	{
+		m_fd = open(file_name.c_str(), O_RDONLY);
+		if (m_fd < 0)
+			throw MAKE_ERROR("Could not open file " + file_name + ": " + std::strerror(errno));
+
+		struct stat st;
+		if (fstat(m_fd, &st) != 0)
+		{
+			close(m_fd);
+			throw MAKE_ERROR("Could not get the size of file " + file_name + ": " + std::strerror(errno));
+		}
+		m_size = static_cast<size_t>(st.st_size);
+		// an empty file cannot be mapped
+		if (m_size == 0)
+			return;
+
+		auto addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+		if (addr == MAP_FAILED)
+		{
+			close(m_fd);
+			throw MAKE_ERROR("Could not map file " + file_name + ": " + std::strerror(errno));
+		}
+		// the file is read from front to back by each thread
+		madvise(addr, m_size, MADV_SEQUENTIAL);
+		m_data = static_cast<char const*>(addr);
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (m_data)
+			munmap(const_cast<char*>(m_data), m_size);
+		if (m_fd >= 0)
+			close(m_fd);
+	}
+#endif
+}
@@ -0,0 +1,40 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+namespace nbody
+{
+	/**
+	 * \brief A read-only view of a whole file mapped into memory, so that large files can be read
+	 *		  in place, in parallel, without first being copied into a buffer.
+	 */
+	class MappedFile
+	{
+	public:
+		/**
+		 * \brief Map a file, throwing an Error if it cannot be opened.
+		 */
+		explicit MappedFile(std::string const& file_name);
+		~MappedFile();
+
+		MappedFile(MappedFile const&) = delete;
+		MappedFile& operator=(MappedFile const&) = delete;
+
+		char const* data() const { return m_data; }
+		size_t size() const { return m_size; }
+
+	private:
+		char const* m_data;
+		size_t m_size;
+#ifdef _WIN32
+		void * m_file;
+		void * m_mapping;
+#else
+		int m_fd;
+#endif
+	};
+}
+
+#endif // MAPPED_FILE_H
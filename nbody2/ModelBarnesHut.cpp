@@ -2,13 +2,11 @@
 #include "Constants.h"
 #include "IDistributor.h"
 #include "ModelBarnesHut.h"
-#include "Timings.h"
+#include "PerfCounters.h"
+#include "Profiler.h"
 #include "Types.h"
 
 #include <algorithm>
-
-#include <iostream>
-
 #include <numeric>
 
 namespace nbody
@@ -16,7 +14,12 @@ namespace nbody
 	ModelBarnesHut::ModelBarnesHut()
 		: IModel("Barnes-Hut N-body simulation", true),
 		m_root(m_bounds),
-		m_bounds({ 0, 0 }, 0)
+		m_bounds({ 0, 0 }, 0),
+		m_len_mult_fact(1),
+		m_ilist_reuse(0),
+		m_evals_since_build(0),
+		m_mixed_precision(false),
+		m_last_deriv(nullptr)
 	{
 	}
 
@@ -36,19 +39,34 @@ namespace nbody
 		auto state{ reinterpret_cast<ParticleState *>(state_in) };
 		auto deriv_state{ reinterpret_cast<ParticleDerivState *>(deriv_out) };
 		ParticleData all{ state, m_aux_state, deriv_state };
+		m_last_deriv = deriv_state;
+
+		auto use_cache = m_ilist_reuse > 1;
 
-		timings[Timings::TREE_BUILD_START] = Clock::now();
-		calcBounds(all);
-		buildTree(all);
-		timings[Timings::TREE_BUILD_END] = Clock::now();
+		{
+			ScopedZone zone{ Zone::TREE_BUILD };
+			ScopedCounters counters{ CounterPhase::TREE_BUILD };
+			if (!use_cache || m_evals_since_build == 0 || m_evals_since_build >= m_ilist_reuse)
+			{
+				calcBounds(all);
+				buildTree(all);
+				m_evals_since_build = 0;
+			}
+			else
+			{
+				// keep the tree and the cached interaction lists, just move the node moments
+				m_root.refit(all);
+			}
+			m_evals_since_build++;
+		}
 
-		timings[Timings::FORCE_CALC_START] = Clock::now();
-		m_root.calcForces();
+		ScopedZone zone{ Zone::FORCE_CALC };
+		m_root.calcForces(use_cache, m_mixed_precision);
 		for (auto i = 0; i < m_num_bodies; i++)
 		{
 			deriv_state[i].vel = state[i].vel;
 		}
-		timings[Timings::FORCE_CALC_END] = Clock::now();
+		recordConserved(state_in, time, BHTreeNode::getPotentialEnergy());
 	}
 
 	BHTreeNode const* ModelBarnesHut::getTreeRoot() const
@@ -56,17 +74,77 @@ namespace nbody
 		return &m_root;
 	}
 
+	void ModelBarnesHut::setInteractionListReuse(size_t const num_evals)
+	{
+		if (num_evals == m_ilist_reuse)
+			return;
+
+		m_ilist_reuse = num_evals;
+		// force a rebuild so that stale lists are never used
+		m_evals_since_build = 0;
+		BHTreeNode::resetCacheStats();
+	}
+
+	void ModelBarnesHut::onReorder(std::vector<size_t> const& order)
+	{
+		// the tree points into the arrays by position, so must be rebuilt rather than refitted
+		m_evals_since_build = 0;
+		m_last_deriv = nullptr;
+		BHTreeNode::permuteBodyCosts(order);
+	}
+
+	void ModelBarnesHut::onInsert()
+	{
+		// the new bodies are not in the tree yet
+		m_evals_since_build = 0;
+		m_last_deriv = nullptr;
+	}
+
+	void ModelBarnesHut::findClosePairs(Vector2d * state, double const radius, std::vector<std::pair<uint32_t, uint32_t>> & pairs)
+	{
+		// until the next evaluation, there is no tree to search
+		if (!m_last_deriv)
+		{
+			IModel::findClosePairs(state, radius, pairs);
+			return;
+		}
+
+		// the bodies have moved since the tree was built, but are still in the same slots,
+		// so its bounds only need bringing up to date; the tree is left fit for the next evaluation to reuse
+		{
+			ScopedZone zone{ Zone::TREE_BUILD };
+			m_root.refit({ reinterpret_cast<ParticleState *>(state), m_aux_state, m_last_deriv });
+		}
+		m_root.findClosePairs(radius, pairs);
+	}
+
+	size_t ModelBarnesHut::getInteractionListReuse() const
+	{
+		return m_ilist_reuse;
+	}
+
+	void ModelBarnesHut::setMixedPrecision(bool const mixed)
+	{
+		m_mixed_precision = mixed;
+	}
+
+	bool ModelBarnesHut::getMixedPrecision() const
+	{
+		return m_mixed_precision;
+	}
+
 	void ModelBarnesHut::calcBounds(ParticleData const & all)
 	{
-        auto static len_mult_fact = 1;
-        
         auto num = this->getNumBodies();
+		// every body has been removed, so the last bounds are as good as any
+		if (num == 0)
+			return;
+
         auto num_renegades = m_root.getNumRenegades();
         auto frac_renegade = static_cast<double>(num_renegades) / num;
-        std::cout << frac_renegade << std::endl;
         
         if(frac_renegade > 0.01)
-            len_mult_fact++;
+            m_len_mult_fact++;
             
         auto avg_dist = std::accumulate(&all.m_state[0].pos,
                                         &all.m_state[m_num_bodies - 1].pos,
@@ -79,12 +157,12 @@ namespace nbody
                                          
 		auto len = (*furthest - m_centre_mass).mag();*/
 		
-        m_bounds = Quad{ m_centre_mass, len_mult_fact * avg_dist };
+        m_bounds = Quad{ m_centre_mass, m_len_mult_fact * avg_dist };
 	}
 
 	void ModelBarnesHut::buildTree(ParticleData const & all)
 	{
-		m_root.reset(m_bounds);
+		m_root.reset(m_bounds, all, m_num_bodies);
 
 		for (size_t i = 0; i < m_num_bodies; i++)
 		{
@@ -35,12 +35,47 @@ namespace nbody
 		void eval(Vector2d * state_in, double time, Vector2d * deriv_out) override;
 		BHTreeNode const* getTreeRoot() const override;
 
+		/**
+		 * \brief Set how many force evaluations the tree and the interaction list of each critical cell
+		 *		  are reused for. In between full rebuilds the tree is only refitted to the new positions.
+		 * \param num_evals Number of evaluations per tree build. Zero or one disables caching.
+		 */
+		void setInteractionListReuse(size_t const num_evals);
+		size_t getInteractionListReuse() const;
+
+		/**
+		 * \brief Choose whether forces are evaluated with the mixed precision kernel, which computes
+		 *		  each interaction in single precision and sums them in double precision.
+		 *		  See BHTreeNode::calcCellAccelMixed for the accuracy this gives.
+		 */
+		void setMixedPrecision(bool const mixed);
+		bool getMixedPrecision() const;
+
+	protected:
+		void onReorder(std::vector<size_t> const& order) override;
+		void onInsert() override;
+
+		/**
+		 * \brief Refit the tree of the last evaluation to the given state and search it for the pairs
+		 *		  (see BHTreeNode::findClosePairs).
+		 */
+		void findClosePairs(Vector2d * state, double const radius, std::vector<std::pair<uint32_t, uint32_t>> & pairs) override;
+
 	private:
 		void calcBounds(ParticleData const& all);
 		void buildTree(ParticleData const& all);
 
 		BHTreeNode m_root;
 		Quad m_bounds;
+		// root node size in units of the mean distance of the bodies, grown while too many are outside it
+		int m_len_mult_fact;
+
+		size_t m_ilist_reuse;
+		size_t m_evals_since_build;
+		bool m_mixed_precision;
+		// derivatives of the last evaluation, which the tree points into, or null if the tree no longer
+		// matches the arrays
+		ParticleDerivState * m_last_deriv;
 	};
 }
 
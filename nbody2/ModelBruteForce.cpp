@@ -2,7 +2,7 @@
 #include "BodyGroupProperties.h"
 #include "Constants.h"
 #include "ModelBruteForce.h"
-#include "Timings.h"
+#include "Profiler.h"
 #include "Types.h"
 
 namespace nbody
@@ -50,17 +50,21 @@ namespace nbody
 		}
 
 		m_centre_mass = {};
+		auto potential = 0.0;
 
-		timings[Timings::FORCE_CALC_START] = Clock::now();
-#pragma omp parallel for schedule(static)
+		ScopedZone zone{ Zone::FORCE_CALC };
+#pragma omp parallel for schedule(static) reduction(+:potential)
 		for (auto i = 0; i < m_num_bodies; i++)
 		{
 			for (auto j = i + 1; j < m_num_bodies; j++)
 			{
 				auto rel_pos = state[j].pos - state[i].pos; // relative position vector r
-				auto rel_pos_mag_sq = rel_pos.mag_sq(); // |r|**2
-				rel_pos_mag_sq = std::max(rel_pos_mag_sq, Constants::SOFTENING * Constants::SOFTENING);
+				auto dist_sq = rel_pos.mag_sq();
+				auto rel_pos_mag_sq = std::max(dist_sq, Constants::SOFTENING * Constants::SOFTENING); // |r|**2
 				auto unit_vec = (1 / sqrt(rel_pos_mag_sq)) * rel_pos; // rhat = r/|r|
+				// -G m1 m2 / |r|, continued smoothly inside the softening length
+				potential -= Constants::G * m_aux_state[i].mass * m_aux_state[j].mass
+					* (1.5 * rel_pos_mag_sq - 0.5 * dist_sq) / (rel_pos_mag_sq * sqrt(rel_pos_mag_sq));
 				// F = (G m1 m2 / (|r|**2 + eps**2) * r_hat
 				// a = F / m1
 				deriv_state[i].acc += (Constants::G * m_aux_state[j].mass / rel_pos_mag_sq) * unit_vec;
@@ -70,12 +74,12 @@ namespace nbody
 				deriv_state[j].vel = state[j].vel;
 			}
 		}
-		timings[Timings::FORCE_CALC_END] = Clock::now();
 
 		for (size_t i = 0; i < m_num_bodies; i++)
 			m_centre_mass += state[i].pos * m_aux_state[i].mass;
 
 		m_centre_mass /= m_tot_mass;
+		recordConserved(state_in, time, potential);
 	}
 
 	BHTreeNode const* ModelBruteForce::getTreeRoot() const
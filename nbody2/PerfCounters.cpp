@@ -0,0 +1,292 @@
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+
+namespace nbody
+{
+	namespace
+	{
+		auto constexpr num_counters = static_cast<size_t>(Counter::NUM_COUNTERS);
+		auto constexpr num_phases = static_cast<size_t>(CounterPhase::NUM_PHASES);
+
+		std::array<char const*, num_phases> constexpr s_phase_names = { {
+			"Tree build",
+			"Tree walk",
+			"Force kernel",
+			"Integrator update"
+		} };
+
+		std::array<char const*, num_counters> constexpr s_counter_names = { {
+			"Cycles",
+			"Instructions",
+			"LLC misses",
+			"Branch misses"
+		} };
+
+		/**
+		 * \brief The counters which could be opened, found once by trying them on the first thread to ask.
+		 */
+		struct Support
+		{
+			std::array<bool, num_counters> valid;
+			bool any;
+			std::string reason;
+		};
+
+#ifdef __linux__
+		std::array<uint64_t, num_counters> constexpr s_configs = { {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES
+		} };
+
+		/**
+		 * \brief Open a counter of the calling thread's user-space events.
+		 * \param group_fd The group leader, or -1 to open a new group.
+		 * \return The file descriptor, or -1 with errno set.
+		 */
+		int openCounter(Counter const counter, int const group_fd)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = s_configs[static_cast<size_t>(counter)];
+			attr.read_format = PERF_FORMAT_GROUP;
+			// user-space only, which is permitted at the default perf_event_paranoid level
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+		}
+
+		Support probe()
+		{
+			Support s{};
+			auto leader = -1;
+			for (size_t c = 0; c < num_counters; c++)
+			{
+				auto fd = openCounter(static_cast<Counter>(c), leader);
+				if (fd < 0)
+				{
+					if (s.reason.empty())
+					{
+						s.reason = std::string(s_counter_names[c]) + ": " + std::strerror(errno);
+						if (errno == EACCES || errno == EPERM)
+							s.reason += " (check /proc/sys/kernel/perf_event_paranoid)";
+						else if (errno == ENOENT || errno == EOPNOTSUPP)
+							s.reason += " (no hardware counter support, e.g. in a virtual machine)";
+					}
+					continue;
+				}
+				s.valid[c] = true;
+				s.any = true;
+				if (leader < 0)
+					leader = fd;
+				else
+					close(fd);
+			}
+			if (leader >= 0)
+				close(leader);
+			return s;
+		}
+#else
+		Support probe()
+		{
+			Support s{};
+			s.reason = "Hardware counters are only supported on Linux";
+			return s;
+		}
+#endif
+
+		Support const& getSupport()
+		{
+			static Support const support = probe();
+			return support;
+		}
+	}
+
+	struct PerfCounters::ThreadCounters
+	{
+		ThreadCounters()
+		{
+			fds.fill(-1);
+			totals.fill({});
+#ifdef __linux__
+			auto const& support = getSupport();
+			auto leader = -1;
+			for (size_t c = 0; c < num_counters; c++)
+			{
+				if (!support.valid[c])
+					continue;
+				fds[c] = openCounter(static_cast<Counter>(c), leader);
+				if (fds[c] >= 0)
+				{
+					// values are read back in the order the counters joined the group
+					slot[c] = num_open++;
+					if (leader < 0)
+						leader = fds[c];
+				}
+			}
+			leader_fd = leader;
+#endif
+		}
+
+		/**
+		 * \brief Read every counter of the group at once. Unopened counters read as zero.
+		 */
+		bool read(std::array<uint64_t, num_counters>& out) const
+		{
+			out.fill(0);
+#ifdef __linux__
+			if (leader_fd < 0)
+				return false;
+
+			// PERF_FORMAT_GROUP layout: the number of counters, then their values
+			std::array<uint64_t, num_counters + 1> buf{};
+			auto const bytes = static_cast<ssize_t>((num_open + 1) * sizeof(uint64_t));
+			if (::read(leader_fd, buf.data(), bytes) != bytes)
+				return false;
+
+			for (size_t c = 0; c < num_counters; c++)
+			{
+				if (fds[c] >= 0)
+					out[c] = buf[1 + slot[c]];
+			}
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		int leader_fd = -1;
+		size_t num_open = 0;
+		std::array<int, num_counters> fds;
+		std::array<size_t, num_counters> slot{};
+		std::array<std::array<uint64_t, num_counters>, num_phases> totals;
+	};
+
+	std::array<std::atomic<PerfCounters::ThreadCounters *>, PerfCounters::s_MAX_THREADS> PerfCounters::s_threads{};
+	std::atomic<size_t> PerfCounters::s_num_threads{ 0 };
+	std::atomic<bool> PerfCounters::s_enabled{ false };
+	size_t constexpr PerfCounters::s_MAX_THREADS;
+
+	double CounterValues::ipc() const
+	{
+		if (!isValid(Counter::CYCLES) || !isValid(Counter::INSTRUCTIONS) || !(*this)[Counter::CYCLES])
+			return 0.0;
+		return static_cast<double>((*this)[Counter::INSTRUCTIONS]) / (*this)[Counter::CYCLES];
+	}
+
+	double CounterValues::perKiloInstruction(Counter const c) const
+	{
+		if (!isValid(c) || !isValid(Counter::INSTRUCTIONS) || !(*this)[Counter::INSTRUCTIONS])
+			return 0.0;
+		return 1000.0 * (*this)[c] / (*this)[Counter::INSTRUCTIONS];
+	}
+
+	void PerfCounters::setEnabled(bool const enabled)
+	{
+		s_enabled.store(enabled && isAvailable(), std::memory_order_relaxed);
+	}
+
+	bool PerfCounters::isEnabled()
+	{
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+
+	bool PerfCounters::isAvailable()
+	{
+		return getSupport().any;
+	}
+
+	std::string const& PerfCounters::getUnavailableReason()
+	{
+		return getSupport().reason;
+	}
+
+	PerfCounters::ThreadCounters * PerfCounters::getThreadCounters()
+	{
+		// runs once per thread, the first time it enters a phase with collection enabled
+		// the counters are leaked when the thread exits, so that its totals are kept
+		thread_local ThreadCounters * counters = []() -> ThreadCounters *
+		{
+			auto const slot = s_num_threads.fetch_add(1);
+			// beyond s_MAX_THREADS threads, counts are dropped
+			if (slot >= s_MAX_THREADS)
+				return nullptr;
+
+			auto new_counters = new ThreadCounters;
+			s_threads[slot].store(new_counters, std::memory_order_release);
+			return new_counters;
+		}();
+		return counters;
+	}
+
+	CounterTotals PerfCounters::takeTotals()
+	{
+		CounterTotals totals{};
+		auto const& support = getSupport();
+		for (auto& t : totals)
+			t.valid = support.valid;
+
+		for (auto const& slot : s_threads)
+		{
+			auto counters = slot.load(std::memory_order_acquire);
+			if (!counters)
+				continue;
+
+			for (size_t p = 0; p < num_phases; p++)
+			{
+				for (size_t c = 0; c < num_counters; c++)
+					totals[p].count[c] += counters->totals[p][c];
+				counters->totals[p].fill(0);
+			}
+		}
+		return totals;
+	}
+
+	char const* PerfCounters::getName(CounterPhase const phase)
+	{
+		return s_phase_names[static_cast<size_t>(phase)];
+	}
+
+	char const* PerfCounters::getName(Counter const counter)
+	{
+		return s_counter_names[static_cast<size_t>(counter)];
+	}
+
+	ScopedCounters::ScopedCounters(CounterPhase const phase)
+		: m_counters(nullptr),
+		m_phase(phase)
+	{
+		if (!PerfCounters::isEnabled())
+			return;
+
+		m_counters = PerfCounters::getThreadCounters();
+		if (m_counters && !m_counters->read(m_start))
+			m_counters = nullptr;
+	}
+
+	ScopedCounters::~ScopedCounters()
+	{
+		if (!m_counters)
+			return;
+
+		std::array<uint64_t, num_counters> end;
+		if (!m_counters->read(end))
+			return;
+
+		auto& totals = m_counters->totals[static_cast<size_t>(m_phase)];
+		for (size_t c = 0; c < num_counters; c++)
+			totals[c] += end[c] - m_start[c];
+	}
+}
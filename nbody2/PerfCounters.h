@@ -0,0 +1,122 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace nbody
+{
+	/**
+	 * \brief The hot phases around which hardware counters are collected.
+	 */
+	enum class CounterPhase : uint32_t
+	{
+		TREE_BUILD,
+		TREE_WALK,
+		FORCE_KERNEL,
+		INTEGRATOR_UPDATE,
+		NUM_PHASES
+	};
+
+	enum class Counter : uint32_t
+	{
+		CYCLES,
+		INSTRUCTIONS,
+		LLC_MISSES,
+		BRANCH_MISSES,
+		NUM_COUNTERS
+	};
+
+	/**
+	 * \brief Counts accumulated in one phase, summed over all threads.
+	 */
+	struct CounterValues
+	{
+		std::array<uint64_t, static_cast<size_t>(Counter::NUM_COUNTERS)> count;
+		// false if the counter could not be opened, in which case its count is zero
+		std::array<bool, static_cast<size_t>(Counter::NUM_COUNTERS)> valid;
+
+		uint64_t operator[](Counter const c) const { return count[static_cast<size_t>(c)]; }
+		bool isValid(Counter const c) const { return valid[static_cast<size_t>(c)]; }
+
+		/**
+		 * \brief Instructions per cycle, or zero if either is unavailable.
+		 */
+		double ipc() const;
+
+		/**
+		 * \brief Events of the given counter per thousand instructions, or zero if unavailable.
+		 */
+		double perKiloInstruction(Counter const c) const;
+	};
+
+	using CounterTotals = std::array<CounterValues, static_cast<size_t>(CounterPhase::NUM_PHASES)>;
+
+	/**
+	 * \brief Optional hardware performance counters (cycles, instructions, last-level cache misses and
+	 *		  branch misses), read with perf_event_open on Linux. Each thread opens its own counters the
+	 *		  first time it enters a phase while collection is enabled, and accumulates into its own totals.
+	 *		  Where the counters cannot be opened (other platforms, no PMU in a virtual machine, or
+	 *		  kernel.perf_event_paranoid too high) collection is a no-op and getUnavailableReason says why.
+	 *		  Totals may only be read (takeTotals) while no phases are running, e.g. between steps.
+	 */
+	class PerfCounters
+	{
+	public:
+		/**
+		 * \brief Enable or disable collection. Disabled by default, since reading the counters costs a
+		 *		  system call at the start and end of every phase.
+		 */
+		static void setEnabled(bool const enabled);
+		static bool isEnabled();
+
+		/**
+		 * \brief Whether counters can be opened on this system. Tries to open them on the calling thread.
+		 */
+		static bool isAvailable();
+		static std::string const& getUnavailableReason();
+
+		/**
+		 * \brief Sum the counts of every thread since the last call, and reset them.
+		 */
+		static CounterTotals takeTotals();
+
+		static char const* getName(CounterPhase const phase);
+		static char const* getName(Counter const counter);
+
+		static size_t constexpr s_MAX_THREADS = 256;
+
+	private:
+		friend class ScopedCounters;
+
+		struct ThreadCounters;
+
+		static ThreadCounters * getThreadCounters();
+
+		static std::array<std::atomic<ThreadCounters *>, s_MAX_THREADS> s_threads;
+		static std::atomic<size_t> s_num_threads;
+		static std::atomic<bool> s_enabled;
+	};
+
+	/**
+	 * \brief Adds the counts of the enclosing scope to a phase of the calling thread, if collection is enabled.
+	 */
+	class ScopedCounters
+	{
+	public:
+		explicit ScopedCounters(CounterPhase const phase);
+		~ScopedCounters();
+
+		ScopedCounters(ScopedCounters const&) = delete;
+		ScopedCounters& operator=(ScopedCounters const&) = delete;
+
+	private:
+		PerfCounters::ThreadCounters * m_counters;
+		CounterPhase const m_phase;
+		std::array<uint64_t, static_cast<size_t>(Counter::NUM_COUNTERS)> m_start;
+	};
+}
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,110 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace nbody
+{
+	/**
+	 * \brief Counter-based random number generator (Philox4x32-10, Salmon et al. 2011).
+	 *		  Each (seed, stream) pair is an independent sequence which is cheap to create, so every body
+	 *		  can be given its own stream and bodies can be generated in any order, or in parallel, with
+	 *		  identical results. The output is the same on every platform and standard library.
+	 */
+	class Philox
+	{
+	public:
+		/**
+		 * \param seed Selects the family of sequences, e.g. one per body group.
+		 * \param stream Selects the sequence within the family, e.g. the index of a body in its group.
+		 */
+		Philox(uint64_t const seed, uint64_t const stream)
+			: m_key{ { static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32) } },
+			m_ctr{ { 0, 0, static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32) } },
+			m_out{}, m_used(4)
+		{
+		}
+
+		/**
+		 * \brief Get the next 32 random bits.
+		 */
+		uint32_t next()
+		{
+			if (m_used == 4)
+			{
+				m_out = generate(m_ctr, m_key);
+				// 64-bit block counter in the low words, the stream in the high words
+				if (++m_ctr[0] == 0)
+					++m_ctr[1];
+				m_used = 0;
+			}
+			return m_out[m_used++];
+		}
+
+		/**
+		 * \brief Get a uniformly distributed value in [0, 1) with 53 random bits.
+		 */
+		double uniform()
+		{
+			auto const hi = next() >> 5;
+			auto const lo = next() >> 6;
+			return (hi * 67108864.0 + lo) * (1.0 / 9007199254740992.0);
+		}
+
+		/**
+		 * \brief Get a uniformly distributed value in [lower, upper).
+		 */
+		double uniform(double const lower, double const upper)
+		{
+			return lower + (upper - lower) * uniform();
+		}
+
+		/**
+		 * \brief Get a uniformly distributed integer in [lower, upper].
+		 */
+		int uniformInt(int const lower, int const upper)
+		{
+			auto const range = static_cast<double>(upper) - lower + 1;
+			return lower + static_cast<int>(uniform() * range);
+		}
+
+		/**
+		 * \brief Get an exponentially distributed value with rate lambda.
+		 */
+		double exponential(double const lambda)
+		{
+			return -std::log(1.0 - uniform()) / lambda;
+		}
+
+	private:
+		using Block = std::array<uint32_t, 4>;
+		using Key = std::array<uint32_t, 2>;
+
+		static Block generate(Block ctr, Key key)
+		{
+			for (auto r = 0; r < 10; r++)
+			{
+				auto const p0 = uint64_t{ 0xD2511F53 } * ctr[0];
+				auto const p1 = uint64_t{ 0xCD9E8D57 } * ctr[2];
+				ctr = { {
+					static_cast<uint32_t>(p1 >> 32) ^ ctr[1] ^ key[0],
+					static_cast<uint32_t>(p1),
+					static_cast<uint32_t>(p0 >> 32) ^ ctr[3] ^ key[1],
+					static_cast<uint32_t>(p0)
+				} };
+				key[0] += 0x9E3779B9;
+				key[1] += 0xBB67AE85;
+			}
+			return ctr;
+		}
+
+		Key m_key;
+		Block m_ctr;
+		Block m_out;
+		size_t m_used;
+	};
+}
+
+#endif // PHILOX_H
@@ -0,0 +1,170 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <vector>
+
+namespace nbody
+{
+	size_t constexpr Profiler::s_RING_SIZE;
+	size_t constexpr Profiler::s_MAX_THREADS;
+	size_t constexpr Profiler::s_STATS_WINDOW;
+
+	std::array<std::atomic<Profiler::ThreadLog *>, Profiler::s_MAX_THREADS> Profiler::s_logs{};
+	std::atomic<size_t> Profiler::s_num_logs{ 0 };
+	Clock::time_point const Profiler::s_epoch = Clock::now();
+
+	namespace
+	{
+		std::array<char const*, static_cast<size_t>(Zone::NUM_ZONES)> constexpr s_zone_names = { {
+			"Step",
+			"Tree construction",
+			"Force evaluation",
+			"Force thread",
+			"Sort bodies",
+			"Merge bodies",
+			"Colour bodies",
+			"Draw bodies",
+			"Draw grid",
+			"Draw trails",
+			"Render",
+			"Total energy calculation"
+		} };
+	}
+
+	Profiler::ThreadLog * Profiler::getThreadLog()
+	{
+		// runs once per thread, on its first zone
+		// the log is leaked when its thread exits, so that its zones remain in the trace
+		thread_local ThreadLog * log = []() -> ThreadLog *
+		{
+			auto const slot = s_num_logs.fetch_add(1);
+			// beyond s_MAX_THREADS threads, zones are dropped
+			if (slot >= s_MAX_THREADS)
+				return nullptr;
+
+			auto new_log = new ThreadLog;
+			s_logs[slot].store(new_log, std::memory_order_release);
+			return new_log;
+		}();
+		return log;
+	}
+
+	void Profiler::record(Zone const zone, Clock::time_point const start, Clock::time_point const end)
+	{
+		auto log = getThreadLog();
+		if (!log)
+			return;
+
+		auto const count = log->count.load(std::memory_order_relaxed);
+		auto& e = log->events[count & (s_RING_SIZE - 1)];
+		e.zone = zone;
+		e.start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(start - s_epoch).count();
+		e.end_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - s_epoch).count();
+		log->count.store(count + 1, std::memory_order_release);
+	}
+
+	ZoneStatsArray Profiler::getStats()
+	{
+		auto constexpr num_zones = static_cast<size_t>(Zone::NUM_ZONES);
+		std::array<std::vector<double>, num_zones> durations;
+		// the most recent occurrence of each zone on any thread
+		std::array<int64_t, num_zones> last_end;
+		last_end.fill(-1);
+		ZoneStatsArray stats{};
+
+		for (auto const& slot : s_logs)
+		{
+			auto log = slot.load(std::memory_order_acquire);
+			if (!log)
+				continue;
+
+			auto const count = log->count.load(std::memory_order_acquire);
+			auto const first = count > s_RING_SIZE ? count - s_RING_SIZE : 0;
+			std::array<size_t, num_zones> taken{};
+
+			// newest first, until each zone has a full window from this thread
+			for (auto i = count; i > first; i--)
+			{
+				auto const& e = log->events[(i - 1) & (s_RING_SIZE - 1)];
+				auto const z = static_cast<size_t>(e.zone);
+				if (taken[z] == s_STATS_WINDOW)
+					continue;
+				taken[z]++;
+
+				auto const ms = (e.end_ns - e.start_ns) * 1e-6;
+				durations[z].push_back(ms);
+				if (e.end_ns > last_end[z])
+				{
+					last_end[z] = e.end_ns;
+					stats[z].last = ms;
+				}
+			}
+		}
+
+		for (size_t z = 0; z < num_zones; z++)
+		{
+			auto& d = durations[z];
+			auto& s = stats[z];
+			s.count = d.size();
+			if (d.empty())
+				continue;
+
+			std::sort(d.begin(), d.end());
+			s.min = d.front();
+			s.p99 = d[static_cast<size_t>(0.99 * (d.size() - 1))];
+			auto sum = 0.0;
+			for (auto ms : d)
+				sum += ms;
+			s.mean = sum / d.size();
+		}
+		return stats;
+	}
+
+	void Profiler::writeTrace(std::ostream& out)
+	{
+		// timestamps are in microseconds
+		out << std::fixed << std::setprecision(3);
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+		auto first_event = true;
+		for (size_t t = 0; t < s_MAX_THREADS; t++)
+		{
+			auto log = s_logs[t].load(std::memory_order_acquire);
+			if (!log)
+				continue;
+
+			if (!first_event)
+				out << ",\n";
+			first_event = false;
+			out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t
+				<< ",\"args\":{\"name\":\"Thread " << t << "\"}}";
+
+			auto const count = log->count.load(std::memory_order_acquire);
+			auto const first = count > s_RING_SIZE ? count - s_RING_SIZE : 0;
+			for (auto i = first; i < count; i++)
+			{
+				auto const& e = log->events[i & (s_RING_SIZE - 1)];
+				out << ",\n{\"name\":\"" << getName(e.zone) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << t
+					<< ",\"ts\":" << e.start_ns * 1e-3 << ",\"dur\":" << (e.end_ns - e.start_ns) * 1e-3 << '}';
+			}
+		}
+
+		out << "\n]}\n";
+	}
+
+	void Profiler::clear()
+	{
+		for (auto const& slot : s_logs)
+		{
+			auto log = slot.load(std::memory_order_acquire);
+			if (log)
+				log->count.store(0, std::memory_order_release);
+		}
+	}
+
+	char const* Profiler::getName(Zone const zone)
+	{
+		return s_zone_names[static_cast<size_t>(zone)];
+	}
+}
@@ -0,0 +1,126 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "Timings.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+namespace nbody
+{
+	/**
+	 * \brief The phases of a step which are timed. Zones may nest, and FORCE_THREAD is recorded
+	 *		  once by every thread taking part in the force calculation.
+	 */
+	enum class Zone : uint32_t
+	{
+		STEP,
+		TREE_BUILD,
+		FORCE_CALC,
+		FORCE_THREAD,
+		REORDER,
+		MERGE,
+		COLOUR,
+		DRAW_BODIES,
+		DRAW_GRID,
+		DRAW_TRAILS,
+		RENDER,
+		ENERGY_CALC,
+		NUM_ZONES
+	};
+
+	/**
+	 * \brief Rolling statistics for one zone, in milliseconds.
+	 */
+	struct ZoneStats
+	{
+		size_t count;
+		double last;
+		double min;
+		double mean;
+		double p99;
+	};
+
+	using ZoneStatsArray = std::array<ZoneStats, static_cast<size_t>(Zone::NUM_ZONES)>;
+
+	/**
+	 * \brief Records when each zone starts and ends in a fixed-size ring buffer per thread.
+	 *		  Recording takes no locks and never allocates after a thread's first zone; only the most
+	 *		  recent s_RING_SIZE zones of each thread are kept.
+	 *		  The buffers may only be read (getStats, writeTrace) while no zones are being recorded,
+	 *		  e.g. from the main thread between steps.
+	 */
+	class Profiler
+	{
+	public:
+		/**
+		 * \brief Record a completed zone for the calling thread.
+		 */
+		static void record(Zone const zone, Clock::time_point const start, Clock::time_point const end);
+
+		/**
+		 * \brief Calculate the minimum, mean and 99th percentile duration of each zone over its
+		 *		  s_STATS_WINDOW most recent occurrences on each thread.
+		 */
+		static ZoneStatsArray getStats();
+
+		/**
+		 * \brief Write every recorded zone as a Chrome trace event file, which may be opened in
+		 *		  chrome://tracing or https://ui.perfetto.dev to see the phases of each thread on a timeline.
+		 */
+		static void writeTrace(std::ostream& out);
+
+		/**
+		 * \brief Forget every recorded zone.
+		 */
+		static void clear();
+
+		static char const* getName(Zone const zone);
+
+		static size_t constexpr s_RING_SIZE = 1 << 14;
+		static size_t constexpr s_MAX_THREADS = 256;
+		static size_t constexpr s_STATS_WINDOW = 128;
+
+	private:
+		struct Event
+		{
+			Zone zone;
+			int64_t start_ns;
+			int64_t end_ns;
+		};
+
+		struct ThreadLog
+		{
+			std::array<Event, s_RING_SIZE> events;
+			// total number of events recorded, including those since overwritten
+			std::atomic<uint64_t> count{ 0 };
+		};
+
+		static ThreadLog * getThreadLog();
+
+		static std::array<std::atomic<ThreadLog *>, s_MAX_THREADS> s_logs;
+		static std::atomic<size_t> s_num_logs;
+		static Clock::time_point const s_epoch;
+	};
+
+	/**
+	 * \brief Times the enclosing scope as one occurrence of a zone.
+	 */
+	class ScopedZone
+	{
+	public:
+		explicit ScopedZone(Zone const zone) : m_zone(zone), m_start(Clock::now()) {}
+		~ScopedZone() { Profiler::record(m_zone, m_start, Clock::now()); }
+
+		ScopedZone(ScopedZone const&) = delete;
+		ScopedZone& operator=(ScopedZone const&) = delete;
+
+	private:
+		Zone const m_zone;
+		Clock::time_point const m_start;
+	};
+}
+
+#endif // PROFILER_H
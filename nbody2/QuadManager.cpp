@@ -44,12 +44,17 @@ namespace nbody
 		auto half_length = screen_length / 2;
 		auto screen_x = Display::worldToScreenX(world_pos.x);
 		auto screen_y = Display::worldToScreenY(world_pos.y);
-		auto is_visible = (screen_length > 5)
-			&& (screen_x + half_length > 0)
+		auto on_screen = (screen_x + half_length > 0)
 			&& (screen_x - half_length < Display::screen_size.x)
 			&& (screen_y + half_length > 0)
 			&& (screen_y - half_length < Display::screen_size.y);
 
+		// daughters lie within their parent's square, so none of them can be on screen either
+		if (!on_screen)
+			return;
+
+		auto is_visible = screen_length > 5;
+
 		auto col{ (mode == GridDrawMode::COMPLETE) ? sf::Color::Green : sf::Color::Red };
 
 		// If complete grid is being drawn, then as long as the node is on screen it needs drawing
@@ -4,24 +4,50 @@
 #include "IState.h"
 #include "ModelBarnesHut.h"
 #include "RunState.h"
+#include "Profiler.h"
 #include "Sim.h"
-#include "Timings.h"
 
 #include "imgui.h"
 #include "imgui_sfml.h"
 
 #include <SFML/Graphics.hpp>
 
+#include <fstream>
+
 namespace nbody
 {
+	constexpr char const* RunState::s_TRACE_FILE;
+
+	namespace
+	{
+		/**
+		 * \brief Plot one quantity of each sample in a conservation history.
+		 */
+		void plotDrift(char const* label, std::vector<ConservationDrift> const& history, double ConservationDrift::* field)
+		{
+			struct Source
+			{
+				std::vector<ConservationDrift> const* history;
+				double ConservationDrift::* field;
+			} source{ &history, field };
+
+			float(*getter)(void*, int) = [](void* data, int i)
+			{
+				auto const& src = *static_cast<Source const*>(data);
+				return static_cast<float>((*src.history)[i].*src.field);
+			};
+			ImGui::PlotLines(label, getter, &source, static_cast<int>(history.size()), 0, nullptr, FLT_MAX, FLT_MAX, { 0.f, 50.f });
+		}
+	}
+
 	//void drawEllipse(double const a, double const b, double const angle);
 	//double eccentricity(double const r);
 
-	std::map<Timings, std::chrono::time_point<Clock>> timings;
-
 	RunState::RunState(Sim * simIn) :
 		m_highlighted(nullptr),
-		m_energy(0.0)
+		m_energy(0.0),
+		m_run_start(Clock::now()),
+		m_counters()
 	{
 		m_sim = simIn;
 		auto pos = sf::Vector2f(m_sim->m_window.getSize());
@@ -33,32 +59,60 @@ namespace nbody
 		m_flags.tree_exists = m_sim->m_mod_ptr->hasTree();
 
 		m_sim->m_mod_ptr->updateColours(m_sim->m_int_ptr->getStateVector());
-
-		timings[Timings::RUN_START] = Clock::now();
 	}
 
 	void RunState::update(sf::Time const dt)
 	{
 		if (m_flags.running)
 		{
-			m_sim->m_int_ptr->singleStep();
+			{
+				ScopedZone zone{ Zone::STEP };
+				m_sim->m_int_ptr->singleStep();
+			}
+			m_flags.tree_current = m_flags.tree_exists;
+			m_monitor.record(m_sim->m_mod_ptr->getConserved());
+			if (PerfCounters::isEnabled())
+				m_counters = PerfCounters::takeTotals();
+
+			if (m_sim->m_merge_radius > 0)
+			{
+				ScopedZone zone{ Zone::MERGE };
+				mergeBodies();
+			}
+
+			// sorting drops the tombstones too, so the arrays are only compacted in between
+			auto const interval = m_sim->m_reorder_interval;
+			if (interval && m_sim->m_int_ptr->getNumSteps() % interval == 0)
+			{
+				ScopedZone zone{ Zone::REORDER };
+				reorderBodies();
+			}
+			else if (m_sim->m_mod_ptr->shouldCompact())
+			{
+				ScopedZone zone{ Zone::REORDER };
+				compactBodies();
+			}
+
+			ScopedZone zone{ Zone::COLOUR };
 			m_sim->m_mod_ptr->updateColours(m_sim->m_int_ptr->getStateVector());
 		}
 
-		timings[Timings::DRAW_BODIES_START] = Clock::now();
 		if (m_flags.show_bodies)
 		{
+			ScopedZone zone{ Zone::DRAW_BODIES };
+			auto const cull_tree = m_flags.tree_current && m_flags.cull_with_tree ? m_sim->m_mod_ptr->getTreeRoot() : nullptr;
 			m_body_mgr.update(
 				m_sim->m_int_ptr->getStateVector(),
 				m_sim->m_mod_ptr->getAuxState(),
 				m_sim->m_mod_ptr->getColourState(),
-				m_sim->m_mod_ptr->getNumBodies());
+				m_sim->m_mod_ptr->getRemoved(),
+				m_sim->m_mod_ptr->getNumBodies(),
+				cull_tree);
 		}
-		timings[Timings::DRAW_BODIES_END] = Clock::now();
 
-		timings[Timings::DRAW_GRID_START] = Clock::now();
 		if (m_flags.tree_exists && m_flags.show_grid)
 		{
+			ScopedZone zone{ Zone::DRAW_GRID };
 			auto mouse_pos = sf::Mouse::getPosition(m_sim->m_window);
 			auto mouse_world = Vector2d{ Display::screenToWorldX(static_cast<float>(mouse_pos.x)), Display::screenToWorldY(static_cast<float>(mouse_pos.y)) };
 			m_highlighted = m_sim->m_mod_ptr->getTreeRoot()->getHovered(mouse_world);
@@ -76,16 +130,15 @@ namespace nbody
 		}
 		else
 			m_highlighted = nullptr;
-		timings[Timings::DRAW_GRID_END] = Clock::now();
 
-		timings[Timings::DRAW_TRAILS_START] = Clock::now();
 		if (m_flags.show_trails)
 		{
+			ScopedZone zone{ Zone::DRAW_TRAILS };
 			m_trail_mgr.update(
 				m_sim->m_int_ptr->getStateVector(),
+				m_sim->m_mod_ptr->getRemoved(),
 				m_sim->m_mod_ptr->getNumBodies());
 		}
-		timings[Timings::DRAW_TRAILS_END] = Clock::now();
 
 		using namespace ImGui;
 
@@ -108,17 +161,79 @@ namespace nbody
 			auto m_time_yrs = m_sim->m_int_ptr->getTime() / SECS_IN_YEAR;
 			Text("Simulation time: %.3g yrs", m_time_yrs);
 
-			auto elapsed = Clock::now() - timings[Timings::RUN_START];
+			auto elapsed = Clock::now() - m_run_start;
 			auto minutes = duration_cast<std::chrono::minutes>(elapsed);
 			auto seconds = duration_cast<std::chrono::seconds>(elapsed);
 			Text("Elapsed run time: %d:%.2zu", minutes.count(), seconds.count() % 60);
 			//AlignFirstTextHeightToWidgets();
-			Text("System energy: %.3g J", m_energy);
+			auto const& energy = m_sim->m_mod_ptr->getConserved();
+			if (energy.time >= 0)
+			{
+				Text("System energy: %.6g J", energy.kinetic + energy.potential);
+				if (IsItemHovered())
+					SetTooltip("Kinetic: %.6g J\nPotential: %.6g J\nAt time: %.4g s\n"
+						"Found with the forces each step, so as accurate as they are",
+						energy.kinetic, energy.potential, energy.time);
+			}
+			else
+				Text("System energy: not yet known");
 			SameLine();
-			if (SmallButton("Recalculate"))
+			if (SmallButton("Exact"))
 			{
 				m_energy = m_sim->m_mod_ptr->getTotalEnergy(m_sim->m_int_ptr->getStateVector());
 			}
+			if (IsItemHovered())
+				SetTooltip("Sum the energy over every pair of bodies, which is slow for many bodies");
+			if (m_energy != 0.0)
+			{
+				SameLine();
+				Text("%.6g J", m_energy);
+			}
+
+			auto interval = static_cast<int>(m_sim->m_reorder_interval);
+			PushItemWidth(100.f);
+			if (InputInt("Sort bodies in memory (steps)", &interval))
+				m_sim->m_reorder_interval = static_cast<size_t>(std::max(interval, 0));
+			if (InputDoubleScientific("Merge radius (m)", &m_sim->m_merge_radius))
+				m_sim->m_merge_radius = std::max(m_sim->m_merge_radius, 0.);
+			PopItemWidth();
+			Text("Bodies merged: %zu", m_sim->m_mod_ptr->getNumMerged());
+			Text("Bodies removed: %zu", m_sim->m_mod_ptr->getNumRemoved());
+			if (IsItemHovered())
+				SetTooltip("Including those merged. %zu of them are still in the arrays, until they are next compacted",
+					m_sim->m_mod_ptr->getNumTombstones());
+			Spacing();
+		}
+
+		if (CollapsingHeader("Conserved quantities"))
+		{
+			auto const& history = m_monitor.getHistory();
+			if (history.empty())
+				Text("Recorded from the next step");
+			else
+			{
+				auto const& d = m_monitor.getLatestDrift();
+				Text("Energy error: %+.3e", d.energy);
+				if (IsItemHovered())
+					SetTooltip("Change in the total energy, relative to the energy at the start");
+				plotDrift("##energy", history, &ConservationDrift::energy);
+				Text("Momentum error: %.3e", d.momentum);
+				if (IsItemHovered())
+					SetTooltip("Change in the total momentum, relative to the sum of the bodies' momenta at the start");
+				plotDrift("##momentum", history, &ConservationDrift::momentum);
+				Text("Angular momentum error: %+.3e", d.angular_momentum);
+				if (IsItemHovered())
+					SetTooltip("Change in the total angular momentum, relative to the sum of the bodies' angular momenta at the start");
+				plotDrift("##angular_momentum", history, &ConservationDrift::angular_momentum);
+				Text("Centre of mass drift: %.3e m", d.centre_mass);
+				if (IsItemHovered())
+					SetTooltip("Distance of the centre of mass from where its initial velocity would have carried it");
+				plotDrift("##centre_mass", history, &ConservationDrift::centre_mass);
+			}
+			if (Button("Restart from here"))
+				m_monitor.reset();
+			if (IsItemHovered())
+				SetTooltip("Measure the changes from the next step");
 			Spacing();
 		}
 
@@ -127,22 +242,80 @@ namespace nbody
 			using namespace std::chrono;
 
 			auto fps = 1000.f / dt.asMilliseconds();
-			auto t_tree = Dble_ms{ timings[Timings::TREE_BUILD_END] - timings[Timings::TREE_BUILD_START] };
-			auto t_eval = Dble_ms{ timings[Timings::FORCE_CALC_END] - timings[Timings::FORCE_CALC_START] };
-			auto t_body = Dble_ms{ timings[Timings::DRAW_BODIES_END] - timings[Timings::DRAW_BODIES_START] };
-			auto t_grid = Dble_ms{ timings[Timings::DRAW_GRID_END] - timings[Timings::DRAW_GRID_START] };
-			auto t_trail = Dble_ms{ timings[Timings::DRAW_TRAILS_END] - timings[Timings::DRAW_TRAILS_START] };
-			auto t_render = Dble_ms{ timings[Timings::RENDER_END] - timings[Timings::RENDER_START] };
-			auto t_energy = Dble_ms{ timings[Timings::ENERGY_CALC_END] - timings[Timings::ENERGY_CALC_START] };
-
 			Text("FPS: %f", fps);
-			Text("Tree construction: %f ms", t_tree.count());
-			Text("Force evaluation: %f ms", t_eval.count());
-			Text("Draw bodies: %f ms", t_body.count());
-			Text("Draw grid: %f ms", t_grid.count());
-			Text("Draw trails: %f ms", t_trail.count());
-			Text("Render: %f ms", t_render.count());
-			Text("Last total energy calculation: %f ms", t_energy.count());
+
+			// over the last Profiler::s_STATS_WINDOW occurrences of each phase
+			auto const stats = Profiler::getStats();
+			Columns(5, "timings", false);
+			// wide first column for the phase names, the rest split evenly
+			for (auto c = 1; c < 5; c++)
+				SetColumnOffset(c, 170.f + (c - 1) * 0.25f * (h_sz - 180.f));
+			Text("ms"); NextColumn();
+			Text("last"); NextColumn();
+			Text("min"); NextColumn();
+			Text("mean"); NextColumn();
+			Text("p99"); NextColumn();
+			for (size_t z = 0; z < stats.size(); z++)
+			{
+				auto const& s = stats[z];
+				if (!s.count)
+					continue;
+				Text("%s", Profiler::getName(static_cast<Zone>(z))); NextColumn();
+				Text("%.3f", s.last); NextColumn();
+				Text("%.3f", s.min); NextColumn();
+				Text("%.3f", s.mean); NextColumn();
+				Text("%.3f", s.p99); NextColumn();
+			}
+			Columns(1);
+
+			if (Button("Export timeline"))
+			{
+				std::ofstream file(s_TRACE_FILE);
+				if (file.is_open())
+					Profiler::writeTrace(file);
+			}
+			if (IsItemHovered())
+				SetTooltip("Write the recent phases of each thread to %s, which can be opened in chrome://tracing or ui.perfetto.dev", s_TRACE_FILE);
+			Spacing();
+		}
+
+		if (CollapsingHeader("Hardware counters"))
+		{
+			if (!PerfCounters::isAvailable())
+				TextWrapped("Unavailable: %s", PerfCounters::getUnavailableReason().c_str());
+			else
+			{
+				auto enabled = PerfCounters::isEnabled();
+				if (Checkbox("Collect counters", &enabled))
+					PerfCounters::setEnabled(enabled);
+				if (IsItemHovered())
+					SetTooltip("Count cycles, instructions, last-level cache misses and branch misses in each phase of a step, summed over all threads. Slows the force calculation slightly.");
+
+				if (enabled)
+				{
+					// per step, summed over all threads; misses are per thousand instructions
+					Columns(5, "counters", false);
+					for (auto c = 1; c < 5; c++)
+						SetColumnOffset(c, 130.f + (c - 1) * 0.25f * (h_sz - 140.f));
+					Text("per step"); NextColumn();
+					Text("Mcycles"); NextColumn();
+					Text("IPC"); NextColumn();
+					Text("LLC/ki"); NextColumn();
+					Text("branch/ki"); NextColumn();
+					for (size_t p = 0; p < m_counters.size(); p++)
+					{
+						auto const& v = m_counters[p];
+						Text("%s", PerfCounters::getName(static_cast<CounterPhase>(p))); NextColumn();
+						Text("%.3f", v[Counter::CYCLES] * 1e-6); NextColumn();
+						Text("%.2f", v.ipc()); NextColumn();
+						Text("%.2f", v.perKiloInstruction(Counter::LLC_MISSES)); NextColumn();
+						Text("%.2f", v.perKiloInstruction(Counter::BRANCH_MISSES)); NextColumn();
+					}
+					Columns(1);
+					if (!PerfCounters::getUnavailableReason().empty())
+						TextWrapped("Some counters unavailable: %s", PerfCounters::getUnavailableReason().c_str());
+				}
+			}
 			Spacing();
 		}
 
@@ -152,7 +325,7 @@ namespace nbody
 			{
 
 				auto mod_bh_tree = dynamic_cast<ModelBarnesHut *>(m_sim->m_mod_ptr.get());
-				auto stats = mod_bh_tree->getTreeRoot()->getStats();
+				auto const& stats = mod_bh_tree->getTreeRoot()->getStats();
 				auto num_bodies = m_sim->m_mod_ptr->getNumBodies();
 
 				Text("Force calculations: %zu", stats.m_num_calc);
@@ -162,6 +335,24 @@ namespace nbody
 				Text("Level of deepest node: %zu", stats.m_max_level);
 				Text("Particles in tree: %zu", stats.m_body_ct);
 				Text("Renegade particles: %zu", num_bodies - stats.m_body_ct);
+
+				auto reuse = static_cast<int>(mod_bh_tree->getInteractionListReuse());
+				PushItemWidth(100.f);
+				if (InputInt("Reuse interaction lists (evaluations)", &reuse))
+					mod_bh_tree->setInteractionListReuse(static_cast<size_t>(std::max(reuse, 0)));
+				PopItemWidth();
+				if (IsItemHovered())
+					SetTooltip("Forces are evaluated more than once a step by the improved Euler and Adams-Bashforth integrators");
+				if (reuse > 1)
+				{
+					auto hit_rate = stats.m_ilist_lookups ? 100. * stats.m_ilist_hits / stats.m_ilist_lookups : 0.;
+					Text("Cached list hit rate: %.1f%%", hit_rate);
+					// walks are timed in each thread and summed
+					Text("Last tree walk: %f ms CPU", stats.m_walk_ms);
+					Text("Walk CPU time saved: %f ms", stats.m_walk_saved_ms);
+				}
+				for (size_t t = 0; t < stats.m_thread_busy_ms.size(); t++)
+					Text("Thread %zu: %f ms busy, %f ms idle", t, stats.m_thread_busy_ms[t], stats.m_thread_idle_ms[t]);
 				Spacing();
 			}
 		}
@@ -203,56 +394,116 @@ namespace nbody
 			InputInt("Index", &idx);
 			if (idx < 0)
 				idx = 0;
-			if (idx >= m_sim->m_mod_ptr->getNumBodies())
-				idx = static_cast<int>(m_sim->m_mod_ptr->getNumBodies() - 1);
+			if (idx >= m_sim->m_mod_ptr->getNumIds())
+				idx = static_cast<int>(m_sim->m_mod_ptr->getNumIds() - 1);
+			// the index shown is the body's id, which stays the same when the arrays are sorted or compacted
+			if (m_sim->m_mod_ptr->isRemoved(idx))
+			{
+				SameLine();
+				TextDisabled("(removed)");
+			}
+			else
+			{
+				auto const slot = m_sim->m_mod_ptr->getSlot(idx);
+				pos = &state[slot].pos;
+				vel = &state[slot].vel;
+				mass = &aux_state[slot].mass;
+
+				// the tree no longer says where the body is until it is next built
+				// edits change the conserved quantities, so they are measured afresh
+				if (InputDoubleScientific2("Position", reinterpret_cast<double*>(pos)))
+				{
+					m_flags.tree_current = false;
+					m_monitor.reset();
+				}
+				SameLine();
+				auto start = GetCursorScreenPos();
+				Checkbox("Show", &draw_line);
 
-			pos = &state[idx].pos;
-			vel = &state[idx].vel;
-			mass = &aux_state[idx].mass;
+				if (draw_line)
+				{
+					auto draw_list = GetWindowDrawList();
+					auto end = Vector2f{ Display::worldToScreenX(pos->x), Display::worldToScreenY(pos->y) };
+					draw_list->PushClipRectFullScreen();
+					auto sz = 5.f * Display::bodyScalingFunc(Display::screen_scale);
+					auto tl = ImVec2{ end + Vector2f{ -sz, -sz } };
+					auto tr = ImVec2{ end + Vector2f{  sz, -sz } };
+					auto bl = ImVec2{ end + Vector2f{ -sz,  sz } };
+					auto br = ImVec2{ end + Vector2f{  sz,  sz } };
+					draw_list->AddQuad(tl, tr, br, bl, IM_COL32_WHITE);
+					draw_list->AddLine(start, tl, IM_COL32_WHITE);
+					draw_list->PopClipRect();
+				}
 
-			InputDoubleScientific2("Position", reinterpret_cast<double*>(pos));
-			SameLine();
-			auto start = GetCursorScreenPos();
-			Checkbox("Show", &draw_line);
+				if (InputDoubleScientific2("Velocity", reinterpret_cast<double*>(vel)))
+					m_monitor.reset();
 
-			if (draw_line)
-			{
-				auto draw_list = GetWindowDrawList();
-				auto end = Vector2f{ Display::worldToScreenX(pos->x), Display::worldToScreenY(pos->y) };
-				draw_list->PushClipRectFullScreen();
-				auto sz = 5.f * Display::bodyScalingFunc(Display::screen_scale);
-				auto tl = ImVec2{ end + Vector2f{ -sz, -sz } };
-				auto tr = ImVec2{ end + Vector2f{  sz, -sz } };
-				auto bl = ImVec2{ end + Vector2f{ -sz,  sz } };
-				auto br = ImVec2{ end + Vector2f{  sz,  sz } };
-				draw_list->AddQuad(tl, tr, br, bl, IM_COL32_WHITE);
-				draw_list->AddLine(start, tl, IM_COL32_WHITE);
-				draw_list->PopClipRect();
-			}
+				if (InputDoubleScientific("Mass", mass))
+				{
+					// need to update cached radius
+					m_body_mgr.setDirty();
+					m_monitor.reset();
+				}
 
-			InputDoubleScientific2("Velocity", reinterpret_cast<double*>(vel));
+				if (Button("Remove"))
+				{
+					// the body stays in the arrays as a tombstone until they are next compacted
+					m_sim->m_mod_ptr->removeBody(idx, m_sim->m_int_ptr->getStateVector());
+					m_body_mgr.setDirty();
+					m_monitor.reset();
+				}
+				SameLine();
+				if (Button("Energy"))
+				{
+					auto ke = 0.5 * (*mass) * vel->mag_sq();
+					auto pe = 0.0;
+					auto removed = m_sim->m_mod_ptr->getRemoved();
+					for (auto i = 0; i < m_sim->m_mod_ptr->getNumBodies(); i++)
+					{
+						// tombstones may sit on the body itself
+						if (i == slot || removed[i])
+							continue;
+						auto rel_pos_mag = (*pos - state[i].pos).mag();
+						pe += -aux_state[i].mass * (*mass) * Constants::G / rel_pos_mag;
+					}
+					energy = pe + ke;
+				}
+				SameLine();
+				Text("%.3g", energy);
+			}
+			Spacing();
+		}
 
-			if (InputDoubleScientific("Mass", mass))
+		if (CollapsingHeader("Rendering"))
+		{
+			auto mode = static_cast<int>(m_body_mgr.getRenderMode());
+			if (Combo("Bodies", &mode, "Automatic\0Circles\0Density\0"))
 			{
-				// need to update cached radius
-				m_body_mgr.setDirty();
+				m_body_mgr.setRenderMode(static_cast<BodyRenderMode>(mode));
 			}
-
-			if (Button("Energy"))
+			if (IsItemHovered())
 			{
-				auto ke = 0.5 * (*mass) * vel->mag_sq();
-				auto pe = 0.0;
-				for (auto i = 0; i < m_sim->m_mod_ptr->getNumBodies(); i++)
+				SetTooltip("Automatic draws the density of the bodies on screen when zoomed out");
+			}
+			auto density_colour = m_body_mgr.getDensityColour();
+			if (Checkbox("Colour density", &density_colour))
+			{
+				m_body_mgr.setDensityColour(density_colour);
+			}
+			Text("Drawing %s", m_body_mgr.isDrawingDensity() ? "density" : "circles");
+			if (m_flags.tree_exists)
+			{
+				auto cull = m_flags.cull_with_tree;
+				if (Checkbox("Cull with tree", &cull))
 				{
-					if (i == idx)
-						continue;
-					auto rel_pos_mag = (*pos - state[i].pos).mag();
-					pe += -aux_state[i].mass * (*mass) * Constants::G / rel_pos_mag;
+					m_flags.cull_with_tree = cull;
+				}
+				if (IsItemHovered())
+				{
+					SetTooltip("Skip the subtrees away from the screen rather than looking at every body");
 				}
-				energy = pe + ke;
 			}
-			SameLine();
-			Text("%.3g", energy);
+			Text("Bodies looked at: %zu", m_body_mgr.getNumExamined());
 			Spacing();
 		}
 
@@ -378,9 +629,46 @@ namespace nbody
 		return 0;
 	}*/
 
+	void RunState::reorderBodies()
+	{
+		onBodiesMoved(m_sim->m_int_ptr->reorder());
+	}
+
+	void RunState::compactBodies()
+	{
+		auto order = m_sim->m_int_ptr->compact();
+		if (!order.empty())
+			onBodiesMoved(order);
+	}
+
+	void RunState::onBodiesMoved(std::vector<size_t> const& order)
+	{
+		m_trail_mgr.permute(order);
+		// cached radii are stored by array slot
+		m_body_mgr.setDirty();
+		// the tree refers to bodies by array slot
+		m_flags.tree_current = false;
+	}
+
+	void RunState::mergeBodies()
+	{
+		std::vector<size_t> survivors;
+		if (m_sim->m_int_ptr->mergeBodies(m_sim->m_merge_radius, survivors) == 0)
+			return;
+
+		// the merged bodies are left as tombstones, which are not drawn
+		m_body_mgr.setDirty();
+		// each survivor jumps to its group's centre of mass, which its trail would join with a false segment
+		m_trail_mgr.restart(m_sim->m_int_ptr->getStateVector(), survivors);
+		// the tree's boxes no longer hold the survivors
+		m_flags.tree_current = false;
+		// mergers are inelastic, so drift is measured from the quantities after each one
+		m_monitor.rebase();
+	}
+
 	void RunState::draw(sf::Time const dt)
 	{
-		timings[Timings::RENDER_START] = Clock::now();
+		ScopedZone zone{ Zone::RENDER };
 		if (m_flags.view_centre)
 		{
 			auto com = m_sim->m_mod_ptr->getCentreMass();
@@ -408,7 +696,6 @@ namespace nbody
 		m_sim->m_window.setView(m_gui_view);
 
 		ImGui::Render();
-		timings[Timings::RENDER_END] = Clock::now();
 	}
 
 	void RunState::handleInput()
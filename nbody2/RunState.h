@@ -2,8 +2,11 @@
 #define RUN_STATE_H
 
 #include "BodyManager.h"
+#include "ConservationMonitor.h"
+#include "PerfCounters.h"
 #include "QuadManager.h"
 #include "IState.h"
+#include "Timings.h"
 #include "TrailManager.h"
 
 #include <SFML/Graphics.hpp>
@@ -19,7 +22,8 @@ namespace nbody
 			running(false),
 			show_bodies(true), show_trails(false), show_grid(false),
 			view_centre(true), view_dragging(false),
-			tree_exists(false), grid_mode_complete(true) {}
+			tree_exists(false), grid_mode_complete(true),
+			tree_current(false), cull_with_tree(true) {}
 
 		bool running : 1;
 
@@ -31,6 +35,9 @@ namespace nbody
 		bool view_dragging : 1;
 		bool tree_exists : 1;
 		bool grid_mode_complete : 1;
+		// whether the tree was built from the bodies as they are now laid out in memory
+		bool tree_current : 1;
+		bool cull_with_tree : 1;
 	};	
 
 	class RunState : public IState
@@ -43,6 +50,12 @@ namespace nbody
 		explicit RunState(Sim * sim);
 		virtual ~RunState() = default;
 	private:
+		void reorderBodies();
+		void compactBodies();
+		// update what is kept by array slot after the bodies have been sorted or compacted
+		void onBodiesMoved(std::vector<size_t> const& order);
+		void mergeBodies();
+
 		sf::View m_main_view;
 		sf::View m_gui_view;
 
@@ -54,6 +67,12 @@ namespace nbody
 		BHTreeNode const* m_highlighted;
 
 		double m_energy;
+		ConservationMonitor m_monitor;
+		Clock::time_point const m_run_start;
+		// hardware counter totals of the last step
+		CounterTotals m_counters;
+
+		static constexpr char const* s_TRACE_FILE = "nbody2_timeline.json";
 	};
 }
 
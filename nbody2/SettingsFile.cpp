@@ -0,0 +1,487 @@
+#include "BodyGroupProperties.h"
+#include "ByteOrder.h"
+#include "DistributorFile.h"
+#include "Error.h"
+#include "MappedFile.h"
+#include "SettingsFile.h"
+#include "Sim.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+namespace nbody
+{
+	char constexpr SettingsFile::s_MAGIC[8];
+	uint32_t constexpr SettingsFile::s_VERSION;
+
+	namespace
+	{
+		size_t constexpr s_HEADER_SIZE = 16;
+		size_t constexpr s_TAG_SIZE = 4;
+		// chunks start on multiples of this, so that embedded bodies are aligned in the mapped file
+		size_t constexpr s_ALIGN = 8;
+
+		char constexpr s_TAG_SIM[s_TAG_SIZE + 1] = "SIMP";
+		char constexpr s_TAG_GROUP[s_TAG_SIZE + 1] = "GRUP";
+		char constexpr s_TAG_PARTICLES[s_TAG_SIZE + 1] = "PART";
+		uint32_t constexpr s_SIM_VERSION = 2;
+		uint32_t constexpr s_GROUP_VERSION = 1;
+		uint32_t constexpr s_PARTICLES_VERSION = 1;
+
+		/**
+		 * \brief The format written before the chunked container, which is still read.
+		 *		  Each string (with its terminator) and value is followed by SEP, and values were written
+		 *		  as the bytes of the variable on a 64-bit little-endian machine.
+		 */
+		namespace legacy
+		{
+			char constexpr FILE_HEADER[] = "nb_settings";
+			// v7 has no particle file names, and v6 no seeds either
+			char constexpr VERSION[] = "v8";
+			char constexpr VERSION_NO_FILE[] = "v7";
+			char constexpr VERSION_NO_SEED[] = "v6";
+			char constexpr GLOBAL_HEADER[] = "global";
+			char constexpr ITEM_HEADER[] = "bgprop";
+			char constexpr SEP[] = "__";
+			// the fewest bytes a body group can take, used to reject corrupt group counts
+			size_t constexpr MIN_GROUP_SIZE = sizeof(ITEM_HEADER) + 4 + 4 + 16 + 16 + 8 + 1 + 8 + 8 + 1 + 8 + 4
+				+ 4 * MAX_COLS_PER_COLOURER + (12 + MAX_COLS_PER_COLOURER) * sizeof(SEP);
+		}
+
+		/**
+		 * \brief Appends little-endian fields to the payload of a chunk.
+		 */
+		class Writer
+		{
+		public:
+			template<typename T>
+			void write(T const value)
+			{
+				auto const pos = m_buf.size();
+				m_buf.resize(pos + sizeof(T));
+				byteorder::writeLE(value, &m_buf[pos]);
+			}
+
+			template<typename E>
+			void writeEnum(E const value)
+			{
+				write(static_cast<int32_t>(value));
+			}
+
+			void writeBool(bool const value)
+			{
+				write<uint8_t>(value ? 1 : 0);
+			}
+
+			void writeVector(Vector2d const& value)
+			{
+				write(value.x);
+				write(value.y);
+			}
+
+			void writeColour(sf::Color const& value)
+			{
+				m_buf.insert(m_buf.end(), { static_cast<char>(value.r), static_cast<char>(value.g),
+					static_cast<char>(value.b), static_cast<char>(value.a) });
+			}
+
+			void writeString(std::string const& value)
+			{
+				write(static_cast<uint32_t>(value.size()));
+				m_buf.insert(m_buf.end(), value.begin(), value.end());
+			}
+
+			std::vector<char> const& data() const { return m_buf; }
+
+		private:
+			std::vector<char> m_buf;
+		};
+
+		/**
+		 * \brief Reads little-endian fields from a range of bytes, throwing an Error if it runs past the end.
+		 */
+		class Reader
+		{
+		public:
+			Reader(char const* data, size_t const size, std::string const& what)
+				: m_pos(data), m_end(data + size), m_what(what) {}
+
+			template<typename T>
+			T read()
+			{
+				auto const value = byteorder::readLE<T>(take(sizeof(T)));
+				return value;
+			}
+
+			/**
+			 * \brief Read an enum, which must be INVALID or less than count.
+			 */
+			template<typename E>
+			E readEnum(E const count)
+			{
+				auto const value = read<int32_t>();
+				if (value < -1 || value >= static_cast<int32_t>(count))
+					throw MAKE_ERROR(m_what + " has an unknown option " + std::to_string(value));
+				return static_cast<E>(value);
+			}
+
+			bool readBool()
+			{
+				return read<uint8_t>() != 0;
+			}
+
+			Vector2d readVector()
+			{
+				Vector2d value;
+				value.x = read<double>();
+				value.y = read<double>();
+				return value;
+			}
+
+			sf::Color readColour()
+			{
+				auto const rgba = reinterpret_cast<unsigned char const*>(take(4));
+				return { rgba[0], rgba[1], rgba[2], rgba[3] };
+			}
+
+			std::string readString()
+			{
+				auto const size = read<uint32_t>();
+				return std::string(take(size), size);
+			}
+
+			/**
+			 * \brief Step over the next size bytes, returning where they start.
+			 */
+			char const* take(size_t const size)
+			{
+				if (static_cast<size_t>(m_end - m_pos) < size)
+					throw MAKE_ERROR(m_what + " is truncated");
+				auto const pos = m_pos;
+				m_pos += size;
+				return pos;
+			}
+
+			/**
+			 * \brief Check whether the next bytes match, and if so step over them.
+			 */
+			bool match(char const* bytes, size_t const size)
+			{
+				if (static_cast<size_t>(m_end - m_pos) < size || std::memcmp(m_pos, bytes, size))
+					return false;
+				m_pos += size;
+				return true;
+			}
+
+			void expect(char const* bytes, size_t const size)
+			{
+				if (!match(bytes, size))
+					throw MAKE_ERROR(m_what + " is malformed");
+			}
+
+			size_t remaining() const { return static_cast<size_t>(m_end - m_pos); }
+
+		private:
+			char const* m_pos;
+			char const* m_end;
+			std::string m_what;
+		};
+
+		size_t padding(size_t const size)
+		{
+			return (s_ALIGN - size % s_ALIGN) % s_ALIGN;
+		}
+
+		void writeChunk(std::ofstream & file, char const* tag, uint32_t const version, char const* payload, size_t const size)
+		{
+			char header[s_TAG_SIZE + 12];
+			std::memcpy(header, tag, s_TAG_SIZE);
+			byteorder::writeLE(version, header + 4);
+			byteorder::writeLE(static_cast<uint64_t>(size), header + 8);
+			char const zeros[s_ALIGN] = {};
+			file.write(header, sizeof(header));
+			file.write(payload, size);
+			file.write(zeros, padding(size));
+		}
+
+		/**
+		 * \brief Move a file over another, which is replaced if it exists.
+		 */
+		bool replaceFile(std::string const& from, std::string const& to)
+		{
+#ifdef _WIN32
+			return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+			return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+		}
+
+		void writeSim(Writer & out, SimProperties const& props)
+		{
+			out.write(props.timestep);
+			out.write(static_cast<uint64_t>(props.n_bodies));
+			out.writeEnum(props.int_type);
+			out.writeEnum(props.mod_type);
+			out.write(static_cast<uint64_t>(props.reorder_interval));
+			out.writeBool(props.mixed_precision);
+			out.write(props.merge_radius);
+		}
+
+		void readSim(Reader & in, uint32_t const version, SimProperties & props)
+		{
+			props.timestep = in.read<double>();
+			props.n_bodies = static_cast<size_t>(in.read<uint64_t>());
+			props.int_type = in.readEnum(IntegratorType::N_INTEGRATORS);
+			props.mod_type = in.readEnum(ModelType::N_MODELS);
+			props.reorder_interval = static_cast<size_t>(in.read<uint64_t>());
+			props.mixed_precision = in.readBool();
+			if (version >= 2)
+				props.merge_radius = in.read<double>();
+		}
+
+		void writeGroup(Writer & out, BodyGroupProperties const& bgp)
+		{
+			out.writeEnum(bgp.dist);
+			out.write(static_cast<int32_t>(bgp.num));
+			out.writeVector(bgp.pos);
+			out.writeVector(bgp.vel);
+			out.write(bgp.radius);
+			out.writeBool(bgp.use_parsecs);
+			out.write(bgp.min_mass);
+			out.write(bgp.max_mass);
+			out.writeBool(bgp.has_central_mass);
+			out.write(bgp.central_mass);
+			out.writeEnum(bgp.colour);
+			for (auto const& c : bgp.cols)
+				out.writeColour(c);
+			out.write(bgp.seed);
+			out.writeString(bgp.file_name);
+		}
+
+		void readGroup(Reader & in, BodyGroupProperties & bgp)
+		{
+			bgp.dist = in.readEnum(DistributorType::N_DISTRIBUTIONS);
+			bgp.num = in.read<int32_t>();
+			bgp.pos = in.readVector();
+			bgp.vel = in.readVector();
+			bgp.radius = in.read<double>();
+			bgp.use_parsecs = in.readBool();
+			bgp.min_mass = in.read<double>();
+			bgp.max_mass = in.read<double>();
+			bgp.has_central_mass = in.readBool();
+			bgp.central_mass = in.read<double>();
+			bgp.colour = in.readEnum(ColourerType::N_TYPES);
+			for (auto& c : bgp.cols)
+				c = in.readColour();
+			bgp.seed = in.read<uint32_t>();
+			bgp.file_name = in.readString();
+		}
+
+		bool isLegacy(MappedFile const& file)
+		{
+			return file.size() >= sizeof(legacy::FILE_HEADER)
+				&& !std::memcmp(file.data(), legacy::FILE_HEADER, sizeof(legacy::FILE_HEADER));
+		}
+
+		void loadLegacy(MappedFile const& file, std::string const& file_name, SimProperties & props)
+		{
+			using namespace legacy;
+			Reader in(file.data(), file.size(), "Settings file " + file_name);
+			auto expectString = [&in](char const* str, size_t const size)
+			{
+				in.expect(str, size);
+				in.expect(SEP, sizeof(SEP));
+			};
+			auto matchString = [&in](char const* str, size_t const size)
+			{
+				return in.match(str, size) && in.match(SEP, sizeof(SEP));
+			};
+			// values are read with the sizes they had when written, whatever the variables' sizes now
+			auto readValue = [&in](auto tag) -> decltype(tag)
+			{
+				auto const value = in.read<decltype(tag)>();
+				in.expect(SEP, sizeof(SEP));
+				return value;
+			};
+			auto readEnum = [&in](auto count) -> decltype(count)
+			{
+				auto const value = in.readEnum(count);
+				in.expect(SEP, sizeof(SEP));
+				return value;
+			};
+			auto readVector = [&in]()
+			{
+				auto const value = in.readVector();
+				in.expect(SEP, sizeof(SEP));
+				return value;
+			};
+
+			expectString(FILE_HEADER, sizeof(FILE_HEADER));
+			// files from before seeds were saved are still read, and each group given a new seed
+			auto const has_file = matchString(VERSION, sizeof(VERSION));
+			auto const has_seed = has_file || matchString(VERSION_NO_FILE, sizeof(VERSION_NO_FILE));
+			if (!has_seed)
+				expectString(VERSION_NO_SEED, sizeof(VERSION_NO_SEED));
+			expectString(GLOBAL_HEADER, sizeof(GLOBAL_HEADER));
+
+			props.timestep = readValue(double());
+			props.n_bodies = static_cast<size_t>(readValue(uint64_t()));
+			props.int_type = readEnum(IntegratorType::N_INTEGRATORS);
+			props.mod_type = readEnum(ModelType::N_MODELS);
+			auto const n_groups = readValue(uint64_t());
+			if (n_groups > in.remaining() / MIN_GROUP_SIZE)
+				throw MAKE_ERROR("Settings file " + file_name + " is malformed");
+
+			props.bg_props.assign(static_cast<size_t>(n_groups), BodyGroupProperties());
+			for (auto& bgp : props.bg_props)
+			{
+				expectString(ITEM_HEADER, sizeof(ITEM_HEADER));
+				bgp.dist = readEnum(DistributorType::N_DISTRIBUTIONS);
+				bgp.num = readValue(int32_t());
+				bgp.pos = readVector();
+				bgp.vel = readVector();
+				bgp.radius = readValue(double());
+				bgp.use_parsecs = readValue(uint8_t()) != 0;
+				bgp.min_mass = readValue(double());
+				bgp.max_mass = readValue(double());
+				bgp.has_central_mass = readValue(uint8_t()) != 0;
+				bgp.central_mass = readValue(double());
+				bgp.colour = readEnum(ColourerType::N_TYPES);
+				for (auto& c : bgp.cols)
+				{
+					c = in.readColour();
+					in.expect(SEP, sizeof(SEP));
+				}
+				// each group needs its own seed, not that of the prototype the groups were copied from
+				if (has_seed)
+					bgp.seed = readValue(uint32_t());
+				else
+					bgp.seed = IDistributor::randomSeed();
+				if (has_file)
+				{
+					auto const size = readValue(uint32_t());
+					bgp.file_name.assign(in.take(size), size);
+					in.expect(SEP, sizeof(SEP));
+				}
+			}
+		}
+	}
+
+	void SettingsFile::save(std::string const & file_name, SimProperties const & props)
+	{
+		// embedded bodies may still be mapped from the file being replaced, so the new file is written
+		// beside it and only then moved over it, which also leaves it as it was if the save fails
+		auto const temp_name = file_name + ".tmp";
+		try
+		{
+			std::ofstream file;
+			file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+			file.open(temp_name, std::ios::binary);
+
+			char header[s_HEADER_SIZE] = {};
+			std::memcpy(header, s_MAGIC, sizeof(s_MAGIC));
+			byteorder::writeLE(s_VERSION, header + 8);
+			file.write(header, sizeof(header));
+
+			Writer sim;
+			writeSim(sim, props);
+			writeChunk(file, s_TAG_SIM, s_SIM_VERSION, sim.data().data(), sim.data().size());
+
+			for (auto const& bgp : props.bg_props)
+			{
+				Writer group;
+				writeGroup(group, bgp);
+				writeChunk(file, s_TAG_GROUP, s_GROUP_VERSION, group.data().data(), group.data().size());
+				if (bgp.embedded)
+					writeChunk(file, s_TAG_PARTICLES, s_PARTICLES_VERSION, bgp.embedded->data, bgp.embedded->size);
+			}
+			file.close();
+		}
+		catch (std::ofstream::failure const& fail)
+		{
+			std::remove(temp_name.c_str());
+			throw MAKE_ERROR("Could not write settings file " + file_name + ": " + fail.what());
+		}
+
+		if (!replaceFile(temp_name, file_name))
+		{
+			std::remove(temp_name.c_str());
+			throw MAKE_ERROR("Could not replace settings file " + file_name);
+		}
+	}
+
+	void SettingsFile::load(std::string const & file_name, SimProperties & props)
+	{
+		auto const file = std::make_shared<MappedFile const>(file_name);
+		// read into a copy, so that nothing changes if the file is bad
+		auto result = props;
+
+		if (isLegacy(*file))
+		{
+			loadLegacy(*file, file_name, result);
+			props = std::move(result);
+			return;
+		}
+
+		Reader in(file->data(), file->size(), "Settings file " + file_name);
+		if (!in.match(s_MAGIC, sizeof(s_MAGIC)))
+			throw MAKE_ERROR("File " + file_name + " is not a settings file");
+		auto const version = in.read<uint32_t>();
+		if (version > s_VERSION)
+			throw MAKE_ERROR("Settings file " + file_name + " has version " + std::to_string(version)
+				+ ", but only up to " + std::to_string(s_VERSION) + " can be read");
+		in.take(4);
+
+		auto has_sim = false;
+		result.bg_props.clear();
+		while (in.remaining() > 0)
+		{
+			auto const tag = std::string(in.take(s_TAG_SIZE), s_TAG_SIZE);
+			// later chunk versions only append fields, which are left unread
+			auto const chunk_version = in.read<uint32_t>();
+			auto const size = in.read<uint64_t>();
+			if (size > in.remaining())
+				throw MAKE_ERROR("Settings file " + file_name + " is truncated");
+			auto const payload = in.take(static_cast<size_t>(size));
+			in.take(std::min(padding(static_cast<size_t>(size)), in.remaining()));
+
+			Reader chunk(payload, static_cast<size_t>(size), "Chunk " + tag + " of settings file " + file_name);
+			if (tag == s_TAG_SIM)
+			{
+				readSim(chunk, chunk_version, result);
+				has_sim = true;
+			}
+			else if (tag == s_TAG_GROUP)
+			{
+				result.bg_props.emplace_back();
+				readGroup(chunk, result.bg_props.back());
+			}
+			else if (tag == s_TAG_PARTICLES)
+			{
+				if (result.bg_props.empty())
+					throw MAKE_ERROR("Settings file " + file_name + " has bodies before any body group");
+				auto image = std::make_shared<ParticleImage>();
+				image->data = payload;
+				image->size = static_cast<size_t>(size);
+				image->mapping = file;
+				auto& bgp = result.bg_props.back();
+				bgp.num = static_cast<int>(DistributorFile::countBodies(*image));
+				bgp.embedded = std::move(image);
+			}
+		}
+
+		if (!has_sim)
+			throw MAKE_ERROR("Settings file " + file_name + " has no simulation properties");
+		props = std::move(result);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef SETTINGS_FILE_H
+#define SETTINGS_FILE_H
+
+#include <cstdint>
+#include <string>
+
+namespace nbody
+{
+	// forward declaration
+	struct SimProperties;
+
+	/**
+	 * \brief Reads and writes the settings files (.dat) saved from the start menu.
+	 *		  A file is the 8 bytes of s_MAGIC, a uint32 container version and 4 reserved bytes, followed by
+	 *		  chunks. Each chunk is a 4 character tag, a uint32 chunk version, a uint64 payload size, the
+	 *		  payload and zero padding to a multiple of 8 bytes. Every number is little-endian, bools are
+	 *		  one byte, enums are int32, colours are rgba bytes and strings are a uint32 length followed by
+	 *		  the characters. The chunks are:
+	 *		  - SIMP: the simulation-wide properties
+	 *		  - GRUP: the properties of one body group, in order
+	 *		  - PART: the bodies of the preceding group, as a binary particle file (see DistributorFile)
+	 *		  Chunks with unknown tags, and fields appended to a chunk by later versions, are skipped,
+	 *		  so that older builds can read newer files.
+	 *		  Files are memory mapped when loaded, and embedded bodies are read in place from the mapping
+	 *		  when the simulation starts. Files in the previous format (v6 to v8) are still read.
+	 */
+	class SettingsFile
+	{
+	public:
+		/**
+		 * \brief Write the properties, with the bodies of every group which has them embedded.
+		 *		  Throws an Error if the file cannot be written, in which case any existing file is unchanged.
+		 *		  The file may be the one the properties were loaded from, even with its bodies embedded.
+		 */
+		static void save(std::string const& file_name, SimProperties const& props);
+
+		/**
+		 * \brief Read the properties from a file, throwing an Error if it cannot be read,
+		 *		  in which case props is left unchanged. Properties not in the file keep their values.
+		 */
+		static void load(std::string const& file_name, SimProperties & props);
+
+		static char constexpr s_MAGIC[8] = "NB2SETS";
+		static uint32_t constexpr s_VERSION = 1;
+	};
+}
+
+#endif // SETTINGS_FILE_H
@@ -1,6 +1,7 @@
 #include "BodyGroupProperties.h"
 #include "Display.h"
 #include "IState.h"
+#include "ModelBarnesHut.h"
 #include "Sim.h"
 
 #include "imgui_sfml.h"
@@ -104,15 +105,22 @@ namespace nbody
 	void Sim::setProperties(SimProperties const& props)
 	{
 		m_step = props.timestep;
+		m_reorder_interval = props.reorder_interval;
+		m_merge_radius = props.merge_radius;
 		m_mod_ptr = m_asset_mgr.getModel(props.mod_type);
 		m_mod_ptr->init(props.n_bodies, props.timestep);
 
+		if (auto mod_bh_tree = dynamic_cast<ModelBarnesHut *>(m_mod_ptr.get()))
+			mod_bh_tree->setMixedPrecision(props.mixed_precision);
+
 		m_int_ptr = m_asset_mgr.getIntegrator(props.int_type, m_mod_ptr.get(), m_step);
+		m_mod_ptr->trackConserved(m_int_ptr->getStateVector());
 
 		for (auto& bgp : props.bg_props)
 		{
 			auto col = m_asset_mgr.getColourer(bgp.colour);
-			auto dist = m_asset_mgr.getDistributor(bgp.dist);
+			// embedded bodies are read like a particle file
+			auto dist = m_asset_mgr.getDistributor(bgp.embedded ? DistributorType::FROM_FILE : bgp.dist);
 			m_mod_ptr->addBodies(*dist, std::move(col), bgp);
 		}
 
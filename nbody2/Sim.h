@@ -43,7 +43,10 @@ namespace nbody
 			int_type(IntegratorType::INVALID),
 			mod_type(ModelType::INVALID),
 			bg_props(),
-			n_bodies(0)
+			n_bodies(0),
+			reorder_interval(50),
+			mixed_precision(false),
+			merge_radius(0.)
 			{}
 
 		double timestep;
@@ -51,6 +54,9 @@ namespace nbody
 		ModelType mod_type;
 		std::vector<BodyGroupProperties> bg_props;
 		size_t n_bodies;
+		size_t reorder_interval; // Steps between sorting the bodies for memory locality, or 0 for never
+		bool mixed_precision; // Evaluate Barnes-Hut forces in single precision, summed in double precision
+		double merge_radius; // Bodies closer together than this are merged after each step, or 0 for never
 	};
 
 	enum class PendingStateOp
@@ -94,6 +100,8 @@ namespace nbody
 		std::unique_ptr<IIntegrator> m_int_ptr;
 		std::unique_ptr<IModel> m_mod_ptr;
 		double m_step;
+		size_t m_reorder_interval;
+		double m_merge_radius;
 
 		sf::RenderWindow m_window;	
 		sf::Sprite m_background;
@@ -1,5 +1,7 @@
 #include "Config.h"
+#include "DistributorFile.h"
 #include "Error.h"
+#include "SettingsFile.h"
 #include "StartState.h"
 #include "RunState.h"
 #include "IState.h"
@@ -10,11 +12,31 @@
 #include <SFML/Graphics.hpp>
 
 #include <algorithm>
-#include <fstream>
 #include <numeric>
 
 namespace nbody
 {
+	namespace
+	{
+		// if a file extension was supplied, trim it and append '.dat' instead
+		std::string withExtension(char const* filename)
+		{
+			std::string fn_str(filename);
+			auto pos = fn_str.find_last_of('.');
+			if (pos != std::string::npos)
+			{
+				fn_str.erase(pos);
+			}
+			return fn_str.append(".dat");
+		}
+
+		// whether a group's bodies are read, from a particle file or the settings file, rather than generated
+		bool readsBodies(BodyGroupProperties const& bgp)
+		{
+			return bgp.embedded || bgp.dist == DistributorType::FROM_FILE;
+		}
+	}
+
 	StartState::StartState(Sim * simIn)
 		: m_l1_modal_open(false),
 		m_l2_modal_open(false),
@@ -130,12 +152,31 @@ namespace nbody
 		*/
 		for (auto const& bgp : m_bg_props)
 		{
+			if (bgp.dist == DistributorType::FROM_FILE && !bgp.embedded)
+			{
+				// the file may have changed since it was loaded
+				try
+				{
+					auto n_file = DistributorFile::countBodies(bgp.file_name);
+					if (n_file == 0 || n_file != static_cast<size_t>(bgp.num))
+					{
+						result_message = "Particle file " + bgp.file_name + " holds " + std::to_string(n_file)
+							+ " bodies, load it again";
+						return false;
+					}
+				}
+				catch (Error const& e)
+				{
+					result_message = e.what();
+					return false;
+				}
+			}
 			if (bgp.num == 0)
 			{
 				result_message = "Every group must contain at least one body";
 				return false;
 			}
-			if (bgp.radius == 0.0)
+			if (bgp.radius == 0.0 && !readsBodies(bgp))
 			{
 				result_message = "Every group must have a non-zero radius";
 				return false;
@@ -281,25 +322,41 @@ namespace nbody
 				// Number label
 				Text("Group %zu", i + 1);
 
-				// Number of bodies slider
+				// Number of bodies slider, or the embedded bodies or particle file which set the number
 				SameLine();
 				PushItemWidth(0.5f * GetContentRegionAvailWidth());
-				SliderInt("Number of bodies", &(m_bg_props[i].num), 0, Constants::MAX_N);
+				if (m_bg_props[i].embedded)
+					makeEmbeddedInput(i);
+				else if (m_bg_props[i].dist == DistributorType::FROM_FILE)
+					makeFileInput(i);
+				else
+					SliderInt("Number of bodies", &(m_bg_props[i].num), 0, Constants::MAX_N);
 				PopItemWidth();
 				auto n_total = std::accumulate(m_bg_props.cbegin(), m_bg_props.cend(), 0, [](auto sum, auto const& b) -> int { return sum + b.num; });
 				m_sim_props.n_bodies = n_total;
-				// too many bodies, need to redistribute them
-				if (n_total > Constants::MAX_N)
+				// too many generated bodies, need to redistribute them
+				// bodies read from files are not limited
+				auto n_generated = std::accumulate(m_bg_props.cbegin(), m_bg_props.cend(), 0, [](auto sum, auto const& b) -> int
+				{
+					return readsBodies(b) ? sum : sum + b.num;
+				});
+				if (n_generated > Constants::MAX_N && !readsBodies(m_bg_props[i]))
 				{
 					// if too many, steal from previous, except if first, then steal from last
 					// if more need to be stolen than are available, move to next
-					auto n_excess = n_total - static_cast<int>(Constants::MAX_N);
+					auto n_excess = n_generated - static_cast<int>(Constants::MAX_N);
 					size_t j = 1;
 					while (n_excess > 0)
 					{
 						// how many are available to steal?
 						// take as reference so we can modify it
-						auto& subtractable = m_bg_props[(i + j) % (m_bg_props.size())].num;
+						auto& group = m_bg_props[(i + j) % (m_bg_props.size())];
+						if (readsBodies(group))
+						{
+							j++;
+							continue;
+						}
+						auto& subtractable = group.num;
 						if (n_excess < subtractable)
 						{
 							// can steal required from this
@@ -322,10 +379,20 @@ namespace nbody
 				SameLine();
 				PushItemWidth(GetContentRegionAvailWidth() - CalcTextSize("Distribution").x);
 				auto sel_dist = reinterpret_cast<int*>(&m_bg_props[i].dist);
+				auto const prev_dist = m_bg_props[i].dist;
 				if (Combo("Distribution", sel_dist, m_getDistributorName,
 					const_cast<DistributorProperties*>(m_dist_infos.data()), static_cast<int>(m_dist_infos.size())))
 				{
 					m_bg_props[i].has_central_mass = m_dist_infos[*sel_dist].has_central_mass;
+					// the number of bodies belongs to the file, so is not kept when switching to or from one
+					if ((prev_dist == DistributorType::FROM_FILE) != (m_bg_props[i].dist == DistributorType::FROM_FILE))
+						m_bg_props[i].num = 0;
+					// embedded bodies were made by the previous distribution
+					if (m_bg_props[i].embedded)
+					{
+						m_bg_props[i].embedded.reset();
+						m_bg_props[i].num = 0;
+					}
 				}
 				PopItemWidth();
 				if (IsItemHovered() && *sel_dist != -1)
@@ -338,7 +405,7 @@ namespace nbody
 				}
 				Dummy({ 0, 5 });
 
-				ImVec2 btn_size(0.2f * GetContentRegionAvailWidth() - m_style.ItemSpacing.x, 0);
+				ImVec2 btn_size(GetContentRegionAvailWidth() / 6.f - m_style.ItemSpacing.x, 0);
 
 				// Mass range popup
 				if (Button("Mass...", btn_size))
@@ -409,6 +476,20 @@ namespace nbody
 					EndPopup();
 				}
 
+				// Seed popup
+				SameLine();
+				if (Button("Seed...", btn_size))
+				{
+					m_l2_modal_open = true;
+					SetNextWindowPosCenter();
+					OpenPopup("Seed setting");
+				}
+				if (BeginPopupModal("Seed setting", &m_l2_modal_open, m_window_flags))
+				{
+					makeSeedPopup(i);
+					EndPopup();
+				}
+
 				EndChild();
 			}
 			PopStyleVar(); // ImGuiStyleVar_ChildWindowRounding, 0.f
@@ -436,6 +517,30 @@ namespace nbody
 				EndTooltip();
 			}
 			PopItemWidth();
+			if (m_sim_props.mod_type == ModelType::BARNES_HUT)
+			{
+				Checkbox("Mixed precision", &m_sim_props.mixed_precision);
+				if (IsItemHovered())
+				{
+					BeginTooltip();
+					PushTextWrapPos(200);
+					TextWrapped("Evaluate forces in single precision and sum them in double precision. Faster, with a relative error in each acceleration of around 1e-6");
+					PopTextWrapPos();
+					EndTooltip();
+				}
+			}
+			PushItemWidth(150);
+			if (InputDoubleScientific("Merge radius (m)", &m_sim_props.merge_radius))
+				m_sim_props.merge_radius = std::max(m_sim_props.merge_radius, 0.);
+			if (IsItemHovered())
+			{
+				BeginTooltip();
+				PushTextWrapPos(200);
+				TextWrapped("Bodies closer together than this after a step are merged into one, keeping their total mass and momentum. 0 never merges bodies");
+				PopTextWrapPos();
+				EndTooltip();
+			}
+			PopItemWidth();
 			EndGroup();
 			auto sz = GetItemRectSize();
 			SameLine();
@@ -676,168 +781,158 @@ namespace nbody
 		}
 	}
 
-	void StartState::makeSavePopup()
+	void StartState::makeSeedPopup(size_t const idx) const
 	{
 		using namespace ImGui;
-
-		char static filename[256] = {};
-		InputText("Filename", filename, 256);
-		SetCursorPosX(0.5f * GetWindowContentRegionWidth());
+		auto seed = static_cast<int>(m_bg_props[idx].seed);
+		PushItemWidth(120.0f);
+		if (InputInt("Seed", &seed))
+		{
+			m_bg_props[idx].seed = static_cast<uint32_t>(std::max(seed, 0));
+		}
+		PopItemWidth();
+		SameLine();
+		ShowHelpMarker("The same seed always generates the same bodies, however many threads are used");
+		if (Button("Randomise"))
+		{
+			m_bg_props[idx].seed = IDistributor::randomSeed();
+		}
+		SameLine();
 		if (Button("OK"))
 		{
-			saveSettings(filename);
 			CloseCurrentPopup();
 		}
 	}
 
-	void StartState::saveSettings(char const* filename)
+	void StartState::makeFileInput(size_t const idx) const
 	{
-		std::ofstream file;
-		auto writeString = [&file](char const data[], size_t len) -> void
+		using namespace ImGui;
+		auto& bgp = m_bg_props[idx];
+		char buf[256] = {};
+		bgp.file_name.copy(buf, sizeof(buf) - 1);
+		PushItemWidth(CalcItemWidth() - CalcTextSize("Load").x - 2 * m_style.FramePadding.x - m_style.ItemSpacing.x);
+		if (InputText("##file", buf, sizeof(buf)))
 		{
-			file.write(data, len);
-			file.write(fileio::SEP, sizeof(fileio::SEP));
-		};
-
-		auto writeValue = [&file](auto data) -> void
+			bgp.file_name = buf;
+		}
+		PopItemWidth();
+		if (IsItemHovered())
+		{
+			BeginTooltip();
+			if (bgp.num > 0)
+				Text("%d bodies", bgp.num);
+			Text("A binary or CSV (x,y,vx,vy,m) particle file in SI units");
+			EndTooltip();
+		}
+		SameLine();
+		if (Button("Load"))
 		{
-			file.write(reinterpret_cast<char*>(&data), sizeof(decltype(data)));
-			file.write(fileio::SEP, sizeof(fileio::SEP));
-		};
+			try
+			{
+				bgp.num = static_cast<int>(DistributorFile::countBodies(bgp.file_name));
+				m_file_error.clear();
+			}
+			catch (Error const& e)
+			{
+				bgp.num = 0;
+				m_file_error = e.what();
+			}
+		}
+		if (bgp.num == 0 && !m_file_error.empty() && IsItemHovered())
+		{
+			SetTooltip("%s", m_file_error.c_str());
+		}
+	}
 
-		// if a file extension was supplied, trim it and append '.dat. instead
-		std::string fn_str(filename);
-		auto pos = fn_str.find_last_of('.');
-		if (pos != std::string::npos)
+	void StartState::makeEmbeddedInput(size_t const idx) const
+	{
+		using namespace ImGui;
+		auto& bgp = m_bg_props[idx];
+		Text("%d embedded bodies", bgp.num);
+		if (IsItemHovered())
 		{
-			fn_str.erase(pos);
+			SetTooltip("Bodies saved in the settings file, which are used instead of the distribution.\n"
+				"Discard them to generate the group again.");
 		}
-		fn_str.append(".dat");
+		SameLine();
+		if (Button("Discard"))
+		{
+			bgp.embedded.reset();
+			bgp.num = std::min(bgp.num, static_cast<int>(Constants::MAX_N));
+		}
+	}
 
-		file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+	void StartState::makeSavePopup()
+	{
+		using namespace ImGui;
 
-		try
+		char static filename[256] = {};
+		bool static embed = false;
+		std::string static save_error;
+		InputText("Filename", filename, 256);
+		Checkbox("Embed bodies", &embed);
+		if (IsItemHovered())
 		{
-			file.open(fn_str, std::ios::binary);
-			writeString(fileio::FILE_HEADER, fileio::SIZE_FH);
-			writeString(fileio::VERSION, fileio::SIZE_VER);
-			writeString(fileio::GLOBAL_HEADER, fileio::SIZE_GH);
-			writeValue(m_sim_props.timestep);
-			writeValue(m_sim_props.n_bodies);
-			writeValue(m_sim_props.int_type);
-			writeValue(m_sim_props.mod_type);
-			writeValue(m_bg_props.size());
-			std::for_each(m_bg_props.begin(), m_bg_props.end(), [&](BodyGroupProperties const& bgp) {
-				writeString(fileio::ITEM_HEADER, fileio::SIZE_IH);
-				writeValue(bgp.dist);
-				writeValue(bgp.num);
-				writeValue(bgp.pos);
-				writeValue(bgp.vel);
-				writeValue(bgp.radius);
-				writeValue(bgp.use_parsecs);
-				writeValue(bgp.min_mass);
-				writeValue(bgp.max_mass);
-				writeValue(bgp.has_central_mass);
-				writeValue(bgp.central_mass);
-				writeValue(bgp.colour);
-				for (auto c : bgp.cols)
-				{
-					writeValue(c);
-				}
-			});
-			file.close();
+			SetTooltip("Save the bodies of every group, so that loading the file gives exactly the same bodies");
 		}
-		catch (std::ofstream::failure const& fail)
+		if (!save_error.empty())
 		{
-			throw MAKE_ERROR(fail.what());
+			Text("%s", save_error.c_str());
+		}
+		SetCursorPosX(0.5f * GetWindowContentRegionWidth());
+		if (Button("OK"))
+		{
+			try
+			{
+				saveSettings(filename, embed);
+				save_error.clear();
+				CloseCurrentPopup();
+			}
+			catch (Error const& e)
+			{
+				save_error = e.what();
+			}
 		}
+	}
 
+	void StartState::saveSettings(char const* filename, bool const embed) const
+	{
+		auto props = m_sim_props;
+		if (embed)
+		{
+			for (auto& bgp : props.bg_props)
+			{
+				if (!bgp.embedded)
+					bgp.embedded = generateBodies(bgp);
+			}
+		}
+		SettingsFile::save(withExtension(filename), props);
 	}
 
 	bool StartState::loadSettings(char const * filename)
 	{
-		//using namespace fileio;
-		std::ifstream file;
-		auto readString = [&file](char const data[], size_t len) -> bool
-		{
-			auto buf = new char[len + 1];
-			file.read(buf, len);
-			auto str_read = !strcmp(data, buf);
-			delete[] buf;
-			char buf2[sizeof(fileio::SEP) + 1];
-			file.read(buf2, sizeof(fileio::SEP));
-			return str_read & !strcmp(buf2, fileio::SEP);
-		};
-		auto readValue = [&file](auto&& dest) -> bool
-		{
-			auto len = sizeof(dest);
-			auto buf = new char[len];
-			file.read(buf, len);
-			dest = reinterpret_cast<decltype(dest)>(*buf);
-			delete[] buf;
-			char buf2[sizeof(fileio::SEP) + 1];
-			file.read(buf2, sizeof(fileio::SEP));
-			return !strcmp(buf2, fileio::SEP);
-
-		};
-
-		std::string fn_str(filename);
-		// if a file extension was supplied, trim it and append '.dat. instead
-		auto pos = fn_str.find_last_of('.');
-		if (pos != std::string::npos)
-		{
-			fn_str.erase(pos);
-		}
-		fn_str.append(".dat");
-
 		try
 		{
-			file.open(fn_str, std::ios::binary);
-			if (!file.is_open())
-				throw MAKE_ERROR(std::string("file " + fn_str + " does not exist"));
-
-			auto good = readString(fileio::FILE_HEADER, fileio::SIZE_FH);
-			good &= readString(fileio::VERSION, fileio::SIZE_VER);
-			good &= readString(fileio::GLOBAL_HEADER, fileio::SIZE_GH);
-			if (!good)
-				throw MAKE_ERROR(std::string("could not read header of file ") + fn_str);
-			good &= readValue(m_sim_props.timestep);
-			good &= readValue(m_sim_props.n_bodies);
-			good &= readValue(m_sim_props.int_type);
-			good &= readValue(m_sim_props.mod_type);
-			if (!good)
-				throw MAKE_ERROR(std::string("could not read global properties in file ") + fn_str);
-			size_t n_groups;
-			readValue(n_groups);
-			m_bg_props.assign(n_groups, BodyGroupProperties());
-			std::for_each(m_bg_props.begin(), m_bg_props.end(), [&](BodyGroupProperties& bgp) {
-				good &= readString(fileio::ITEM_HEADER, fileio::SIZE_IH);
-				good &= readValue(bgp.dist);
-				good &= readValue(bgp.num);
-				good &= readValue(bgp.pos);
-				good &= readValue(bgp.vel);
-				good &= readValue(bgp.radius);
-				good &= readValue(bgp.use_parsecs);
-				good &= readValue(bgp.min_mass);
-				good &= readValue(bgp.max_mass);
-				good &= readValue(bgp.has_central_mass);
-				good &= readValue(bgp.central_mass);
-				good &= readValue(bgp.colour);
-				for (auto& colour : bgp.cols)
-				{
-					good &= readValue(colour);
-				}
-				if (!good)
-					throw MAKE_ERROR(std::string("could not read BodyGroup properties in file ") + fn_str);
-			});
-			file.close();
-			return good;
+			SettingsFile::load(withExtension(filename), m_sim_props);
+			return true;
 		}
-		catch (Error e)
+		catch (Error const& e)
 		{
-			file.close();
 			m_err_string = e.what();
 			return false;
 		}
 	}
-}
\ No newline at end of file
+
+	std::shared_ptr<ParticleImage const> StartState::generateBodies(BodyGroupProperties const & bgp) const
+	{
+		if (bgp.num <= 0 || bgp.dist == DistributorType::INVALID)
+			throw MAKE_ERROR("Every group must have a distribution and at least one body to embed its bodies");
+
+		auto const num = static_cast<size_t>(bgp.num);
+		std::vector<ParticleState> state(num);
+		std::vector<ParticleAuxState> aux_state(num);
+		ParticleData bodies(state.data(), aux_state.data());
+		m_sim->m_asset_mgr.getDistributor(bgp.dist)->createDistribution(bodies, bgp);
+		return DistributorFile::makeImage(bodies, num, bgp);
+	}
+}
@@ -12,11 +12,13 @@
 
 #include <SFML/Graphics.hpp>
 
+#include <memory>
 #include <vector>
 
 namespace nbody
 {
 	struct BodyGroupProperties;
+	struct ParticleImage;
 
 	enum class MenuState
 	{
@@ -62,10 +64,18 @@ namespace nbody
 		void makePosVelPopup(size_t const idx) const;
 		void makeRadiusPopup(size_t const idx) const;
 		void makeColourPopup(size_t const idx) const;
+		void makeSeedPopup(size_t const idx) const;
+		void makeFileInput(size_t const idx) const;
+		void makeEmbeddedInput(size_t const idx) const;
 		void makeSavePopup();
 
-		void saveSettings(char const* filename);
+		/**
+		 * \brief Save the settings, with every group's bodies if embed is set. Throws an Error on failure.
+		 */
+		void saveSettings(char const* filename, bool const embed) const;
 		bool loadSettings(char const* filename);
+		// Generate the bodies of a group to embed in a settings file
+		std::shared_ptr<ParticleImage const> generateBodies(BodyGroupProperties const& bgp) const;
 
 		bool m_do_run;
 
@@ -85,6 +95,8 @@ namespace nbody
 
 		// Error message from file load operations
 		std::string m_err_string;
+		// Error message from the last particle file loaded for a body group
+		mutable std::string m_file_error;
 
 		// Callback functions for drop-down menus
 		ComboCallback m_getDistributorName = callback<DPArray>;
@@ -92,19 +104,6 @@ namespace nbody
 		ComboCallback m_getIntegratorName = callback <IntArray>;
 		ComboCallback m_getModelName = callback<ModArray>;
 	};
-
-	namespace fileio
-	{
-		char constexpr FILE_HEADER[] = "nb_settings";
-		char constexpr VERSION[] = "v6";
-		char constexpr GLOBAL_HEADER[] = "global";
-		char constexpr ITEM_HEADER[] = "bgprop";
-		char constexpr SEP[] = "__";
-		size_t constexpr SIZE_FH = sizeof(FILE_HEADER);
-		size_t constexpr SIZE_VER = sizeof(VERSION);
-		size_t constexpr SIZE_GH = sizeof(GLOBAL_HEADER);
-		size_t constexpr SIZE_IH = sizeof(ITEM_HEADER);
-	}
 }
 
 #endif // START_STATE_H
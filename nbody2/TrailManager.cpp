@@ -1,10 +1,22 @@
+#include "Constants.h"
 #include "Display.h"
 #include "TrailManager.h"
 #include "Types.h"
 
+#include <algorithm>
+#include <numeric>
+
 namespace nbody
 {
-	TrailManager::TrailManager() : m_first_update(true), m_vtx_array(sf::Lines)
+	namespace
+	{
+		sf::Vector2f toParsecs(Vector2d const& pt)
+		{
+			return sf::Vector2f{ static_cast<float>(pt.x / Constants::PARSEC), static_cast<float>(pt.y / Constants::PARSEC) };
+		}
+	}
+
+	TrailManager::TrailManager() : m_first_update(true), m_head(0), m_points(0), m_num_bodies(0), m_cursor(0), m_rows(0)
 	{
 	}
 
@@ -12,49 +24,146 @@ namespace nbody
 	{
 	}
 
-	void TrailManager::update(Vector2d const* state, size_t const num_bodies)
+	void TrailManager::update(Vector2d const* state, bool const* removed, size_t const num_bodies)
 	{
 		auto bodies{ reinterpret_cast<ParticleState const*>(state) };
 
-		if (m_first_update)
+		if (!m_first_update && num_bodies > m_num_bodies)
 		{
-			// on first runthrough create circular buffers for body coordinates
-			m_world_coords.assign(num_bodies, CircularBuffer<Vector2d>{ s_TRAIL_LENGTH });
-			m_first_update = false;
+			// bodies have been added after the others, and their trails start where they are
+			std::vector<size_t> source(num_bodies, NO_SLOT);
+			std::iota(source.begin(), source.begin() + m_num_bodies, size_t{ 0 });
+			remap(state, source);
 		}
 
-		// all trails are redrawn each frame
-		m_vtx_array.clear();
+		if (m_first_update || num_bodies != m_num_bodies)
+		{
+			// on first runthrough, or when bodies have gone without the trails being rearranged,
+			// allocate the history of every body at once
+			m_world_coords.assign(s_TRAIL_LENGTH * num_bodies, Vector2d());
+			m_vertices.assign(2 * s_SEGMENTS * num_bodies, sf::Vertex());
+			m_num_bodies = num_bodies;
+			m_head = 0;
+			m_points = 0;
+			m_cursor = 0;
+			m_rows = 0;
+			m_first_update = false;
+		}
 
-		for (size_t i = 0; i < num_bodies; i++)
+		// store the current coordinates of the bodies in the oldest row of the history
+		// only the segment from each body's previous position to its current one is new
+		auto const coords = &m_world_coords[m_head * num_bodies];
+		auto const prev_coords = &m_world_coords[((m_head + s_TRAIL_LENGTH - 1) % s_TRAIL_LENGTH) * num_bodies];
+		auto const row = &m_vertices[2 * m_cursor * num_bodies];
+		auto const has_prev = m_points > 0;
+		#pragma omp parallel for schedule(static)
+		for (auto i = 0; i < static_cast<int>(num_bodies); i++)
 		{
-			// store the current coordinates of each body in a circular buffer
-			// when the buffer is full, new coordinates replace old
-			// the capacity of the buffer sets the length of the trails
-			m_world_coords[i].push_back(bodies[i].pos);
+			coords[i] = bodies[i].pos;
+			if (!has_prev)
+				continue;
 
-			for (size_t j = 0; j < m_world_coords[i].size() - 1; j++)
-			{
-				// when there are at least two coordinates stored
-				// can draw the trail
-				auto& pt{ m_world_coords[i][j + 1] };
-				auto& prev_pt{ m_world_coords[i][j] };
-
-				// trail made up of line segments from (n+1)th to nth point
-				m_vtx_array.append(sf::Vertex{ { Display::worldToScreenX(pt.x), Display::worldToScreenY(pt.y) } });
-				m_vtx_array.append(sf::Vertex{ { Display::worldToScreenX(prev_pt.x), Display::worldToScreenY(prev_pt.y) } });
-			}
+			// trail made up of line segments from (n+1)th to nth point, which are empty for tombstones
+			row[2 * i] = sf::Vertex{ toParsecs(coords[i]) };
+			row[2 * i + 1] = sf::Vertex{ toParsecs(removed[i] ? coords[i] : prev_coords[i]) };
+		}
+
+		m_head = (m_head + 1) % s_TRAIL_LENGTH;
+		m_points = std::min(m_points + 1, s_TRAIL_LENGTH);
+		if (has_prev)
+		{
+			m_cursor = (m_cursor + 1) % s_SEGMENTS;
+			m_rows = std::min(m_rows + 1, s_SEGMENTS);
 		}
+
+		// the view is applied to all the segments at once when they are drawn
+		auto const t = Display::worldToScreenTransform();
+		m_transform = sf::Transform(
+			static_cast<float>(t.scale_x * Constants::PARSEC), 0.f, static_cast<float>(t.offset_x),
+			0.f, static_cast<float>(t.scale_y * Constants::PARSEC), static_cast<float>(t.offset_y),
+			0.f, 0.f, 1.f);
 	}
 
 	void TrailManager::reset()
 	{
-		m_vtx_array.clear();
+		m_world_coords.clear();
+		m_vertices.clear();
+		m_rows = 0;
 		m_first_update = true;
 	}
 
+	void TrailManager::permute(std::vector<size_t> const& order)
+	{
+		if (m_first_update)
+			return;
+
+		// bodies added since the last update have no trail to move
+		if (std::any_of(order.begin(), order.end(), [this](size_t const i) { return i >= m_num_bodies; }))
+		{
+			reset();
+			return;
+		}
+
+		remap(nullptr, order);
+	}
+
+	void TrailManager::restart(Vector2d const* state, std::vector<size_t> const& slots)
+	{
+		if (m_first_update)
+			return;
+
+		// every other body keeps its trail in its slot
+		std::vector<size_t> source(m_num_bodies);
+		std::iota(source.begin(), source.end(), size_t{ 0 });
+		for (auto const slot : slots)
+		{
+			if (slot < m_num_bodies)
+				source[slot] = NO_SLOT;
+		}
+		remap(state, source);
+	}
+
+	void TrailManager::remap(Vector2d const* state, std::vector<size_t> const& source)
+	{
+		auto bodies{ reinterpret_cast<ParticleState const*>(state) };
+
+		// each row of positions and segments is in the same order as the bodies
+		auto const old_coords = std::move(m_world_coords);
+		auto const old_vertices = std::move(m_vertices);
+		auto const old_num = m_num_bodies;
+		auto const num = source.size();
+		m_world_coords.assign(s_TRAIL_LENGTH * num, Vector2d());
+		m_vertices.assign(2 * s_SEGMENTS * num, sf::Vertex());
+		#pragma omp parallel for schedule(static)
+		for (auto i = 0; i < static_cast<int>(num); i++)
+		{
+			auto const j = source[i];
+			if (j == NO_SLOT)
+			{
+				auto const point = sf::Vertex{ toParsecs(bodies[i].pos) };
+				for (size_t r = 0; r < s_TRAIL_LENGTH; r++)
+					m_world_coords[r * num + i] = bodies[i].pos;
+				for (size_t r = 0; r < m_rows; r++)
+					m_vertices[2 * (r * num + i)] = m_vertices[2 * (r * num + i) + 1] = point;
+				continue;
+			}
+
+			for (size_t r = 0; r < s_TRAIL_LENGTH; r++)
+				m_world_coords[r * num + i] = old_coords[r * old_num + j];
+			for (size_t r = 0; r < m_rows; r++)
+			{
+				m_vertices[2 * (r * num + i)] = old_vertices[2 * (r * old_num + j)];
+				m_vertices[2 * (r * num + i) + 1] = old_vertices[2 * (r * old_num + j) + 1];
+			}
+		}
+		m_num_bodies = num;
+	}
+
 	void TrailManager::draw(sf::RenderTarget & target, sf::RenderStates states) const
 	{
-		target.draw(m_vtx_array);
+		if (m_rows == 0)
+			return;
+		states.transform *= m_transform;
+		target.draw(m_vertices.data(), 2 * m_rows * m_num_bodies, sf::Lines, states);
 	}
 }
\ No newline at end of file
@@ -1,7 +1,6 @@
 #ifndef TRAIL_MANAGER_H
 #define TRAIL_MANAGER_H
 
-#include "CircularBuffer.h"
 #include "Vector.h"
 
 #include <vector>
@@ -17,17 +16,54 @@ namespace nbody
 		TrailManager();
 		~TrailManager();
 
-		void update(Vector2d const* state, size_t const num_bodies);
+		/**
+		 * \brief Add the latest segment of each trail. Bodies added since the last update start new trails,
+		 *		  and the trails of tombstones stop growing, so fade out.
+		 * \param removed Whether each body is a tombstone.
+		 */
+		void update(Vector2d const* state, bool const* removed, size_t const num_bodies);
 		void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
 		void reset();
 
+		/**
+		 * \brief Rearrange the stored trails after the particle arrays have been sorted or compacted.
+		 * \param order The body now in slot i was previously in slot order[i].
+		 */
+		void permute(std::vector<size_t> const& order);
+
+		/**
+		 * \brief Start the trails of some bodies again from where they are now, e.g. after they have jumped.
+		 * \param slots The slots of those bodies.
+		 */
+		void restart(Vector2d const* state, std::vector<size_t> const& slots);
+
 	private:
+		/**
+		 * \brief Copy each stored row into rows of num_bodies bodies, the body in slot i of each taken from
+		 *		  slot source[i], or from the body's current position if source[i] is NO_SLOT.
+		 */
+		void remap(Vector2d const* state, std::vector<size_t> const& source);
+
 		constexpr static size_t s_TRAIL_LENGTH = 10;
+		constexpr static size_t s_SEGMENTS = s_TRAIL_LENGTH - 1;
 
 		bool m_first_update;
 
-		std::vector<CircularBuffer<Vector2d>> m_world_coords;
-		sf::VertexArray m_vtx_array;
+		// the last s_TRAIL_LENGTH positions of the bodies, as one row of num_bodies positions per step,
+		// each step overwriting the oldest row
+		std::vector<Vector2d> m_world_coords;
+		// the row the next positions are written to, and the number of rows written so far
+		size_t m_head;
+		size_t m_points;
+		// the line segments of the trails in parsecs, as s_SEGMENTS rows of one segment per body,
+		// each step overwriting the oldest row, so that the vertices are only converted once
+		std::vector<sf::Vertex> m_vertices;
+		size_t m_num_bodies;
+		// the row the next segments are written to, and the number of rows written so far
+		size_t m_cursor;
+		size_t m_rows;
+		// maps parsecs to the screen, as it was when the trails were last updated
+		sf::Transform m_transform;
 	};
 }
 
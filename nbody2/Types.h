@@ -4,6 +4,10 @@
 #include "Vector.h"
 #include <SFML/Graphics/Color.hpp>
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
 #pragma pack(push, 1)
 
 namespace nbody
@@ -63,6 +67,38 @@ namespace nbody
 		ParticleAuxState * m_aux_state;
 		ParticleDerivState * m_deriv_state;
 	};
+
+	// the slot of a body which is no longer in the arrays
+	size_t constexpr NO_SLOT = SIZE_MAX;
+
+	/**
+	 * \brief Rearrange an array so that the element at position i is the one previously at position order[i].
+	 * \param arr Array holding at least every element in order.
+	 * \param order The permutation to apply. Elements left out of it are dropped, and the first order.size()
+	 *		  elements are then the ones kept.
+	 */
+	template<typename T>
+	void applyOrder(T * arr, std::vector<size_t> const& order)
+	{
+		auto const num_old = order.empty() ? 0 : *std::max_element(order.begin(), order.end()) + 1;
+		std::vector<T> old(arr, arr + std::max(num_old, order.size()));
+
+#pragma omp parallel for schedule(static)
+		for (int i = 0; i < static_cast<int>(order.size()); i++)
+			arr[i] = old[order[i]];
+	}
+
+	/**
+	 * \brief Move the first num elements of an array allocated with new[] into a new one of a greater capacity.
+	 */
+	template<typename T>
+	void reallocate(T *& arr, size_t const num, size_t const capacity)
+	{
+		auto grown = new T[capacity];
+		std::copy(arr, arr + num, grown);
+		delete[] arr;
+		arr = grown;
+	}
 }
 
 #endif // !TYPES_H
\ No newline at end of file
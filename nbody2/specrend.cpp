@@ -230,15 +230,15 @@ namespace specrend
 	a light source with spectral distribution given by  the
 	function SPEC_INTENS, which is called with a series of
 	wavelengths between 380 and 780 nm (the argument is
-	expressed in meters), which returns emittance at  that
-	wavelength in arbitrary units.  The chromaticity
+	expressed in meters) and the given TEMPERATURE, which
+	returns emittance at  that wavelength in arbitrary units.  The chromaticity
 	coordinates of the spectrum are returned in the x, y, and z
 	arguments which respect the identity:
 	x + y + z = 1.
 	*/
 
-	void spectrum_to_xyz(double(*spec_intens)(double wavelength),
-		double *x, double *y, double *z)
+	void spectrum_to_xyz(double(*spec_intens)(double wavelength, double temperature),
+		double temperature, double *x, double *y, double *z)
 	{
 		int i;
 		double lambda, X = 0, Y = 0, Z = 0, XYZ;
@@ -289,7 +289,7 @@ namespace specrend
 		for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
 			double Me;
 
-			Me = (*spec_intens)(lambda);
+			Me = (*spec_intens)(lambda, temperature);
 			X += Me * cie_colour_match[i][0];
 			Y += Me * cie_colour_match[i][1];
 			Z += Me * cie_colour_match[i][2];
@@ -302,16 +302,14 @@ namespace specrend
 
 	/*                            BB_SPECTRUM
 	Calculate, by Planck's radiation law, the emittance of a black body
-	of temperature bbTemp at the given wavelength (in metres).  */
+	of the given temperature at the given wavelength (in metres).  */
 
-	double bbTemp = 5000;                 /* Hidden temperature argument
-										  to BB_SPECTRUM. */
-	double bb_spectrum(double wavelength)
+	double bb_spectrum(double wavelength, double temperature)
 	{
 		double wlm = wavelength * 1e-9;   /* Wavelength in meters */
 
 		return (3.74183e-16 * pow(wlm, -5.0)) /
-			(exp(1.4388e-2 / (wlm * bbTemp)) - 1.0);
+			(exp(1.4388e-2 / (wlm * temperature)) - 1.0);
 	}
 }
 
@@ -348,8 +346,7 @@ struct colourSystem *cs = &SMPTEsystem;
 printf("Temperature       x      y      z       R     G     B\n");
 printf("-----------    ------ ------ ------   ----- ----- -----\n");
 for (t = 1000; t <= 10000; t+= 500) {
-bbTemp = t;
-spectrum_to_xyz(bb_spectrum, &x, &y, &z);
+spectrum_to_xyz(bb_spectrum, t, &x, &y, &z);
 xyz_to_rgb(cs, x, y, z, &r, &g, &b);
 printf("  %5.0f K      %.4f %.4f %.4f   ", t, x, y, z);
 if (constrain_rgb(&r, &g, &b)) {
@@ -21,14 +21,12 @@ namespace specrend
 	extern colourSystem SMPTEsystem;
 	extern colourSystem CIEsystem;
 	extern colourSystem Rec709system;
-	extern double bbTemp;                 /* Hidden temperature argument */
 
-	void spectrum_to_xyz(double(*spec_intens)(double wavelength), double *x, double *y, double *z);
+	void spectrum_to_xyz(double(*spec_intens)(double wavelength, double temperature), double temperature, double *x, double *y, double *z);
 	extern void xyz_to_rgb(struct colourSystem *cs, double xc, double yc, double zc, double *r, double *g, double *b);
-	extern double bb_spectrum(double wavelength);
 	extern int constrain_rgb(double *r, double *g, double *b);
 	extern void norm_rgb(double *r, double *g, double *b);
-	extern double bb_spectrum(double wavelength);
+	extern double bb_spectrum(double wavelength, double temperature);
 }
 
 #endif // SPECREND_H
\ No newline at end of file